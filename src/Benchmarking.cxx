@@ -1,3 +1,19 @@
+/**
+\file  Benchmarking.cxx
+
+\brief Benchmark harness for the toolkit kernels.
+
+Runs registered kernels over every subject found in the data directory and records wall time,
+CPU time and memory (using cbica::getCurrentlyUsedMemoryByCurrentProcess()) per kernel and subject.
+Results are written as CSV and/or JSON and can be compared against a previous run to catch performance regressions.
+
+https://www.med.upenn.edu/cbica/captk/ <br>
+software@cbica.upenn.edu
+
+Copyright (c) 2018 University of Pennsylvania. All rights reserved. <br>
+See COPYING file or https://www.med.upenn.edu/cbica/software-agreement.html
+
+*/
 #include <iostream>
 #include <iterator>
 #include <stdlib.h>
@@ -7,6 +23,10 @@
 #include <typeinfo>
 #include <stdexcept>
 #include <stdio.h>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <map>
 #if(WIN32)
 #include <direct.h>
 #else
@@ -17,19 +37,394 @@
 #include "cbicaUtilities.h"
 #include "cbicaLogging.h"
 
+#include "cbicaITKImageInfo.h"
+#include "cbicaITKSafeImageIO.h"
+#include "cbicaITKUtilities.h"
+#include "itkN3MRIBiasFieldCorrectionImageFilter.h"
+#include "itkDiffusionTensor3DReconstructionImageFilter.h"
+
+using ImageTypeFloat4D = itk::Image< float, 4 >;
+
+//! The files that were detected for a single subject
+struct SubjectData
+{
+  std::string name, directory;
+  std::vector< std::string > inputFiles, // files which need to run through the kernel
+    outputFiles, // files which need to be compared with the output obtained after processing the inputFiles
+    allFiles; // everything in the subject directory (used to pick up side-car files like bval/bvec)
+};
+
+//! Timing and memory record of a single kernel run on a single subject
+struct BenchmarkResult
+{
+  std::string subject, kernel, status = "OK";
+  size_t iteration = 0;
+  double wallTime_ms = 0, cpuTime_ms = 0;
+  size_t memoryBefore = 0, memoryAfter = 0, memoryPeak = 0;
+};
+
+/**
+\brief A kernel does all its (untimed) data preparation from the subject's files and returns the work that needs to be timed
+
+Throw an std::runtime_error during preparation if the subject doesn't have the data the kernel needs; it gets recorded as 'SKIPPED'.
+*/
+using KernelPreparer = std::function< std::function< void() >(const SubjectData &) >;
+
+//! Returns the first file in the list which has the specified image dimension
+inline std::string GetFirstImageWithDimension(const std::vector< std::string > &files, const unsigned int dimension)
+{
+  for (const auto &file : files)
+  {
+    auto ext = cbica::getFilenameExtension(file, false);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if ((ext == ".nii.gz") || (ext == ".nii") || (ext == ".nrrd") || (ext == ".mha"))
+    {
+      if (cbica::ImageInfo(file).GetImageDimensions() == dimension)
+      {
+        return file;
+      }
+    }
+  }
+  throw std::runtime_error("No image of dimension '" + std::to_string(dimension) + "' was found");
+}
+
+//! Returns the first file in the list which has the specified extension
+inline std::string GetFirstFileWithExtension(const std::vector< std::string > &files, const std::string &extension)
+{
+  for (const auto &file : files)
+  {
+    if (cbica::getFilenameExtension(file, false) == extension)
+    {
+      return file;
+    }
+  }
+  throw std::runtime_error("No file with extension '" + extension + "' was found");
+}
+
+//! Reads all white-space separated values of an FSL-style bval/bvec file
+inline std::vector< double > ReadWhiteSpaceSeparatedValues(const std::string &fileName)
+{
+  std::vector< double > returnVector;
+  std::ifstream file(fileName.c_str());
+  double value;
+  while (file >> value)
+  {
+    returnVector.push_back(value);
+  }
+  return returnVector;
+}
+
+//! All the kernels that can be benchmarked; add new entries here
+std::map< std::string, KernelPreparer > GetRegisteredKernels()
+{
+  std::map< std::string, KernelPreparer > kernels;
+
+  kernels["ReadImage"] = [](const SubjectData &subject)
+  {
+    if (subject.inputFiles.empty())
+    {
+      throw std::runtime_error("No input files");
+    }
+    // the header probe that picks the dimension is part of the preparation, so only the reads are timed
+    std::vector< std::pair< std::string, bool > > filesAndIs4D;
+    for (const auto &file : subject.inputFiles)
+    {
+      filesAndIs4D.emplace_back(file, cbica::ImageInfo(file).GetImageDimensions() == 4);
+    }
+    return std::function< void() >([filesAndIs4D]()
+    {
+      for (const auto &fileAndIs4D : filesAndIs4D)
+      {
+        if (fileAndIs4D.second)
+        {
+          cbica::ReadImage< ImageTypeFloat4D >(fileAndIs4D.first);
+        }
+        else
+        {
+          cbica::ReadImage< ImageTypeFloat3D >(fileAndIs4D.first);
+        }
+      }
+    });
+  };
+
+  kernels["ResampleImage"] = [](const SubjectData &subject)
+  {
+    auto inputImage = cbica::ReadImage< ImageTypeFloat3D >(GetFirstImageWithDimension(subject.inputFiles, 3));
+    return std::function< void() >([inputImage]()
+    {
+      cbica::ResampleImage< ImageTypeFloat3D >(inputImage, 1.0, "Linear");
+    });
+  };
+
+  kernels["GetLabelStatistics"] = [](const SubjectData &subject)
+  {
+    auto label_1 = cbica::ReadImage< ImageTypeFloat3D >(GetFirstImageWithDimension(subject.inputFiles, 3));
+    auto label_2 = cbica::ReadImage< ImageTypeFloat3D >(GetFirstImageWithDimension(subject.outputFiles, 3));
+    return std::function< void() >([label_1, label_2]()
+    {
+      cbica::GetLabelStatistics< ImageTypeFloat3D >(label_1, label_2);
+    });
+  };
+
+  kernels["DTI"] = [](const SubjectData &subject)
+  {
+    using ReconstructionFilterType = itk::DiffusionTensor3DReconstructionImageFilter< float, float, double >;
+
+    auto dwiImage = cbica::ReadImage< ImageTypeFloat4D >(GetFirstImageWithDimension(subject.inputFiles, 4));
+    auto bValues = ReadWhiteSpaceSeparatedValues(GetFirstFileWithExtension(subject.allFiles, ".bval"));
+    auto bVectors = ReadWhiteSpaceSeparatedValues(GetFirstFileWithExtension(subject.allFiles, ".bvec"));
+    // the volumes are views into dwiImage, which is kept alive by the kernel below
+    auto volumes = cbica::GetExtractedImages< ImageTypeFloat4D, ImageTypeFloat3D >(dwiImage, 3, false, true);
+
+    if ((bValues.size() != volumes.size()) || (bVectors.size() != 3 * volumes.size()))
+    {
+      throw std::runtime_error("Number of volumes doesn't match bval/bvec entries");
+    }
+
+    // the filter only takes a single reference volume when gradients are passed as separate images
+    auto filter = ReconstructionFilterType::New();
+    bool referenceFound = false;
+    double bValue = 0;
+    for (size_t i = 0; i < volumes.size(); i++)
+    {
+      if (bValues[i] == 0)
+      {
+        if (!referenceFound)
+        {
+          filter->SetReferenceImage(volumes[i]);
+          referenceFound = true;
+        }
+      }
+      else
+      {
+        // FSL stores the vectors as 3 rows of N values
+        ReconstructionFilterType::GradientDirectionType direction;
+        direction[0] = bVectors[i];
+        direction[1] = bVectors[volumes.size() + i];
+        direction[2] = bVectors[2 * volumes.size() + i];
+        filter->AddGradientImage(direction, volumes[i]);
+        bValue = bValues[i];
+      }
+    }
+    if (!referenceFound)
+    {
+      throw std::runtime_error("No b0 volume was found");
+    }
+    filter->SetBValue(bValue);
+
+    return std::function< void() >([filter, dwiImage]()
+    {
+      filter->Modified();
+      filter->Update();
+    });
+  };
+
+  kernels["N3"] = [](const SubjectData &subject)
+  {
+    auto inputImage = cbica::ReadImage< ImageTypeFloat3D >(GetFirstImageWithDimension(subject.inputFiles, 3));
+    return std::function< void() >([inputImage]()
+    {
+      auto corrector = itk::N3MRIBiasFieldCorrectionImageFilter< ImageTypeFloat3D >::New();
+      corrector->SetInput(inputImage);
+      corrector->Update();
+    });
+  };
+
+  return kernels;
+}
+
+//! Times a single kernel invocation
+BenchmarkResult RunKernel(const std::function< void() > &kernel)
+{
+  BenchmarkResult result;
+  // the high-water mark covers the whole process, so it is reset to measure this kernel alone; where that is not
+  // possible, the peak of the kernel is only known if it sets a new high for the process (otherwise a lower bound is given)
+  const bool peakWasReset = cbica::resetPeakMemoryUsedByCurrentProcess();
+  const size_t peakBefore = cbica::getPeakMemoryUsedByCurrentProcess();
+  result.memoryBefore = cbica::getCurrentlyUsedMemoryByCurrentProcess();
+
+  auto wallStart = std::chrono::steady_clock::now();
+  auto cpuStart = std::clock();
+  try
+  {
+    kernel();
+  }
+  catch (const std::exception &e)
+  {
+    result.status = std::string("FAILED: ") + e.what();
+  }
+  auto cpuEnd = std::clock();
+  auto wallEnd = std::chrono::steady_clock::now();
+
+  result.memoryAfter = cbica::getCurrentlyUsedMemoryByCurrentProcess();
+  const size_t peakAfter = cbica::getPeakMemoryUsedByCurrentProcess();
+  result.memoryPeak = (peakWasReset || (peakAfter > peakBefore)) ? peakAfter : std::max(result.memoryBefore, result.memoryAfter);
+  result.wallTime_ms = std::chrono::duration< double, std::milli >(wallEnd - wallStart).count();
+  result.cpuTime_ms = 1000.0 * static_cast< double >(cpuEnd - cpuStart) / CLOCKS_PER_SEC;
+
+  return result;
+}
+
+//! Strips characters which would break the CSV output
+inline std::string SanitizeForOutput(const std::string &input)
+{
+  std::string returnString = input;
+  std::replace(returnString.begin(), returnString.end(), ',', ';');
+  std::replace(returnString.begin(), returnString.end(), '"', '\'');
+  std::replace(returnString.begin(), returnString.end(), '\n', ' ');
+  std::replace(returnString.begin(), returnString.end(), '\\', '/');
+  return returnString;
+}
+
+//! Escapes a string for a JSON string literal: quotes, backslashes and control characters
+inline std::string EscapeForJSON(const std::string &input)
+{
+  std::string returnString;
+  returnString.reserve(input.size());
+  for (const char character : input)
+  {
+    if ((character == '"') || (character == '\\'))
+    {
+      returnString += '\\';
+      returnString += character;
+    }
+    else if (static_cast< unsigned char >(character) < 0x20)
+    {
+      char escaped[7];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast< unsigned int >(static_cast< unsigned char >(character)));
+      returnString += escaped;
+    }
+    else
+    {
+      returnString += character;
+    }
+  }
+  return returnString;
+}
+
+void WriteResultsCSV(const std::string &fileName, const std::vector< BenchmarkResult > &results)
+{
+  std::ofstream file(fileName.c_str());
+  file << "Version,Subject,Kernel,Iteration,Status,WallTime_ms,CPUTime_ms,MemoryBefore_bytes,MemoryAfter_bytes,PeakMemory_bytes\n";
+  for (const auto &result : results)
+  {
+    file << PROJECT_VERSION << "," << SanitizeForOutput(result.subject) << "," << SanitizeForOutput(result.kernel) << "," << result.iteration << "," <<
+      SanitizeForOutput(result.status) << "," << result.wallTime_ms << "," << result.cpuTime_ms << "," <<
+      result.memoryBefore << "," << result.memoryAfter << "," << result.memoryPeak << "\n";
+  }
+}
+
+void WriteResultsJSON(const std::string &fileName, const std::vector< BenchmarkResult > &results)
+{
+  std::ofstream file(fileName.c_str());
+  file << "{\n  \"version\": \"" << EscapeForJSON(PROJECT_VERSION) << "\",\n  \"timestamp\": \"" << EscapeForJSON(cbica::getCurrentLocalDateAndTime()) <<
+    "\",\n  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); i++)
+  {
+    const auto &result = results[i];
+    file << "    { \"subject\": \"" << EscapeForJSON(result.subject) << "\", \"kernel\": \"" << EscapeForJSON(result.kernel) <<
+      "\", \"iteration\": " << result.iteration << ", \"status\": \"" << EscapeForJSON(result.status) <<
+      "\", \"wallTime_ms\": " << result.wallTime_ms << ", \"cpuTime_ms\": " << result.cpuTime_ms <<
+      ", \"memoryBefore_bytes\": " << result.memoryBefore << ", \"memoryAfter_bytes\": " << result.memoryAfter <<
+      ", \"peakMemory_bytes\": " << result.memoryPeak << " }" << ((i + 1 < results.size()) ? "," : "") << "\n";
+  }
+  file << "  ]\n}\n";
+}
+
+//! Mean wall time per kernel over all successful runs
+std::map< std::string, double > GetMeanWallTimePerKernel(const std::vector< BenchmarkResult > &results)
+{
+  std::map< std::string, double > sums;
+  std::map< std::string, size_t > counts;
+  for (const auto &result : results)
+  {
+    if (result.status == "OK")
+    {
+      sums[result.kernel] += result.wallTime_ms;
+      counts[result.kernel]++;
+    }
+  }
+  for (auto &sum : sums)
+  {
+    sum.second /= static_cast< double >(counts[sum.first]);
+  }
+  return sums;
+}
+
+/**
+\brief Compares the current run with a previously written CSV and returns the number of kernels that regressed
+
+\param baselineFile CSV written by an earlier run of this executable
+\param results The results of the current run
+\param tolerance Allowed slow-down in percent before a kernel is flagged
+*/
+size_t CompareWithBaseline(const std::string &baselineFile, const std::vector< BenchmarkResult > &results, const float tolerance, cbica::Logging &logger)
+{
+  auto baselineRows = cbica::readCSVDataFile(baselineFile);
+  std::vector< BenchmarkResult > baselineResults;
+  for (size_t i = 1; i < baselineRows.size(); i++) // skip header
+  {
+    if (baselineRows[i].size() < 7)
+    {
+      continue;
+    }
+    BenchmarkResult result;
+    result.subject = baselineRows[i][1];
+    result.kernel = baselineRows[i][2];
+    result.status = baselineRows[i][4];
+    result.wallTime_ms = std::atof(baselineRows[i][5].c_str());
+    baselineResults.push_back(result);
+  }
+
+  auto baselineMeans = GetMeanWallTimePerKernel(baselineResults);
+  auto currentMeans = GetMeanWallTimePerKernel(results);
+
+  size_t regressions = 0;
+  for (const auto &current : currentMeans)
+  {
+    auto baseline = baselineMeans.find(current.first);
+    if ((baseline == baselineMeans.end()) || (baseline->second <= 0))
+    {
+      continue;
+    }
+    auto change = 100.0 * (current.second - baseline->second) / baseline->second;
+    auto message = "Kernel '" + current.first + "': baseline = " + std::to_string(baseline->second) +
+      "ms, current = " + std::to_string(current.second) + "ms, change = " + std::to_string(change) + "%";
+    if (change > tolerance)
+    {
+      logger.WriteError("Regression: " + message);
+      regressions++;
+    }
+    else
+    {
+      logger.Write(message);
+    }
+  }
+  return regressions;
+}
+
 int main(int argc, char** argv)
 {
-  cbica::IsCompatible(argv[1]);
   cbica::CmdParser parser(argc, argv);
   parser.addRequiredParameter("d", "dataDir", cbica::Parameter::DIRECTORY, "none", "Parent directory where all data is present");
   parser.addRequiredParameter("i", "inputPatterns", cbica::Parameter::STRING, "comma separated entries", "String pattern(s) for the input files");
   parser.addRequiredParameter("o", "outputPatterns", cbica::Parameter::STRING, "comma separated entries", "String pattern(s) for the output files");
+  parser.addOptionalParameter("k", "kernels", cbica::Parameter::STRING, "comma separated entries", "Kernels to run", "Defaults to all: DTI,GetLabelStatistics,N3,ReadImage,ResampleImage");
+  parser.addOptionalParameter("n", "iterations", cbica::Parameter::INTEGER, "1 to 1000", "Number of times each kernel is run per subject", "Defaults to 1");
+  parser.addOptionalParameter("c", "csvOutput", cbica::Parameter::FILE, "csv file", "File to write the per-kernel results as CSV", "Defaults to cbica::makeTempDir()/Benchmarking.csv");
+  parser.addOptionalParameter("j", "jsonOutput", cbica::Parameter::FILE, "json file", "File to write the per-kernel results as JSON");
+  parser.addOptionalParameter("b", "baseline", cbica::Parameter::FILE, "csv file", "CSV from an earlier run to compare against", "Exit code is non-zero if any kernel regressed");
+  parser.addOptionalParameter("t", "tolerance", cbica::Parameter::FLOAT, "0 to 1000", "Allowed slow-down (in %) compared to baseline", "Defaults to 10");
   parser.addOptionalParameter("L", "LogFile", cbica::Parameter::FILE, "text file", "File to write all logging information", "Defualts to cbica::makeTempDir()/Benchmarking.log");
-  parser.exampleUsage("-d C:/here/is/my/Data/ -i fixed,moving -o output");
+  parser.exampleUsage("-d C:/here/is/my/Data/ -i fixed,moving -o output -k ReadImage,N3 -n 3 -j C:/output/results.json");
 
-  std::string logFile = cbica::createTmpDir() + "Benchmarking.log", inputPatterns, outputPatterns, dataDir;
+  const std::string tempDir = cbica::createTmpDir();
+  std::string logFile = tempDir + "Benchmarking.log", csvFile = tempDir + "Benchmarking.csv",
+    jsonFile, baselineFile, inputPatterns, outputPatterns, dataDir, kernelsToRun;
+  int iterations = 1;
+  float tolerance = 10;
 
-  if (parser.isPresent("u") || (argc < 2) || (argc > 5))
+  if (parser.isPresent("u") || (argc < 2))
   {
     parser.echoUsage();
     return EXIT_SUCCESS;
@@ -51,12 +446,36 @@ int main(int argc, char** argv)
   parser.getParameterValue("d", dataDir);
   parser.getParameterValue("i", inputPatterns);
   parser.getParameterValue("o", outputPatterns);
-  if (parser.isPresent("-L"))
+  if (parser.isPresent("L"))
   {
-    parser.getParameterValue("-L", logFile);
+    parser.getParameterValue("L", logFile);
+  }
+  if (parser.isPresent("k"))
+  {
+    parser.getParameterValue("k", kernelsToRun);
+  }
+  if (parser.isPresent("n"))
+  {
+    parser.getParameterValue("n", iterations);
+  }
+  if (parser.isPresent("c"))
+  {
+    parser.getParameterValue("c", csvFile);
+  }
+  if (parser.isPresent("j"))
+  {
+    parser.getParameterValue("j", jsonFile);
+  }
+  if (parser.isPresent("b"))
+  {
+    parser.getParameterValue("b", baselineFile);
+  }
+  if (parser.isPresent("t"))
+  {
+    parser.getParameterValue("t", tolerance);
   }
   cbica::Logging logger = cbica::Logging(logFile, "Starting Benchmarking");
-  
+
   // exit if the directory is not found
   if (!cbica::isDir(dataDir))
   {
@@ -70,24 +489,45 @@ int main(int argc, char** argv)
     dataDir.append("/");
   }
 
+  // select the kernels to run
+  auto registeredKernels = GetRegisteredKernels();
+  std::map< std::string, KernelPreparer > selectedKernels;
+  if (kernelsToRun.empty())
+  {
+    selectedKernels = registeredKernels;
+  }
+  else
+  {
+    for (const auto &kernel : cbica::stringSplit(kernelsToRun, ","))
+    {
+      if (registeredKernels.find(kernel) == registeredKernels.end())
+      {
+        logger.WriteError("Kernel '" + kernel + "' is not registered");
+        return EXIT_FAILURE;
+      }
+      selectedKernels[kernel] = registeredKernels[kernel];
+    }
+  }
+
   // start making sense of the inputs from the command line by converting them to vector of strings
   std::vector< std::string > inputPatterns_vector  = cbica::stringSplit(inputPatterns , ",");
   std::vector< std::string > outputPatterns_vector = cbica::stringSplit(outputPatterns, ",");
   std::vector< std::string > detectedSubjects = cbica::subdirectoriesInDirectory(dataDir);
+  std::vector< BenchmarkResult > results;
 
   for (size_t i = 0; i < detectedSubjects.size(); i++)
   {
-    const std::string subjectUnderConsideration = dataDir + detectedSubjects[i] + "/";
-    std::vector< std::string > filesPerSubject = cbica::filesInDirectory(subjectUnderConsideration);
-    std::vector< std::string > inputFiles, // this will contain the input files which need to run through the algorithm
-      outputFiles; // this will contain the files which need to be compared with the output obtained after processing the inputFiles
+    SubjectData subject;
+    subject.name = detectedSubjects[i];
+    subject.directory = dataDir + detectedSubjects[i] + "/";
+    subject.allFiles = cbica::filesInDirectory(subject.directory);
     std::vector< size_t > outputFileIndeces;
 
-    for (size_t j = 0; j < filesPerSubject.size(); j++)
+    for (size_t j = 0; j < subject.allFiles.size(); j++)
     {
       // FileNameParts is a custom struct that holds the full path, base and extensions of a particular file
-      const FileNameParts fileUnderConsideration = FileNameParts(filesPerSubject[j]);
-      
+      const FileNameParts fileUnderConsideration = FileNameParts(subject.allFiles[j]);
+
       // ensure file is present
       if (!cbica::fileExists(fileUnderConsideration.fullFileName))
       {
@@ -102,37 +542,89 @@ int main(int argc, char** argv)
         // this can be easily made modular using a command line option
         if (fileUnderConsideration.base.find(outputPatterns_vector[k]) != std::string::npos)
         {
-          outputFiles.push_back(fileUnderConsideration.fullFileName);
-          outputFileIndeces.push_back(j); // store the indeces where the output file patterns are obtained 
+          subject.outputFiles.push_back(fileUnderConsideration.fullFileName);
+          outputFileIndeces.push_back(j); // store the indeces where the output file patterns are obtained
+          break;
         }
       } // end k-for
     } // end j-for
 
-    // the reason why input and output patterns are being processes separately is to take care of the possibility of encountering a 
+    // the reason why input and output patterns are being processes separately is to take care of the possibility of encountering a
     // file named like 'movingImage_T1_processed_output.nii.gz'
-    for (size_t j = 0; j < filesPerSubject.size(); j++)
+    for (size_t j = 0; j < subject.allFiles.size(); j++)
     {
-      // don't do anything if the output filename pattern was found 
-      if (std::find(outputFileIndeces.begin(), outputFileIndeces.end(), j) == outputFileIndeces.end()) 
+      // don't do anything if the output filename pattern was found
+      if (std::find(outputFileIndeces.begin(), outputFileIndeces.end(), j) == outputFileIndeces.end())
       {
         // check is not needed since it is already done in the previous loop
-        const FileNameParts fileUnderConsideration = FileNameParts(subjectUnderConsideration + filesPerSubject[j]); 
+        const FileNameParts fileUnderConsideration = FileNameParts(subject.allFiles[j]);
         // check for input file patterns
         for (size_t k = 0; k < inputPatterns_vector.size(); k++)
         {
           if (fileUnderConsideration.base.find(inputPatterns_vector[k]) != std::string::npos)
           {
-            inputFiles.push_back(fileUnderConsideration.fullFileName);
+            subject.inputFiles.push_back(fileUnderConsideration.fullFileName);
+            break;
           }
         } // end k-for
       } // end if
     } // end j-for
 
-    // run the algorithm which needs to be tested on the inputFiles and save the result(s) [preferably using one of the outputPatterns]
+    // run every selected kernel on the inputFiles and record the timings
+    for (const auto &kernel : selectedKernels)
+    {
+      std::function< void() > work;
+      try
+      {
+        work = kernel.second(subject);
+      }
+      catch (const std::exception &e)
+      {
+        BenchmarkResult skipped;
+        skipped.subject = subject.name;
+        skipped.kernel = kernel.first;
+        skipped.status = std::string("SKIPPED: ") + e.what();
+        results.push_back(skipped);
+        logger.Write("Skipping kernel '" + kernel.first + "' for subject '" + subject.name + "': " + e.what());
+        continue;
+      }
 
-    // run comparisons between the different output files and generate statistics. Save those statistics using logger
+      for (int n = 0; n < iterations; n++)
+      {
+        auto result = RunKernel(work);
+        result.subject = subject.name;
+        result.kernel = kernel.first;
+        result.iteration = n;
+        results.push_back(result);
+        logger.Write("Subject '" + subject.name + "', kernel '" + kernel.first + "', iteration " + std::to_string(n) +
+          ": wall = " + std::to_string(result.wallTime_ms) + "ms, cpu = " + std::to_string(result.cpuTime_ms) + "ms, peak memory = " +
+          std::to_string(result.memoryPeak) + " bytes, status = " + result.status);
+      }
+    }
+  }
+
+  WriteResultsCSV(csvFile, results);
+  logger.Write("Wrote CSV results to '" + csvFile + "'");
+  if (!jsonFile.empty())
+  {
+    WriteResultsJSON(jsonFile, results);
+    logger.Write("Wrote JSON results to '" + jsonFile + "'");
+  }
+
+  if (!baselineFile.empty())
+  {
+    if (!cbica::isFile(baselineFile))
+    {
+      logger.WriteError("Baseline file '" + baselineFile + "' was not found");
+      return EXIT_FAILURE;
+    }
+    if (CompareWithBaseline(baselineFile, results, tolerance, logger) > 0)
+    {
+      logger.WriteError("Performance regression(s) detected");
+      return EXIT_FAILURE;
+    }
   }
 
   logger.Write("Finished Successfully");
   return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <limits>
+#include <random>
+#include <utility>
+
+namespace cbica
+{
+  /**
+  \brief Mergeable approximate quantile sketch (KLL-style) with bounded memory
+
+  Values are kept in a hierarchy of compactors; when a level is full it is sorted and every other value is promoted
+  to the next level with twice the weight. The memory used is O(k * log(n / k)) and the rank error of Quantile()
+  is roughly 'rankError' (i.e., the returned value has a rank within rankError * n of the requested one).
+  Sketches built with the same error bound can be merged, which allows per-thread or per-subject sketches to be combined.
+
+  Usage example:
+  \verbatim
+  cbica::QuantileSketch< float > sketch(0.005); // ~0.5% rank error
+  for (auto &value : values)
+  {
+    sketch.Add(value);
+  }
+  std::cout << "Median = " << sketch.Quantile(0.5) << "\n";
+  \endverbatim
+  */
+  template< class TDataType = float >
+  class QuantileSketch
+  {
+  public:
+    /**
+    \brief Constructor
+
+    \param rankError The (approximate) normalized rank error; defaults to 1%
+    */
+    explicit QuantileSketch(double rankError = 0.01)
+    {
+      if (rankError <= 0)
+      {
+        rankError = 0.01;
+      }
+      m_k = std::max< size_t >(8, static_cast< size_t >(std::ceil(1.7 / rankError)));
+      m_compactors.resize(1);
+      UpdateRetained();
+    }
+
+    //! Add a single value
+    void Add(const TDataType value)
+    {
+      m_compactors[0].push_back(value);
+      m_count++;
+      m_retained++;
+      m_min = std::min(m_min, value);
+      m_max = std::max(m_max, value);
+      if (m_retained >= m_maxRetained)
+      {
+        Compress();
+      }
+    }
+
+    /**
+    \brief Combine another sketch into this one
+
+    Both sketches need the same compactor size (i.e., the same rank error), otherwise the compaction and the error bound 
+    do not hold; such sketches are not merged.
+
+    \param other The sketch to merge into this one
+    \return False if the sketches were built with different rank errors
+    */
+    bool Merge(const QuantileSketch< TDataType > &other)
+    {
+      if (other.m_k != m_k)
+      {
+        std::cerr << "Quantile sketches built with different rank errors cannot be merged.\n";
+        return false;
+      }
+      if (other.m_count == 0)
+      {
+        return true;
+      }
+      while (m_compactors.size() < other.m_compactors.size())
+      {
+        m_compactors.emplace_back();
+      }
+      for (size_t h = 0; h < other.m_compactors.size(); h++)
+      {
+        m_compactors[h].insert(m_compactors[h].end(), other.m_compactors[h].begin(), other.m_compactors[h].end());
+      }
+      m_count += other.m_count;
+      m_min = std::min(m_min, other.m_min);
+      m_max = std::max(m_max, other.m_max);
+      UpdateRetained();
+      while (m_retained >= m_maxRetained)
+      {
+        Compress();
+      }
+      return true;
+    }
+
+    //! Number of values added to the sketch (including merged sketches)
+    size_t GetCount() const
+    {
+      return m_count;
+    }
+
+    //! Number of values actually stored
+    size_t GetRetainedCount() const
+    {
+      return m_retained;
+    }
+
+    //! Smallest value added (exact)
+    TDataType GetMinimum() const
+    {
+      return m_min;
+    }
+
+    //! Largest value added (exact)
+    TDataType GetMaximum() const
+    {
+      return m_max;
+    }
+
+    /**
+    \brief Get the approximate value at the specified quantile
+
+    \param quantile Quantile in [0,1]; 0 and 1 return the exact minimum and maximum, respectively
+    */
+    TDataType Quantile(double quantile) const
+    {
+      if (m_count == 0)
+      {
+        return TDataType();
+      }
+      if (quantile <= 0)
+      {
+        return m_min;
+      }
+      if (quantile >= 1)
+      {
+        return m_max;
+      }
+
+      // weighted values in sorted order
+      std::vector< std::pair< TDataType, size_t > > weighted;
+      weighted.reserve(m_retained);
+      for (size_t h = 0; h < m_compactors.size(); h++)
+      {
+        const size_t weight = size_t(1) << h;
+        for (auto &value : m_compactors[h])
+        {
+          weighted.emplace_back(value, weight);
+        }
+      }
+      std::sort(weighted.begin(), weighted.end(),
+        [](const std::pair< TDataType, size_t > &a, const std::pair< TDataType, size_t > &b) { return a.first < b.first; });
+
+      const double targetRank = quantile * static_cast< double >(m_count);
+      size_t cumulative = 0;
+      for (auto &element : weighted)
+      {
+        cumulative += element.second;
+        if (static_cast< double >(cumulative) > targetRank)
+        {
+          return element.first;
+        }
+      }
+      return m_max;
+    }
+
+  private:
+    //! level 'h' stores values with weight 2^h; compaction preserves the total weight, which is always m_count
+    std::vector< std::vector< TDataType > > m_compactors;
+    size_t m_k = 200, m_count = 0, m_retained = 0, m_maxRetained = 0;
+    TDataType m_min = std::numeric_limits< TDataType >::max(), m_max = std::numeric_limits< TDataType >::lowest();
+    //! default seeded, so results are reproducible
+    std::minstd_rand m_generator;
+
+    //! Capacity of a level; lower levels get geometrically smaller (c = 2/3)
+    size_t Capacity(size_t level) const
+    {
+      const auto depth = m_compactors.size() - level - 1;
+      return std::max< size_t >(2, static_cast< size_t >(std::ceil(m_k * std::pow(2.0 / 3.0, static_cast< double >(depth)))));
+    }
+
+    void UpdateRetained()
+    {
+      m_retained = 0;
+      m_maxRetained = 0;
+      for (size_t h = 0; h < m_compactors.size(); h++)
+      {
+        m_retained += m_compactors[h].size();
+        m_maxRetained += Capacity(h);
+      }
+    }
+
+    //! Compacts the lowest level which is over capacity
+    void Compress()
+    {
+      for (size_t h = 0; h < m_compactors.size(); h++)
+      {
+        if (m_compactors[h].size() >= Capacity(h))
+        {
+          if (h + 1 == m_compactors.size())
+          {
+            m_compactors.emplace_back();
+          }
+          auto &level = m_compactors[h];
+          std::sort(level.begin(), level.end());
+
+          // odd-sized levels keep their last element so that no weight is lost
+          TDataType leftOver = TDataType();
+          const bool isOdd = (level.size() % 2 == 1);
+          if (isOdd)
+          {
+            leftOver = level.back();
+            level.pop_back();
+          }
+          const size_t offset = m_generator() % 2;
+          for (size_t i = offset; i < level.size(); i += 2)
+          {
+            m_compactors[h + 1].push_back(level[i]);
+          }
+          level.clear();
+          if (isOdd)
+          {
+            level.push_back(leftOver);
+          }
+          break;
+        }
+      }
+      UpdateRetained();
+    }
+  };
+}
@@ -2,12 +2,21 @@
 
 #include <cmath>
 #include <algorithm>
+#include <vector>
+#include <numeric>
+#include <limits>
+#include <iostream>
+
+#include "cbicaQuantileSketch.h"
 
 namespace cbica
 {
   /**
   \brief Stand-alone helper class to generate statistics in a efficient manner
 
+  Moments (mean, variance, skewness, kurtosis), sum, energy and extrema are accumulated in a single pass using Welford-style updates;
+  order statistics (median, percentiles, mode, IQR) are only computed when first requested, using selection on a working copy.
+
   Usage:
   std::vector< int > myArray;
   cbica::Statistics< int > calculator(myArray); // OR use 'calculator.SetInput(myArray)' after doing 'cbica::Statistics< int > calculator;'
@@ -18,6 +27,19 @@ namespace cbica
   std::cout << "Kurtosis = " << calculator.GetKurtosis() << "\n;
   std::cout << "Skewness = " << calculator.GetSkewness() << "\n;
 
+  Streaming usage (for example, one accumulator per thread):
+  cbica::Statistics< float > partial_1, partial_2;
+  partial_1.SetKeepValues(false); // only moments are needed, so memory stays O(1)
+  partial_2.SetKeepValues(false);
+  for (...) partial_1.Add(value); // thread 1
+  for (...) partial_2.Add(value); // thread 2
+  partial_1.Merge(partial_2);
+  std::cout << "StandardDev = " << partial_1.GetStandardDeviation() << "\n;
+
+  For percentiles with bounded memory, call 'SetQuantileSketch(true, rankError)' before adding values: when the values are
+  not kept, median/percentiles/IQR are then answered approximately from a mergeable cbica::QuantileSketch.
+
+  The input vector passed to the constructor or SetInput() is copied; use SetInputView() to avoid the copy for large inputs.
   */
   template< class TDataType = float >
   class Statistics
@@ -26,66 +48,201 @@ namespace cbica
     //! Default Constructor
     Statistics() {};
 
-    //! Constructor with input
-    Statistics(std::vector< TDataType >& inputArray)
+    //! Constructor with input (which is copied)
+    Statistics(const std::vector< TDataType >& inputArray)
     {
-      InitializeClass(inputArray);
+      InitializeClass(inputArray, true);
     }
 
-    //! Set new input
-    void SetInput(std::vector< TDataType >& inputArray)
+    //! Set new input (which is copied)
+    void SetInput(const std::vector< TDataType >& inputArray)
     {
-      InitializeClass(inputArray);
+      InitializeClass(inputArray, true);
+    }
+
+    /**
+    \brief Set new input without copying it
+
+    The calculator only keeps a pointer to inputArray, so it needs to outlive the calculator and must not be changed while 
+    the calculator is in use (the statistics are not updated). The values are copied if Add() or Merge() are called afterwards.
+    */
+    void SetInputView(const std::vector< TDataType >& inputArray)
+    {
+      InitializeClass(inputArray, false);
     }
 
     //! Default Destructor
     ~Statistics()
     {
-      m_input.clear(); // not really needed 
+      m_ownedInput.clear(); // not really needed
+    }
+
+    /**
+    \brief Whether values given to Add() are stored; defaults to true
+
+    Needed for order statistics (median, percentiles, mode, etc.) and z-scores; disable to keep memory constant while streaming.
+    */
+    void SetKeepValues(bool keepValues)
+    {
+      if (!keepValues && m_useSketch && HasValues())
+      {
+        BuildSketchFromValues();
+      }
+      m_keepValues = keepValues;
+      if (!m_keepValues)
+      {
+        m_externalInput = nullptr;
+        std::vector< TDataType >().swap(m_ownedInput);
+        std::vector< TDataType >().swap(m_workingCopy);
+        ResetLazyFlags();
+      }
+    }
+
+    /**
+    \brief Answer order statistics from an approximate quantile sketch when the values are not kept
+
+    The sketch needs O(log(n) / rankError) memory, irrespective of the number of values, and is merged along with the moments.
+    While the values are kept, the exact order statistics are used, so the sketch is only built once the values are dropped.
+
+    \param useSketch Whether to maintain the sketch
+    \param rankError The normalized rank error of the percentiles (defaults to 1%); only used if useSketch is true
+    */
+    void SetQuantileSketch(bool useSketch, double rankError = 0.01)
+    {
+      m_useSketch = useSketch;
+      m_sketchRankError = rankError;
+      m_sketch = QuantileSketch< TDataType >(rankError);
+      if (m_useSketch && !HasValues() && (m_moments.count > 0))
+      {
+        std::cerr << "Values were not kept, so the quantile sketch can only be enabled on an empty calculator.\n";
+        m_useSketch = false;
+      }
+      ResetLazyFlags();
+    }
+
+    //! Add a single value to the accumulator
+    void Add(const TDataType value)
+    {
+      DetachFromExternalInput();
+      m_moments.Add(static_cast< double >(value));
+      if (m_keepValues)
+      {
+        m_ownedInput.push_back(value);
+      }
+      if (m_useSketch && !HasValues())
+      {
+        m_sketch.Add(value);
+      }
+      ResetLazyFlags();
+    }
+
+    //! Combine the accumulated values of another calculator into this one (Chan et al. pairwise update)
+    void Merge(const Statistics< TDataType > &other)
+    {
+      DetachFromExternalInput();
+      if (m_useSketch && !(HasValues() && other.HasValues()))
+      {
+        // the combined values are not kept, so the sketch is needed from here on
+        if (HasValues())
+        {
+          BuildSketchFromValues();
+        }
+        if (other.HasValues())
+        {
+          for (auto &value : other.GetInputValues())
+          {
+            m_sketch.Add(value);
+          }
+        }
+        else if (other.m_useSketch)
+        {
+          if (!m_sketch.Merge(other.m_sketch))
+          {
+            std::cerr << "Disabling the sketch of the merged calculator.\n";
+            m_useSketch = false;
+          }
+        }
+        else
+        {
+          std::cerr << "The merged calculator has neither values nor a quantile sketch; disabling the sketch.\n";
+          m_useSketch = false;
+        }
+      }
+      m_moments.Merge(other.m_moments);
+      if (m_keepValues)
+      {
+        if (!other.HasValues())
+        {
+          // order statistics can no longer be computed for the combined set
+          m_keepValues = false;
+          std::vector< TDataType >().swap(m_ownedInput);
+        }
+        else
+        {
+          auto &otherInput = other.GetInputValues();
+          m_ownedInput.insert(m_ownedInput.end(), otherInput.begin(), otherInput.end());
+        }
+      }
+      ResetLazyFlags();
+    }
+
+    //! Number of values that have been accumulated
+    size_t GetCount()
+    {
+      return m_moments.count;
     }
 
     //! Does exactly what it says
     double GetMaximum()
     {
-      return m_max;
+      return m_moments.max;
     }
 
     //! Does exactly what it says
     double GetMinimum()
     {
-      return m_min;
+      return m_moments.min;
     }
 
     //! Does exactly what it says
     double GetSum()
     {
-      return m_sum;
+      return m_moments.sum;
     }
 
     //! Does exactly what it says
     double GetMean()
     {
-      return m_mean;
+      return m_moments.mean;
     }
 
     //! Does exactly what it says
     double GetVariance()
     {
-      return m_variance;
+      return (m_moments.count > 1) ? m_moments.M2 / (static_cast< double >(m_moments.count) - 1) : 0.0;
     }
 
     TDataType GetMode()
     {
       if (!mode_calculated)
       {
-        m_mode = m_input_Sorted[0];
-        auto number = m_input_Sorted[0];
+        if (!PrepareWorkingCopy())
+        {
+          return std::numeric_limits< TDataType >::min();
+        }
+        if (!workingCopy_sorted)
+        {
+          std::sort(m_workingCopy.begin(), m_workingCopy.end());
+          workingCopy_sorted = true;
+        }
+        m_mode = m_workingCopy[0];
+        auto number = m_workingCopy[0];
         int count = 1;
         int countMode = 1;
 
-        for (size_t i = 1; i < m_input_Sorted.size(); i++)
+        for (size_t i = 1; i < m_workingCopy.size(); i++)
         {
-          if (m_input_Sorted[i] == number)
+          if (m_workingCopy[i] == number)
           { // count occurrences of the current number
             ++count;
           }
@@ -97,7 +254,7 @@ namespace cbica
               m_mode = number;
             }
             count = 1; // reset count for the new number
-            number = m_input_Sorted[i];
+            number = m_workingCopy[i];
           }
         }
         mode_calculated = true;
@@ -108,24 +265,28 @@ namespace cbica
 
     TDataType GetMedian()
     {
+      if (UseSketchForOrderStatistics())
+      {
+        return m_sketch.Quantile(0.5);
+      }
       if (!median_calculated)
       {
-        if (!m_input_Sorted.empty())
+        if (!PrepareWorkingCopy())
         {
-          auto size = m_input_Sorted.size();
-          if (size % 2 == 0)
-          {
-            m_median = (m_input_Sorted[size / 2 - 1] + m_input_Sorted[size / 2]) / 2;
-          }
-          else
-          {
-            m_median = m_input_Sorted[size / 2];
-          }
+          return std::numeric_limits< TDataType >::min();
+        }
+        auto size = m_workingCopy.size();
+        auto upper = SelectElement(size / 2);
+        if (size % 2 == 0)
+        {
+          // after selection, the lower half is everything before 'size / 2'
+          auto lower = workingCopy_sorted ? m_workingCopy[size / 2 - 1] :
+            *std::max_element(m_workingCopy.begin(), m_workingCopy.begin() + size / 2);
+          m_median = (lower + upper) / 2;
         }
         else
         {
-          std::cerr << "Array cannot be empty.\n";
-          return std::numeric_limits< TDataType >::min();
+          m_median = upper;
         }
         median_calculated = true;
       }
@@ -136,36 +297,29 @@ namespace cbica
     //! Does exactly what it says
     double GetStandardDeviation()
     {
-      CalculateSTD();
-      return m_stdDev;
+      return std::sqrt(GetVariance());
     }
 
     //! Does exactly what it says
     double GetKurtosis()
     {
-      if (!kurtosis_calculated)
+      auto variance = GetVariance();
+      if ((m_moments.count == 0) || (variance == 0))
       {
-        CalculateSTD();
-
-        m_kurtosis = weirdStatistics(4);
-        kurtosis_calculated = true;
+        return 0.0;
       }
-
-      return m_kurtosis;
+      return (m_moments.M4 / static_cast< double >(m_moments.count)) / (variance * variance);
     }
 
     //! Does exactly what it says
     double GetSkewness()
     {
-      if (!skewness_calculated)
+      auto stdDev = GetStandardDeviation();
+      if ((m_moments.count == 0) || (stdDev == 0))
       {
-        CalculateSTD();
-
-        m_skewness = weirdStatistics(3);
-        skewness_calculated = true;
+        return 0.0;
       }
-
-      return m_skewness;
+      return (m_moments.M3 / static_cast< double >(m_moments.count)) / (stdDev * stdDev * stdDev);
     }
 
     //! Gets the element at the Nth percentile (always defined between 1-99)
@@ -176,15 +330,21 @@ namespace cbica
         std::cerr << "Cannot calculate percentile less than 1. Giving Minimum, instead.\n";
         return GetMinimum();
       }
-      auto nth = m_input_Sorted.begin() + (n * m_input_Sorted.size()) / 100;
-      std::nth_element(m_input_Sorted.begin(), nth, m_input_Sorted.end());
-      return *nth;
+      if (UseSketchForOrderStatistics())
+      {
+        return m_sketch.Quantile(static_cast< double >(n) / 100.0);
+      }
+      if (!PrepareWorkingCopy())
+      {
+        return std::numeric_limits< TDataType >::min();
+      }
+      return SelectElement((n * m_workingCopy.size()) / 100);
     }
 
     //! Get the Range
     TDataType GetRange()
     {
-      return (m_max - m_min);
+      return (m_moments.max - m_moments.min);
     }
 
     //! Get the InterQuartile Range
@@ -196,67 +356,71 @@ namespace cbica
     //! Get the Studentized Range
     double GetStudentizedRange()
     {
-      return (static_cast<double>(m_max - m_min) / m_variance);
+      return ((m_moments.max - m_moments.min) / GetVariance());
     }
 
     //! Get the Mean Absolute Deviation
     double GetMeanAbsoluteDeviation()
     {
+      auto &input = GetInputValues();
       double mad = 0;
-      for (size_t i = 0; i < m_input.size(); i++)
+      for (size_t i = 0; i < input.size(); i++)
       {
-        mad += (m_input[i] - m_mean);
+        mad += (input[i] - m_moments.mean);
       }
-      return (mad / m_inputSize_double);
+      return (mad / static_cast< double >(m_moments.count));
     }
 
     //! Get the Robust Mean Absolute Deviation
     double GetRobustMeanAbsoluteDeviation(size_t lowerQuantile, size_t upperQuantile)
     {
-      std::vector< TDataType > truncatedVector;
       auto lower = GetNthPercentileElement(lowerQuantile);
       auto upper = GetNthPercentileElement(upperQuantile);
-      for (size_t i = 0; i < m_input_Sorted.size(); i++)
+      auto &input = GetInputValues();
+
+      double truncated_sum = 0;
+      size_t truncated_count = 0;
+      for (size_t i = 0; i < input.size(); i++)
       {
-        if ((m_input_Sorted[i] >= lower) && (m_input_Sorted[i] <= upper))
+        if ((input[i] >= lower) && (input[i] <= upper))
         {
-          truncatedVector.push_back(m_input_Sorted[i]);
+          truncated_sum += input[i];
+          truncated_count++;
         }
       }
-
-      double truncated_sum = std::accumulate(truncatedVector.begin(), truncatedVector.end(), 0.0);
-      double truncated_mean = truncated_sum / static_cast<double>(truncatedVector.size());
+      double truncated_mean = truncated_sum / static_cast<double>(truncated_count);
 
       double rmad = 0;
-      for (size_t i = 0; i < truncatedVector.size(); i++)
+      for (size_t i = 0; i < input.size(); i++)
       {
-        rmad += std::abs(truncatedVector[i] - truncated_mean);
+        if ((input[i] >= lower) && (input[i] <= upper))
+        {
+          rmad += std::abs(input[i] - truncated_mean);
+        }
       }
-      return (rmad / static_cast<double>(truncatedVector.size()));
+      return (rmad / static_cast<double>(truncated_count));
     }
 
-    //! Get Median Absolute Deviation 
+    //! Get Median Absolute Deviation
     double GetMedianAbsoluteDeviation()
     {
+      auto median = GetMedian();
+      auto &input = GetInputValues();
       double mad = 0;
-      for (size_t i = 0; i < m_input.size(); i++)
+      for (size_t i = 0; i < input.size(); i++)
       {
-        mad += (m_input[i] - GetMedian());
+        mad += (input[i] - median);
       }
-      return (mad / m_inputSize_double);
+      return (mad / static_cast< double >(m_moments.count));
     }
 
-    //! Get Coefficient of Variation 
+    //! Get Coefficient of Variation
     double GetCoefficientOfVariation()
     {
-      if (!stdDev_calculated)
-      {
-        CalculateSTD();
-      }
-      return (m_stdDev / m_mean);
+      return (GetStandardDeviation() / m_moments.mean);
     }
 
-    //! Get Quartile Coefficient Of Dispersion 
+    //! Get Quartile Coefficient Of Dispersion
     double GetQuartileCoefficientOfDispersion()
     {
       auto seventyFifth = GetNthPercentileElement(75);
@@ -265,16 +429,16 @@ namespace cbica
       return (static_cast<double>(seventyFifth - twentyFifth) / static_cast<double>(seventyFifth + twentyFifth));
     }
 
-    //! Get the Energy 
+    //! Get the Energy
     double GetEnergy()
     {
-      return m_energy;
+      return m_moments.energy;
     }
 
-    //! Get the Root Mean Square (also called Quadratic Mean) 
+    //! Get the Root Mean Square (also called Quadratic Mean)
     double GetRootMeanSquare()
     {
-      return (std::sqrt(m_energy / m_inputSize_double));
+      return (std::sqrt(m_moments.energy / static_cast< double >(m_moments.count)));
     }
 
     //! Does exactly what it says
@@ -282,14 +446,12 @@ namespace cbica
     {
       if (!zscores_calculated)
       {
-        if (!stdDev_calculated)
-        {
-          CalculateSTD();
-        }
-        m_zscores.clear();
-        for (const TDataType& element : m_input)
+        auto &input = GetInputValues();
+        auto stdDev = GetStandardDeviation();
+        m_zscores.resize(input.size());
+        for (size_t i = 0; i < input.size(); i++)
         {
-          m_zscores.push_back((element - m_mean) / m_stdDev);
+          m_zscores[i] = (input[i] - m_moments.mean) / stdDev;
         }
         zscores_calculated = true;
       }
@@ -298,73 +460,214 @@ namespace cbica
     }
 
   private:
-    std::vector< TDataType > m_input;
-    std::vector< TDataType > m_input_Sorted;
+    //! Running moments; M2, M3 and M4 are the sums of 2nd, 3rd and 4th powers of the differences from the mean
+    struct Moments
+    {
+      size_t count = 0;
+      double mean = 0.0, M2 = 0.0, M3 = 0.0, M4 = 0.0, sum = 0.0, energy = 0.0,
+        min = std::numeric_limits< double >::max(), max = std::numeric_limits< double >::lowest();
+
+      //! Terriberry's extension of Welford's update to the higher moments
+      void Add(const double value)
+      {
+        const double n1 = static_cast< double >(count);
+        count++;
+        const double n = static_cast< double >(count);
+        const double delta = value - mean;
+        const double delta_n = delta / n;
+        const double delta_n2 = delta_n * delta_n;
+        const double term1 = delta * delta_n * n1;
+        mean += delta_n;
+        M4 += term1 * delta_n2 * (n * n - 3 * n + 3) + 6 * delta_n2 * M2 - 4 * delta_n * M3;
+        M3 += term1 * delta_n * (n - 2) - 3 * delta_n * M2;
+        M2 += term1;
+        sum += value;
+        energy += value * value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+      }
+
+      //! Pairwise combination from Chan et al. / Pebay
+      void Merge(const Moments &other)
+      {
+        if (other.count == 0)
+        {
+          return;
+        }
+        if (count == 0)
+        {
+          *this = other;
+          return;
+        }
+        const double na = static_cast< double >(count), nb = static_cast< double >(other.count);
+        const double n = na + nb;
+        const double delta = other.mean - mean;
+        const double delta2 = delta * delta, delta3 = delta2 * delta, delta4 = delta2 * delta2;
+
+        const double combinedM4 = M4 + other.M4 + delta4 * na * nb * (na * na - na * nb + nb * nb) / (n * n * n) +
+          6 * delta2 * (na * na * other.M2 + nb * nb * M2) / (n * n) + 4 * delta * (na * other.M3 - nb * M3) / n;
+        const double combinedM3 = M3 + other.M3 + delta3 * na * nb * (na - nb) / (n * n) +
+          3 * delta * (na * other.M2 - nb * M2) / n;
+        const double combinedM2 = M2 + other.M2 + delta2 * na * nb / n;
+
+        mean += delta * nb / n;
+        M2 = combinedM2;
+        M3 = combinedM3;
+        M4 = combinedM4;
+        count += other.count;
+        sum += other.sum;
+        energy += other.energy;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+      }
+    };
+
+    Moments m_moments;
 
-    //! actual outputs
-    double m_inputSize_double = 0, m_sum = 0.0, m_mean = 0.0, m_variance = 0.0, m_stdDev = 0.0, m_kurtosis = 0.0, m_skewness = 0.0, 
-      m_max = 0.0, m_min = 0.0, m_energy = 0.0;
+    //! the input given to SetInputView() (not owned) and the values given to SetInput() or Add()
+    const std::vector< TDataType > *m_externalInput = nullptr;
+    std::vector< TDataType > m_ownedInput;
+
+    //! scratch copy for selection; only populated when an order statistic is asked for
+    std::vector< TDataType > m_workingCopy;
 
     TDataType m_mode, m_median;
 
     std::vector< double > m_zscores;
 
+    bool m_keepValues = true;
+
+    //! optional approximate backend for order statistics
+    QuantileSketch< TDataType > m_sketch;
+    bool m_useSketch = false;
+    double m_sketchRankError = 0.01;
+
     //! flags to check if something has been calculated or not
-    bool stdDev_calculated = false, kurtosis_calculated = false, skewness_calculated = false, zscores_calculated = false,
-      mode_calculated = false, median_calculated = false;
+    bool zscores_calculated = false, mode_calculated = false, median_calculated = false,
+      workingCopy_available = false, workingCopy_sorted = false;
 
     //! This function gets called every time the input is set, for obvious reasons
-    void InitializeClass(std::vector< TDataType >& inputArray)
+    void InitializeClass(const std::vector< TDataType >& inputArray, bool copyInput)
     {
-      m_input = inputArray;
-      m_input_Sorted = inputArray;
-      std::sort(m_input_Sorted.begin(), m_input_Sorted.end());
-      m_inputSize_double = static_cast<double>(m_input.size());
+      if (copyInput)
+      {
+        m_externalInput = nullptr;
+        m_ownedInput.assign(inputArray.begin(), inputArray.end());
+      }
+      else
+      {
+        m_externalInput = &inputArray;
+        std::vector< TDataType >().swap(m_ownedInput);
+      }
+      std::vector< TDataType >().swap(m_workingCopy);
+      m_keepValues = true;
+      ResetLazyFlags();
+      // the values are kept, so the sketch is only built if they are dropped or merged with a calculator without values
+      m_sketch = QuantileSketch< TDataType >(m_sketchRankError);
+
+      m_moments = Moments();
+      // per-chunk accumulators are merged in chunk order, which keeps this a single pass over the data and makes
+      // the result independent of the number and scheduling of the threads
+      const long long size = static_cast< long long >(inputArray.size());
+      const long long chunkSize = 65536;
+      const long long numberOfChunks = (size + chunkSize - 1) / chunkSize;
+      std::vector< Moments > chunkMoments(static_cast< size_t >(numberOfChunks));
+#pragma omp parallel for if (numberOfChunks > 1)
+      for (long long c = 0; c < numberOfChunks; c++)
+      {
+        const long long end = std::min(size, (c + 1) * chunkSize);
+        for (long long i = c * chunkSize; i < end; i++)
+        {
+          chunkMoments[c].Add(static_cast< double >(inputArray[i]));
+        }
+      }
+      for (auto &chunk : chunkMoments)
+      {
+        m_moments.Merge(chunk);
+      }
+    }
 
-      stdDev_calculated = false;
-      kurtosis_calculated = false;
-      skewness_calculated = false;
-      zscores_calculated = false;
-      mode_calculated = false;
-      median_calculated = false;
-      m_sum = std::accumulate(m_input.begin(), m_input.end(), 0.0);
-      m_mean = m_sum / m_inputSize_double;
-      auto result = std::minmax_element(m_input.begin(), m_input.end());
-      m_min = *result.first;
-      m_max = *result.second;
-      for (const TDataType& element : m_input)
+    //! Returns the values which have been accumulated so far
+    const std::vector< TDataType > &GetInputValues() const
+    {
+      return (m_externalInput != nullptr) ? *m_externalInput : m_ownedInput;
+    }
+
+    //! Whether the actual values (and not just the moments) are available
+    bool HasValues() const
+    {
+      return m_keepValues && (GetInputValues().size() == m_moments.count);
+    }
+
+    //! Whether percentiles come from the sketch instead of the exact values
+    bool UseSketchForOrderStatistics() const
+    {
+      return m_useSketch && !HasValues() && (m_sketch.GetCount() == m_moments.count) && (m_moments.count > 0);
+    }
+
+    //! Fills the quantile sketch from the kept values, before they are dropped
+    void BuildSketchFromValues()
+    {
+      m_sketch = QuantileSketch< TDataType >(m_sketchRankError);
+      for (auto &value : GetInputValues())
       {
-        m_variance += std::pow(static_cast<double>(element - m_mean), 2);
-        m_energy += std::pow(element, 2);
+        m_sketch.Add(value);
       }
+    }
 
-      m_variance = m_variance / (m_inputSize_double - 1);
+    //! Moves an externally set input into the owned buffer before it gets modified
+    void DetachFromExternalInput()
+    {
+      if (m_externalInput != nullptr)
+      {
+        if (m_keepValues)
+        {
+          m_ownedInput = *m_externalInput;
+        }
+        m_externalInput = nullptr;
+      }
     }
 
-    //! Helper function for calculating kurtosis and skewness
-    double weirdStatistics(size_t power)
+    void ResetLazyFlags()
     {
-      if (!stdDev_calculated)
+      zscores_calculated = false;
+      mode_calculated = false;
+      median_calculated = false;
+      workingCopy_available = false;
+      workingCopy_sorted = false;
+    }
+
+    //! Creates the working copy used by selection, if needed; returns false if the values were not kept
+    bool PrepareWorkingCopy()
+    {
+      if (!HasValues() || (m_moments.count == 0))
       {
-        CalculateSTD();
+        std::cerr << "Order statistics need a non-empty input with the values kept (see SetKeepValues() and SetQuantileSketch()).\n";
+        return false;
       }
-      double returnStat = 0.0;
-      for (size_t x = 0; x < m_input.size(); x++)
+      if (!workingCopy_available)
       {
-        returnStat += std::pow(((m_input[x] - m_mean) / m_stdDev), power);
+        auto &input = GetInputValues();
+        m_workingCopy.assign(input.begin(), input.end());
+        workingCopy_available = true;
+        workingCopy_sorted = false;
       }
-      return (returnStat / m_inputSize_double);
+      return true;
     }
 
-    //! Single place to calculate STD Dev to reduce number of moving parts
-    void CalculateSTD()
+    //! Returns the element which would be at 'index' in the sorted array, using selection (expected linear time)
+    TDataType SelectElement(size_t index)
     {
-      if (!stdDev_calculated)
+      if (index >= m_workingCopy.size())
+      {
+        index = m_workingCopy.size() - 1;
+      }
+      if (!workingCopy_sorted)
       {
-        m_stdDev = std::sqrt(m_variance);
-        stdDev_calculated = true;
+        std::nth_element(m_workingCopy.begin(), m_workingCopy.begin() + index, m_workingCopy.end());
       }
+      return m_workingCopy[index];
     }
   };
 
-}
\ No newline at end of file
+}
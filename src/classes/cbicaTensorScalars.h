@@ -0,0 +1,378 @@
+/**
+\file  cbicaTensorScalars.h
+
+\brief Closed-form eigen-analysis of symmetric 3x3 tensors and the scalar maps derived from it
+
+https://www.cbica.upenn.edu/sbia/software/ <br>
+software@cbica.upenn.edu
+
+Copyright (c) 2018 University of Pennsylvania. All rights reserved. <br>
+See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
+
+*/
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+
+namespace cbica
+{
+  /**
+  \brief The eigen-system of a symmetric 3x3 matrix
+
+  The layout is the one of itk::SymmetricSecondRankTensor::ComputeEigenAnalysis(): the eigenvalues are in ascending order
+  and eigenVectors[i] is the unit eigenvector of eigenValues[i].
+  */
+  struct SymmetricEigenSystem3x3
+  {
+    double eigenValues[3];
+    double eigenVectors[3][3];
+  };
+
+  /**
+  \brief Closed-form eigen-decomposition of a symmetric 3x3 matrix
+
+  The eigenvalues are the trigonometric roots of the characteristic polynomial (O.K. Smith, 1961). The eigenvector of the
+  eigenvalue that is farthest from the other two is the largest cross product of the rows of (A - lambda * I); the other
+  two eigen-pairs come from a Jacobi rotation in the plane orthogonal to it (D. Eberly, "A Robust Eigensolver for 3x3
+  Symmetric Matrices"), so the vectors stay orthonormal when eigenvalues are repeated. The same plane is the fallback for
+  the eigenvalues of (nearly) repeated pairs, which the trigonometric roots only resolve to about 1e-8. Diagonal and zero
+  matrices are handled directly and the matrix is scaled by its largest element to avoid over/underflow.
+
+  Unlike the iterative solver behind itk::SymmetricSecondRankTensor::ComputeEigenAnalysis(), the cost is fixed, which
+  matters when it is done for every voxel of an image.
+
+  \param tensor The upper triangle of the matrix as xx, xy, xz, yy, yz, zz (the layout of itk::DiffusionTensor3D); anything with operator[] works
+  \param computeEigenVectors Whether the eigenvectors are needed; if not, they are left uninitialized
+  */
+  template< class TTensorType >
+  inline SymmetricEigenSystem3x3 ComputeSymmetricEigenSystem3x3(const TTensorType &tensor, bool computeEigenVectors = true)
+  {
+    SymmetricEigenSystem3x3 returnSystem;
+
+    double a[6];
+    double maxAbs = 0;
+    for (size_t k = 0; k < 6; k++)
+    {
+      a[k] = static_cast< double >(tensor[k]);
+      maxAbs = std::max(maxAbs, std::abs(a[k]));
+    }
+
+    auto setAxes = [&returnSystem](const size_t order[3])
+    {
+      for (size_t i = 0; i < 3; i++)
+      {
+        for (size_t k = 0; k < 3; k++)
+        {
+          returnSystem.eigenVectors[i][k] = (order[i] == k) ? 1 : 0;
+        }
+      }
+    };
+
+    if (maxAbs == 0)
+    {
+      const size_t order[3] = { 0, 1, 2 };
+      for (size_t i = 0; i < 3; i++)
+      {
+        returnSystem.eigenValues[i] = 0;
+      }
+      setAxes(order);
+      return returnSystem;
+    }
+
+    for (size_t k = 0; k < 6; k++)
+    {
+      a[k] /= maxAbs;
+    }
+    const double &a00 = a[0], &a01 = a[1], &a02 = a[2], &a11 = a[3], &a12 = a[4], &a22 = a[5];
+
+    const double offDiagonal = a01 * a01 + a02 * a02 + a12 * a12;
+    if (offDiagonal == 0)
+    {
+      // diagonal: the eigenvectors are the axes
+      size_t order[3] = { 0, 1, 2 };
+      const double diagonal[3] = { a00, a11, a22 };
+      std::sort(order, order + 3, [&diagonal](size_t i, size_t j) { return diagonal[i] < diagonal[j]; });
+      for (size_t i = 0; i < 3; i++)
+      {
+        returnSystem.eigenValues[i] = diagonal[order[i]] * maxAbs;
+      }
+      setAxes(order);
+      return returnSystem;
+    }
+
+    // the eigenvalues of B = (A - q * I) / p are 2 * cos(angle + 2 * k * pi / 3), where det(B) / 2 = cos(3 * angle)
+    const double q = (a00 + a11 + a22) / 3;
+    const double b00 = a00 - q, b11 = a11 - q, b22 = a22 - q;
+    const double p = std::sqrt((b00 * b00 + b11 * b11 + b22 * b22 + 2 * offDiagonal) / 6);
+    const double c00 = b11 * b22 - a12 * a12, c01 = a01 * b22 - a12 * a02, c02 = a01 * a12 - b11 * a02;
+    const double halfDet = std::max(-1.0, std::min(1.0, (b00 * c00 - a01 * c01 + a02 * c02) / (2 * p * p * p)));
+    const double angle = std::acos(halfDet) / 3;
+    const double twoThirdsPi = 2.09439510239319549;
+    const double largest = q + 2 * p * std::cos(angle), smallest = q + 2 * p * std::cos(angle + twoThirdsPi);
+    returnSystem.eigenValues[0] = smallest * maxAbs;
+    returnSystem.eigenValues[1] = (3 * q - smallest - largest) * maxAbs;
+    returnSystem.eigenValues[2] = largest * maxAbs;
+
+    // acos() is ill-conditioned next to +-1, i.e., when two eigenvalues (nearly) coincide, and only the one
+    // that stands apart is accurate there; the pair is then taken from the fallback below
+    const bool isDegenerate = (1 - std::abs(halfDet) < 1e-4);
+    if (!computeEigenVectors && !isDegenerate)
+    {
+      return returnSystem;
+    }
+
+    auto cross = [](const double u[3], const double v[3], double w[3])
+    {
+      w[0] = u[1] * v[2] - u[2] * v[1];
+      w[1] = u[2] * v[0] - u[0] * v[2];
+      w[2] = u[0] * v[1] - u[1] * v[0];
+    };
+    auto dot = [](const double u[3], const double v[3])
+    {
+      return u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+    };
+
+    // the eigenvalue farthest from the others: the largest one if det(B) >= 0, otherwise the smallest one;
+    // its eigenvector is the largest cross product of the rows of (A - lambda * I), which has rank 2
+    const size_t first = (halfDet >= 0) ? 2 : 0;
+    const double lambdaFirst = (first == 2) ? largest : smallest;
+    double *evecFirst = returnSystem.eigenVectors[first];
+    {
+      const double row0[3] = { a00 - lambdaFirst, a01, a02 }, row1[3] = { a01, a11 - lambdaFirst, a12 },
+        row2[3] = { a02, a12, a22 - lambdaFirst };
+      double candidates[3][3];
+      cross(row0, row1, candidates[0]);
+      cross(row0, row2, candidates[1]);
+      cross(row1, row2, candidates[2]);
+      size_t best = 0;
+      double bestNorm = 0;
+      for (size_t c = 0; c < 3; c++)
+      {
+        const double norm = dot(candidates[c], candidates[c]);
+        if (norm > bestNorm)
+        {
+          bestNorm = norm;
+          best = c;
+        }
+      }
+      if (bestNorm == 0)
+      {
+        // only possible for a (numerically) isotropic matrix, for which any basis is an eigen-basis
+        const size_t order[3] = { 0, 1, 2 };
+        setAxes(order);
+        return returnSystem;
+      }
+      const double inverseNorm = 1 / std::sqrt(bestNorm);
+      for (size_t k = 0; k < 3; k++)
+      {
+        evecFirst[k] = candidates[best][k] * inverseNorm;
+      }
+    }
+
+    // the other two eigen-pairs are the ones of the 2x2 restriction of A to the plane orthogonal to the first
+    // eigenvector, which is diagonalized with a single Jacobi rotation and stays accurate for repeated eigenvalues
+    double u[3], v[3];
+    if (std::abs(evecFirst[0]) > std::abs(evecFirst[1]))
+    {
+      const double inverseLength = 1 / std::sqrt(evecFirst[0] * evecFirst[0] + evecFirst[2] * evecFirst[2]);
+      u[0] = -evecFirst[2] * inverseLength;
+      u[1] = 0;
+      u[2] = evecFirst[0] * inverseLength;
+    }
+    else
+    {
+      const double inverseLength = 1 / std::sqrt(evecFirst[1] * evecFirst[1] + evecFirst[2] * evecFirst[2]);
+      u[0] = 0;
+      u[1] = evecFirst[2] * inverseLength;
+      u[2] = -evecFirst[1] * inverseLength;
+    }
+    cross(evecFirst, u, v);
+
+    const double au[3] = { a00 * u[0] + a01 * u[1] + a02 * u[2], a01 * u[0] + a11 * u[1] + a12 * u[2], a02 * u[0] + a12 * u[1] + a22 * u[2] };
+    const double av[3] = { a00 * v[0] + a01 * v[1] + a02 * v[2], a01 * v[0] + a11 * v[1] + a12 * v[2], a02 * v[0] + a12 * v[1] + a22 * v[2] };
+    const double m00 = dot(u, au), m01 = dot(u, av), m11 = dot(v, av);
+    double t = 0; // tangent of the rotation angle
+    if (m01 != 0)
+    {
+      const double tau = (m11 - m00) / (2 * m01);
+      t = ((tau >= 0) ? 1 : -1) / (std::abs(tau) + std::sqrt(1 + tau * tau));
+    }
+    const double cosine = 1 / std::sqrt(1 + t * t), sine = t * cosine;
+    double pairValues[2] = { m00 - t * m01, m11 + t * m01 };
+    double pairVectors[2][3];
+    for (size_t k = 0; k < 3; k++)
+    {
+      pairVectors[0][k] = cosine * u[k] - sine * v[k];
+      pairVectors[1][k] = sine * u[k] + cosine * v[k];
+    }
+    const size_t lower = (pairValues[0] <= pairValues[1]) ? 0 : 1;
+    const size_t offset = (first == 2) ? 0 : 1;
+    for (size_t i = 0; i < 2; i++)
+    {
+      const size_t pair = (i == 0) ? lower : 1 - lower;
+      returnSystem.eigenValues[offset + i] = pairValues[pair] * maxAbs;
+      for (size_t k = 0; k < 3; k++)
+      {
+        returnSystem.eigenVectors[offset + i][k] = pairVectors[pair][k];
+      }
+    }
+
+    return returnSystem;
+  }
+
+  /**
+  \brief The scalar maps of a diffusion tensor
+
+  FA = Fractional Anisotropy, TR = Trace, AD/RD = Axial/Radial Diffusivity, CL/CP/CS = linear/planar/spherical geometric
+  measures (normalized by the largest eigenvalue), R1-R3 and K1-K3 = Gordon's R and K invariants.
+  */
+  struct TensorScalars
+  {
+    double FA = 0, TR = 0, AD = 0, RD = 0, Skewness = 0, Kurtosis = 0, CL = 0, CP = 0, CS = 0,
+      R1 = 0, R2 = 0, R3 = 0, K1 = 0, K2 = 0, K3 = 0;
+  };
+
+  /**
+  \brief Computes all the scalar maps of a tensor from its (ascending) eigenvalues, so that the eigen-analysis is done once per voxel
+
+  Measures whose denominator vanishes (for example, R2, R3 and K3 of a zero or isotropic tensor) are set to 0.
+
+  \param eigenValues The eigenvalues in ascending order, as given by ComputeSymmetricEigenSystem3x3()
+  */
+  inline TensorScalars ComputeTensorScalars(const double eigenValues[3])
+  {
+    TensorScalars returnScalars;
+    const double &lambda0 = eigenValues[0], &lambda1 = eigenValues[1], &lambda2 = eigenValues[2];
+
+    returnScalars.TR = lambda0 + lambda1 + lambda2;
+    returnScalars.AD = lambda2;
+    returnScalars.RD = (lambda0 + lambda1) / 2;
+
+    const double innerProduct = lambda0 * lambda0 + lambda1 * lambda1 + lambda2 * lambda2;
+    if (innerProduct > 0)
+    {
+      returnScalars.FA = std::sqrt(std::max(0.0, 3 * innerProduct - returnScalars.TR * returnScalars.TR) / (2 * innerProduct));
+    }
+
+    // skewness and kurtosis of the absolute eigenvalues
+    const double l[3] = { std::abs(lambda0), std::abs(lambda1), std::abs(lambda2) };
+    const double absMean = (l[0] + l[1] + l[2]) / 3;
+    if (absMean > 0)
+    {
+      double central3 = 0, central4 = 0, power3 = 0, power4 = 0;
+      for (size_t i = 0; i < 3; i++)
+      {
+        const double d = l[i] - absMean, d2 = d * d, l2 = l[i] * l[i];
+        central3 += d2 * d;
+        central4 += d2 * d2;
+        power3 += l2 * l[i];
+        power4 += l2 * l2;
+      }
+      returnScalars.Skewness = std::cbrt(central3 / power3);
+      returnScalars.Kurtosis = std::pow(central4 / power4, 0.25);
+    }
+
+    if (lambda2 > 0)
+    {
+      returnScalars.CL = (lambda2 - lambda1) / lambda2;
+      returnScalars.CP = (lambda1 - lambda0) / lambda2;
+      returnScalars.CS = lambda0 / lambda2;
+    }
+
+    // Gordon's invariants from the first two moments of the eigenvalues
+    const double mean = returnScalars.TR / 3;
+    const double variance = ((lambda0 - mean) * (lambda0 - mean) + (lambda1 - mean) * (lambda1 - mean) + (lambda2 - mean) * (lambda2 - mean)) / 3;
+    const double norm2 = mean * mean + variance;
+    const double deviation = std::sqrt(3 * variance);
+    returnScalars.R1 = std::sqrt(3 * norm2);
+    returnScalars.K1 = 3 * mean;
+    returnScalars.K2 = deviation;
+    if (norm2 > 0)
+    {
+      returnScalars.R2 = std::sqrt(3 * variance / 2 / norm2);
+    }
+    if (deviation > 0)
+    {
+      returnScalars.R3 = returnScalars.K3 = (lambda0 * lambda1 * lambda2) / (deviation * deviation * deviation);
+    }
+
+    return returnScalars;
+  }
+
+  /**
+  \brief Output buffers of ComputeTensorScalarMaps(); buffers which are left as nullptr are not written
+
+  Scalar buffers hold one value per tensor and eigenvector buffers hold 3 interleaved values per tensor (the layout of
+  itk::VectorImage). Unlike the ascending order of SymmetricEigenSystem3x3, eigenValues[0] and eigenVectors[0] are for
+  the largest eigen-pair (i.e., L1 and V1).
+  */
+  template< class TScalarType, class TVectorType = TScalarType >
+  struct TensorScalarBuffers
+  {
+    TScalarType *FA = nullptr, *TR = nullptr, *AD = nullptr, *RD = nullptr, *Skewness = nullptr, *Kurtosis = nullptr,
+      *CL = nullptr, *CP = nullptr, *CS = nullptr, *R1 = nullptr, *R2 = nullptr, *R3 = nullptr, *K1 = nullptr, *K2 = nullptr, *K3 = nullptr;
+    TScalarType *eigenValues[3] = { nullptr, nullptr, nullptr };
+    TVectorType *eigenVectors[3] = { nullptr, nullptr, nullptr };
+  };
+
+  /**
+  \brief Computes the scalar maps of a buffer of tensors in a single (parallel) pass, with one eigen-analysis per tensor
+
+  The eigenvectors are only computed if one of their buffers is requested.
+
+  \param tensors The tensors, each with the layout expected by ComputeSymmetricEigenSystem3x3()
+  \param numberOfTensors The number of tensors in the buffer
+  \param outputs The buffers to write; each needs to have space for numberOfTensors voxels
+  */
+  template< class TTensorType, class TScalarType, class TVectorType >
+  void ComputeTensorScalarMaps(const TTensorType *tensors, const size_t numberOfTensors, const TensorScalarBuffers< TScalarType, TVectorType > &outputs)
+  {
+    const bool computeEigenVectors = (outputs.eigenVectors[0] != nullptr) || (outputs.eigenVectors[1] != nullptr) || (outputs.eigenVectors[2] != nullptr);
+    const long long numberOfVoxels = static_cast< long long >(numberOfTensors);
+
+#pragma omp parallel for if (numberOfVoxels > 65536)
+    for (long long i = 0; i < numberOfVoxels; i++)
+    {
+      const auto eigenSystem = ComputeSymmetricEigenSystem3x3(tensors[i], computeEigenVectors);
+      const auto scalars = ComputeTensorScalars(eigenSystem.eigenValues);
+      auto write = [i](TScalarType *buffer, double value)
+      {
+        if (buffer != nullptr)
+        {
+          buffer[i] = static_cast< TScalarType >(value);
+        }
+      };
+
+      write(outputs.FA, scalars.FA);
+      write(outputs.TR, scalars.TR);
+      write(outputs.AD, scalars.AD);
+      write(outputs.RD, scalars.RD);
+      write(outputs.Skewness, scalars.Skewness);
+      write(outputs.Kurtosis, scalars.Kurtosis);
+      write(outputs.CL, scalars.CL);
+      write(outputs.CP, scalars.CP);
+      write(outputs.CS, scalars.CS);
+      write(outputs.R1, scalars.R1);
+      write(outputs.R2, scalars.R2);
+      write(outputs.R3, scalars.R3);
+      write(outputs.K1, scalars.K1);
+      write(outputs.K2, scalars.K2);
+      write(outputs.K3, scalars.K3);
+
+      for (size_t e = 0; e < 3; e++)
+      {
+        write(outputs.eigenValues[e], eigenSystem.eigenValues[2 - e]);
+        if (outputs.eigenVectors[e] != nullptr)
+        {
+          for (size_t k = 0; k < 3; k++)
+          {
+            outputs.eigenVectors[e][3 * i + k] = static_cast< TVectorType >(eigenSystem.eigenVectors[2 - e][k]);
+          }
+        }
+      }
+    }
+  }
+}
@@ -35,6 +35,8 @@ static const char  cSeparator = '\\';
 #include <sys/types.h>
 #include <errno.h>
 #include <ftw.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #if (__APPLE__)
   #include <mach-o/dyld.h>
   #include <sys/sysctl.h>
@@ -42,6 +44,8 @@ static const char  cSeparator = '\\';
   #include <mach/mach_types.h>
   #include <mach/mach_init.h>
   #include <mach/mach_host.h>
+  #include <mach/mach.h>
+  #include <sys/resource.h>
 #else
   #include <sys/sysinfo.h>
 #endif
@@ -1407,15 +1411,214 @@ namespace cbica
     return allDirectories;
   }
 
-  size_t numberOfRowsInFile(const std::string &csvFileName, const std::string &delim)
+  MemoryMappedFile::MemoryMappedFile(const std::string &fileName)
   {
-    std::ifstream inFile(csvFileName.c_str());
+#if _WIN32
+    auto fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+    {
+      return;
+    }
+    m_fileHandle = fileHandle;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize))
+    {
+      return;
+    }
+    m_size = static_cast< size_t >(fileSize.QuadPart);
+    m_isOpen = true;
+    if (m_size == 0)
+    {
+      return;
+    }
+    m_mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_mappingHandle != NULL)
+    {
+      m_data = static_cast< const char * >(MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+      m_isMapped = (m_data != nullptr);
+    }
+#else
+    int fileDescriptor = open(fileName.c_str(), O_RDONLY);
+    if (fileDescriptor < 0)
+    {
+      return;
+    }
+    struct stat fileStatus;
+    if (fstat(fileDescriptor, &fileStatus) != 0)
+    {
+      close(fileDescriptor);
+      return;
+    }
+    m_size = static_cast< size_t >(fileStatus.st_size);
+    m_isOpen = true;
+    if (m_size > 0)
+    {
+      void *mapped = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+      if (mapped != MAP_FAILED)
+      {
+        madvise(mapped, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast< const char * >(mapped);
+        m_isMapped = true;
+      }
+    }
+    close(fileDescriptor); // the mapping stays valid after the descriptor is closed
+#endif
+
+    if (m_isOpen && (m_size > 0) && !m_isMapped)
+    {
+      // mapping is not possible (for example, on some network file systems), so read everything in one go
+      std::ifstream inFile(fileName.c_str(), std::ios::binary);
+      m_fallbackBuffer.resize(m_size);
+      if (!inFile.read(m_fallbackBuffer.data(), m_size))
+      {
+        m_isOpen = false;
+        m_size = 0;
+        return;
+      }
+      m_data = m_fallbackBuffer.data();
+    }
+  }
+
+  MemoryMappedFile::~MemoryMappedFile()
+  {
+#if _WIN32
+    if (m_isMapped)
+    {
+      UnmapViewOfFile(m_data);
+    }
+    if (m_mappingHandle != nullptr)
+    {
+      CloseHandle(m_mappingHandle);
+    }
+    if (m_fileHandle != nullptr)
+    {
+      CloseHandle(m_fileHandle);
+    }
+#else
+    if (m_isMapped)
+    {
+      munmap(const_cast< char * >(m_data), m_size);
+    }
+#endif
+  }
+
+  double parseCSVNumber(const char *begin, const char *end)
+  {
+    // exact powers of 10 representable in a double
+    static const double powersOf10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+      1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    while ((begin < end) && ((*begin == ' ') || (*begin == '\t') || (*begin == '"')))
+    {
+      begin++;
+    }
+    while ((end > begin) && ((*(end - 1) == ' ') || (*(end - 1) == '\t') || (*(end - 1) == '"') || (*(end - 1) == '\r')))
+    {
+      end--;
+    }
+    if (begin == end)
+    {
+      return 0;
+    }
 
-    // new lines will be skipped
-    inFile.unsetf(std::ios_base::skipws);
+    auto current = begin;
+    bool negative = false;
+    if ((*current == '-') || (*current == '+'))
+    {
+      negative = (*current == '-');
+      current++;
+    }
+
+    // accumulate up to 19 significant digits; the fast path below only applies to mantissas up to 2^53
+    unsigned long long mantissa = 0;
+    int exponent = 0, digits = 0;
+    bool anyDigit = false;
+    for (; (current < end) && (*current >= '0') && (*current <= '9'); current++)
+    {
+      anyDigit = true;
+      if (digits < 19)
+      {
+        mantissa = mantissa * 10 + static_cast< unsigned long long >(*current - '0');
+        if (mantissa != 0)
+        {
+          digits++;
+        }
+      }
+      else
+      {
+        exponent++;
+      }
+    }
+    if ((current < end) && (*current == '.'))
+    {
+      current++;
+      for (; (current < end) && (*current >= '0') && (*current <= '9'); current++)
+      {
+        anyDigit = true;
+        if (digits < 19)
+        {
+          mantissa = mantissa * 10 + static_cast< unsigned long long >(*current - '0');
+          if (mantissa != 0)
+          {
+            digits++;
+          }
+          exponent--;
+        }
+      }
+    }
+    if (anyDigit && (current < end) && ((*current == 'e') || (*current == 'E')))
+    {
+      auto exponentStart = current + 1;
+      bool negativeExponent = false;
+      if ((exponentStart < end) && ((*exponentStart == '-') || (*exponentStart == '+')))
+      {
+        negativeExponent = (*exponentStart == '-');
+        exponentStart++;
+      }
+      if ((exponentStart < end) && (*exponentStart >= '0') && (*exponentStart <= '9'))
+      {
+        int explicitExponent = 0;
+        for (current = exponentStart; (current < end) && (*current >= '0') && (*current <= '9'); current++)
+        {
+          if (explicitExponent < 100000)
+          {
+            explicitExponent = explicitExponent * 10 + (*current - '0');
+          }
+        }
+        exponent += negativeExponent ? -explicitExponent : explicitExponent;
+      }
+    }
+
+    if (anyDigit && (current == end) && (mantissa <= (1ULL << 53)) && (exponent >= -22) && (exponent <= 22))
+    {
+      // both the mantissa and the power of 10 are exact, so a single multiplication/division is correctly rounded
+      double value = static_cast< double >(mantissa);
+      value = (exponent < 0) ? value / powersOf10[-exponent] : value * powersOf10[exponent];
+      return negative ? -value : value;
+    }
+
+    // anything else (long mantissas, large exponents, nan/inf, trailing text) goes through strtod on a terminated copy
+    char buffer[64];
+    const size_t length = static_cast< size_t >(end - begin);
+    if (length < sizeof(buffer))
+    {
+      memcpy(buffer, begin, length);
+      buffer[length] = '\0';
+      return std::strtod(buffer, NULL);
+    }
+    return std::strtod(std::string(begin, end).c_str(), NULL);
+  }
+
+  size_t numberOfRowsInFile(const std::string &csvFileName, const std::string &delim)
+  {
+    MemoryMappedFile inFile(csvFileName);
+    if (!inFile.IsOpen() || (inFile.GetSize() == 0))
+    {
+      return 0;
+    }
 
     // count the "\n"s with an algorithm specialized for counting
-    return std::count(std::istream_iterator<char>(inFile), std::istream_iterator<char>(), *constCharToChar(delim));
+    return std::count(inFile.GetData(), inFile.GetData() + inFile.GetSize(), delim[0]);
   }
 
   size_t numberOfColsInFile(const std::string &csvFileName, const std::string & delim)
@@ -1444,26 +1647,31 @@ namespace cbica
 
     //std::string dirName_Wrap = dirName;
 
-    // store number of rows in the file - this is used to make the program parallelize-able
-    const size_t numberOfRows = numberOfRowsInFile(csvFileName);
-
-    // initialize return dictionary
-    std::vector< CSVDict > return_CSVDict;
-    return_CSVDict.resize(numberOfRows - 1);
-
     std::vector< std::vector < std::string > > allRows; // store the entire data of the CSV file as a vector of colums and rows (vector< rows <cols> >)
 
-    std::ifstream inFile(csvFileName.c_str());
+    {
+      // single pass over the mapped file
+      MemoryMappedFile inFile(csvFileName);
+      const char *lineBegin = inFile.GetData(), *fileEnd = inFile.GetData() + inFile.GetSize();
+      while (lineBegin < fileEnd)
+      {
+        auto lineEnd = std::find(lineBegin, fileEnd, rowsDelimiter[0]);
+        std::string line(lineBegin, lineEnd);
+        line.erase(std::remove(line.begin(), line.end(), '"'), line.end());
+        allRows.push_back(stringSplit(line, colsDelimiter));
+        lineBegin = (lineEnd < fileEnd) ? lineEnd + 1 : fileEnd;
+      }
+    } // at this point, the entire data from the CSV file has been read and stored in allRows
 
-    for (size_t i = 0; i < numberOfRows; i++)
+    if (allRows.empty())
     {
-      std::string line;
-      std::getline(inFile, line, *constCharToChar(rowsDelimiter));
-      line.erase(std::remove(line.begin(), line.end(), '"'), line.end());
-      allRows.push_back(stringSplit(line, colsDelimiter));
+      std::cerr << "Supplied file name, '" << csvFileName << "' is empty.\n";
+      exit(EXIT_FAILURE);
     }
 
-    inFile.close(); // at this point, the entire data from the CSV file has been read and stored in allRows
+    // initialize return dictionary
+    std::vector< CSVDict > return_CSVDict;
+    return_CSVDict.resize(allRows.size() - 1);
 
     std::vector< std::string > inputColumnsVec = stringSplit(inputColumns, optionsDelimiter), inputLabelsVec; // columns to consider as images
 
@@ -1575,179 +1783,487 @@ namespace cbica
 
   std::vector< std::vector< std::string > > readCSVDataFile(const std::string &csvFileName)
   {
-    const size_t rows = numberOfRowsInFile(csvFileName);
-    const size_t cols = numberOfColsInFile(csvFileName);
-
     std::vector< std::vector< std::string > > returnVector;
-    std::ifstream data(csvFileName.c_str());
-    std::string line, cell;
+    MemoryMappedFile data(csvFileName);
+    const char *lineBegin = data.GetData(), *fileEnd = data.GetData() + data.GetSize();
 
-    returnVector.resize(rows);
-    size_t i = 0, j = 0;
-    while (std::getline(data, line))
+    size_t cols = 0;
+    while (lineBegin < fileEnd)
     {
-      j = 0;
-      returnVector[i].resize(cols);
-      std::stringstream lineStream(line);
-      while (std::getline(lineStream, cell, ','))
+      auto nextLine = std::find(lineBegin, fileEnd, '\n');
+      auto lineEnd = nextLine;
+      if ((lineEnd > lineBegin) && (*(lineEnd - 1) == '\r'))
       {
-        returnVector[i][j] = cell;
-        j++;
+        lineEnd--;
       }
-      i++;
-    }
 
-    return returnVector;
-  }
-
-  std::map< std::string, size_t > ConfusionMatrix(const std::vector< float > &inputRealLabels, const std::vector< float > &inputPredictedLabels)
-  {
-    std::map< std::string, size_t > returnConfusionMatrix;
-
-    if (inputRealLabels.size() != inputPredictedLabels.size())
-    {
-      std::cerr << "The sizes of the real and predicted labels do not match; exiting.\n";
-      return returnConfusionMatrix;
-    }
-
-    size_t TP = 0, TN = 0, FP = 0, FN = 0, RP = 0, PP = 0;
-
-    for (size_t i = 0; i < inputRealLabels.size(); i++)
-    {
-      if (inputRealLabels[i] == 1)
+      std::vector< std::string > row;
+      row.reserve(cols);
+      auto cellBegin = lineBegin;
+      while (cellBegin < lineEnd)
       {
-        RP++;
+        auto cellEnd = std::find(cellBegin, lineEnd, ',');
+        row.emplace_back(cellBegin, cellEnd);
+        cellBegin = cellEnd + 1;
       }
-      if (inputPredictedLabels[i] == 1)
+      if (returnVector.empty())
       {
-        PP++;
+        cols = row.size();
       }
+      row.resize(std::max(cols, row.size()));
+      returnVector.push_back(std::move(row));
 
-      // both real and predicted labels are equal means it is a "true" prediction
-      if (inputRealLabels[i] == inputPredictedLabels[i])
-      {
-        if (inputRealLabels[i] == 1)
-        {
-          TP++;
-        }
-        else
-        {
-          TN++;
-        }
-      }
-      else
-      {
-        if (inputRealLabels[i] == 1)
-        {
-          FN++;
-        }
-        else
-        {
-          FP++;
-        }
-      }
+      lineBegin = (nextLine < fileEnd) ? nextLine + 1 : fileEnd;
     }
 
-    // construct the return structure
+    return returnVector;
+  }
+
+  std::map< std::string, size_t > ConfusionMatrixCounts::ToMap() const
+  {
+    std::map< std::string, size_t > returnConfusionMatrix;
     returnConfusionMatrix["TP"] = TP;
     returnConfusionMatrix["FP"] = FP;
     returnConfusionMatrix["TN"] = TN;
     returnConfusionMatrix["FN"] = FN;
     returnConfusionMatrix["RP"] = RP;
     returnConfusionMatrix["PP"] = PP;
-
     return returnConfusionMatrix;
   }
 
-  std::map< std::string, float > ROC_Values(const std::vector< float > &inputRealLabels, const std::vector< float > &inputPredictedLabels)
+  std::map< std::string, size_t > ConfusionMatrix(const std::vector< float > &inputRealLabels, const std::vector< float > &inputPredictedLabels)
   {
-    std::map< std::string, float > returnStatistics;
+    if (inputRealLabels.size() != inputPredictedLabels.size())
+    {
+      std::cerr << "The sizes of the real and predicted labels do not match; exiting.\n";
+      return std::map< std::string, size_t >();
+    }
+
+    return GetConfusionMatrixCounts(inputRealLabels.data(), inputPredictedLabels.data(), inputRealLabels.size()).ToMap();
+  }
 
+  std::map< std::string, float > ROC_Values(const std::vector< float > &inputRealLabels, const std::vector< float > &inputPredictedLabels)
+  {
     if (inputRealLabels.size() != inputPredictedLabels.size())
     {
       std::cerr << "The sizes of the real and predicted labels do not match; exiting.\n";
-      return returnStatistics;
+      return std::map< std::string, float >();
     }
 
-    auto confusionMatrix = ConfusionMatrix(inputRealLabels, inputPredictedLabels);
-    returnStatistics["TP"] = static_cast<float>(confusionMatrix["TP"]);
-    returnStatistics["FP"] = static_cast<float>(confusionMatrix["FP"]);
-    returnStatistics["TN"] = static_cast<float>(confusionMatrix["TN"]);
-    returnStatistics["FN"] = static_cast<float>(confusionMatrix["FN"]);
-    returnStatistics["RP"] = static_cast<float>(confusionMatrix["RP"]);
-    returnStatistics["PP"] = static_cast<float>(confusionMatrix["PP"]);
+    return ROC_Values(GetConfusionMatrixCounts(inputRealLabels.data(), inputPredictedLabels.data(), inputRealLabels.size()));
+  }
 
-    // https://en.wikipedia.org/wiki/Accuracy_and_precision
-    returnStatistics["Accuracy"] = (returnStatistics["TP"] + returnStatistics["TN"]) / (returnStatistics["TP"] + returnStatistics["TN"] + returnStatistics["FP"] + returnStatistics["FN"]);
+  std::map< std::string, float > ROC_Values(const ConfusionMatrixCounts &counts)
+  {
+    // everything is calculated on plain floats and only put in the map at the end
+    const float TP = static_cast< float >(counts.TP), FP = static_cast< float >(counts.FP),
+      TN = static_cast< float >(counts.TN), FN = static_cast< float >(counts.FN),
+      RP = static_cast< float >(counts.RP), PP = static_cast< float >(counts.PP),
+      total = static_cast< float >(counts.GetTotal());
 
+    // https://en.wikipedia.org/wiki/Sensitivity_and_specificity
+    const float TPR = TP / (TP + FN);
+    // https://en.wikipedia.org/wiki/False_positive_rate
+    const float FPR = FP / (total - RP);
+    // https://en.wikipedia.org/wiki/False_positives_and_false_negatives#False_positive_and_false_negative_rates
+    const float FNR = FN / RP;
+    // https://en.wikipedia.org/wiki/Sensitivity_and_specificity
+    const float TNR = TN / (TN + FP);
+    // https://en.wikipedia.org/wiki/Likelihood_ratios_in_diagnostic_testing
+    const float LRPositive = TPR / FPR, LRNegative = FNR / TNR;
     // https://en.wikipedia.org/wiki/Positive_and_negative_predictive_values
-    returnStatistics["PPV"] = returnStatistics["TP"] / (returnStatistics["TP"] + returnStatistics["FP"]);
-    returnStatistics["Precision"] = returnStatistics["PPV"];
+    const float PPV = TP / (TP + FP);
+
+    std::map< std::string, float > returnStatistics;
+    returnStatistics["TP"] = TP;
+    returnStatistics["FP"] = FP;
+    returnStatistics["TN"] = TN;
+    returnStatistics["FN"] = FN;
+    returnStatistics["RP"] = RP;
+    returnStatistics["PP"] = PP;
+
+    // https://en.wikipedia.org/wiki/Accuracy_and_precision
+    returnStatistics["Accuracy"] = (TP + TN) / (TP + TN + FP + FN);
+
+    returnStatistics["PPV"] = PPV;
+    returnStatistics["Precision"] = PPV;
 
     // https://en.wikipedia.org/wiki/False_discovery_rate
-    returnStatistics["FDR"] = returnStatistics["TP"] / returnStatistics["PP"];
+    returnStatistics["FDR"] = TP / PP;
 
     // https://en.wikipedia.org/wiki/Positive_and_negative_predictive_values#false_omission_rate
-    returnStatistics["FOR"] = returnStatistics["FN"] / (inputPredictedLabels.size() - returnStatistics["PP"]);
+    returnStatistics["FOR"] = FN / (total - PP);
 
     // https://en.wikipedia.org/wiki/Positive_and_negative_predictive_values
-    returnStatistics["NPV"] = returnStatistics["TN"] / (inputPredictedLabels.size() - returnStatistics["PP"]);
+    returnStatistics["NPV"] = TN / (total - PP);
 
     // https://en.wikipedia.org/wiki/Prevalence
-    returnStatistics["Prevalence"] = returnStatistics["RP"] / (2 * inputRealLabels.size());
-
-    // https://en.wikipedia.org/wiki/Sensitivity_and_specificity
-    returnStatistics["TPR"] = returnStatistics["TP"] / (returnStatistics["TP"] + returnStatistics["FN"]);
-    returnStatistics["Sensitivity"] = returnStatistics["TPR"];
-    returnStatistics["Recall"] = returnStatistics["TPR"];
-    returnStatistics["POD"] = returnStatistics["TPR"];
+    returnStatistics["Prevalence"] = RP / (2 * total);
 
-    // https://en.wikipedia.org/wiki/False_positive_rate
-    returnStatistics["FPR"] = returnStatistics["FP"] / (inputPredictedLabels.size() - returnStatistics["RP"]);
-    returnStatistics["Fall-Out"] = returnStatistics["FPR"];
+    returnStatistics["TPR"] = TPR;
+    returnStatistics["Sensitivity"] = TPR;
+    returnStatistics["Recall"] = TPR;
+    returnStatistics["POD"] = TPR;
 
-    // https://en.wikipedia.org/wiki/False_positives_and_false_negatives#False_positive_and_false_negative_rates
-    returnStatistics["FNR"] = returnStatistics["FN"] / returnStatistics["RP"];
-    returnStatistics["MR"] = returnStatistics["FNR"];
+    returnStatistics["FPR"] = FPR;
+    returnStatistics["Fall-Out"] = FPR;
 
-    // https://en.wikipedia.org/wiki/Sensitivity_and_specificity
-    returnStatistics["TNR"] = returnStatistics["TN"] / (returnStatistics["TN"] + returnStatistics["FP"]);
-    returnStatistics["Specificity"] = returnStatistics["TNR"];
+    returnStatistics["FNR"] = FNR;
+    returnStatistics["MR"] = FNR;
 
-    // https://en.wikipedia.org/wiki/Likelihood_ratios_in_diagnostic_testing#positive_likelihood_ratio
-    returnStatistics["LR+"] = returnStatistics["TPR"] / returnStatistics["FPR"];
+    returnStatistics["TNR"] = TNR;
+    returnStatistics["Specificity"] = TNR;
 
-    // https://en.wikipedia.org/wiki/Likelihood_ratios_in_diagnostic_testing#negative_likelihood_ratio
-    returnStatistics["LR-"] = returnStatistics["FNR"] / returnStatistics["TNR"];
+    returnStatistics["LR+"] = LRPositive;
+    returnStatistics["LR-"] = LRNegative;
 
     // https://en.wikipedia.org/wiki/Diagnostic_odds_ratio
-    returnStatistics["DOR"] = returnStatistics["LR+"] / returnStatistics["LR-"];
+    returnStatistics["DOR"] = LRPositive / LRNegative;
 
     // https://en.wikipedia.org/wiki/S%C3%B8rensen%E2%80%93Dice_coefficient
-    returnStatistics["Dice"] = 2 * returnStatistics["TP"] / (2 * returnStatistics["TP"] + returnStatistics["FP"] + returnStatistics["FN"]);
+    returnStatistics["Dice"] = 2 * TP / (2 * TP + FP + FN);
 
     // https://en.wikipedia.org/wiki/Jaccard_index
-    returnStatistics["JR"] = 2 * returnStatistics["TP"] / (returnStatistics["TP"] + returnStatistics["FP"] + returnStatistics["FN"]);
+    returnStatistics["JR"] = 2 * TP / (TP + FP + FN);
 
     return returnStatistics;
   }
 
+  ROCCurve GetROCCurve(const float *realLabels, const float *scores, const size_t size, const size_t numberOfBins,
+    const float positiveLabel, const bool storeCurve)
+  {
+    ROCCurve returnCurve;
+    if (size == 0)
+    {
+      return returnCurve;
+    }
+
+    // NaN scores cannot be ordered (which breaks both the sort and the binning), so they are excluded up front
+    size_t numberOfNaNs = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+      numberOfNaNs += std::isnan(scores[i]) ? 1 : 0;
+    }
+    if (numberOfNaNs > 0)
+    {
+      std::cerr << "Excluding " << numberOfNaNs << " NaN score(s) from the ROC curve.\n";
+      std::vector< float > validLabels, validScores;
+      validLabels.reserve(size - numberOfNaNs);
+      validScores.reserve(size - numberOfNaNs);
+      for (size_t i = 0; i < size; i++)
+      {
+        if (!std::isnan(scores[i]))
+        {
+          validLabels.push_back(realLabels[i]);
+          validScores.push_back(scores[i]);
+        }
+      }
+      return GetROCCurve(validLabels.data(), validScores.data(), validLabels.size(), numberOfBins, positiveLabel, storeCurve);
+    }
+    const long long numberOfElements = static_cast< long long >(size);
+
+    // adds a point to the curve and the trapezoid between it and the previous point to the AUC
+    size_t previousTP = 0, previousFP = 0;
+    double area = 0; // in units of (positives * negatives) * 2
+    auto addPoint = [&](size_t truePositives, size_t falsePositives, float threshold)
+    {
+      area += static_cast< double >(falsePositives - previousFP) * static_cast< double >(truePositives + previousTP);
+      previousTP = truePositives;
+      previousFP = falsePositives;
+      if (storeCurve)
+      {
+        returnCurve.thresholds.push_back(threshold);
+        returnCurve.truePositiveRates.push_back(static_cast< float >(truePositives));
+        returnCurve.falsePositiveRates.push_back(static_cast< float >(falsePositives));
+      }
+    };
+    addPoint(0, 0, std::numeric_limits< float >::infinity());
+
+    if (numberOfBins == 0)
+    {
+      // exact: sort once (descending scores) and emit a point after every run of equal scores
+      std::vector< std::pair< float, unsigned char > > sorted(size);
+#pragma omp parallel for
+      for (long long i = 0; i < numberOfElements; i++)
+      {
+        sorted[i] = std::make_pair(scores[i], static_cast< unsigned char >(realLabels[i] == positiveLabel));
+      }
+      std::sort(sorted.begin(), sorted.end(),
+        [](const std::pair< float, unsigned char > &a, const std::pair< float, unsigned char > &b) { return a.first > b.first; });
+
+      size_t truePositives = 0, falsePositives = 0;
+      for (size_t i = 0; i < size; i++)
+      {
+        truePositives += sorted[i].second;
+        falsePositives += 1 - sorted[i].second;
+        if ((i + 1 == size) || (sorted[i + 1].first != sorted[i].first))
+        {
+          addPoint(truePositives, falsePositives, sorted[i].first);
+        }
+      }
+    }
+    else
+    {
+      // binned: positive/negative histograms over the range of scores
+      float minScore = scores[0], maxScore = scores[0];
+#pragma omp parallel
+      {
+        // min/max reductions are not available in OpenMP 2.0 (MSVC)
+        float threadMin = scores[0], threadMax = scores[0];
+#pragma omp for nowait
+        for (long long i = 0; i < numberOfElements; i++)
+        {
+          threadMin = std::min(threadMin, scores[i]);
+          threadMax = std::max(threadMax, scores[i]);
+        }
+#pragma omp critical
+        {
+          minScore = std::min(minScore, threadMin);
+          maxScore = std::max(maxScore, threadMax);
+        }
+      }
+      const double binWidth = (maxScore > minScore) ? (static_cast< double >(maxScore) - minScore) / numberOfBins : 1.0;
+
+      std::vector< size_t > positiveHistogram(numberOfBins, 0), negativeHistogram(numberOfBins, 0);
+#pragma omp parallel
+      {
+        std::vector< size_t > threadPositives(numberOfBins, 0), threadNegatives(numberOfBins, 0);
+#pragma omp for nowait
+        for (long long i = 0; i < numberOfElements; i++)
+        {
+          auto bin = std::min(numberOfBins - 1, static_cast< size_t >((scores[i] - minScore) / binWidth));
+          if (realLabels[i] == positiveLabel)
+          {
+            threadPositives[bin]++;
+          }
+          else
+          {
+            threadNegatives[bin]++;
+          }
+        }
+#pragma omp critical
+        {
+          for (size_t bin = 0; bin < numberOfBins; bin++)
+          {
+            positiveHistogram[bin] += threadPositives[bin];
+            negativeHistogram[bin] += threadNegatives[bin];
+          }
+        }
+      }
+
+      // sweep from the highest bin; the threshold is the lower edge of each bin
+      size_t truePositives = 0, falsePositives = 0;
+      for (size_t bin = numberOfBins; bin-- > 0;)
+      {
+        if ((positiveHistogram[bin] == 0) && (negativeHistogram[bin] == 0))
+        {
+          continue;
+        }
+        truePositives += positiveHistogram[bin];
+        falsePositives += negativeHistogram[bin];
+        addPoint(truePositives, falsePositives, static_cast< float >(minScore + bin * binWidth));
+      }
+    }
+
+    returnCurve.positives = previousTP;
+    returnCurve.negatives = previousFP;
+
+    // normalize counts to rates
+    const float positives = static_cast< float >(std::max< size_t >(1, returnCurve.positives)),
+      negatives = static_cast< float >(std::max< size_t >(1, returnCurve.negatives));
+    for (size_t i = 0; i < returnCurve.thresholds.size(); i++)
+    {
+      returnCurve.truePositiveRates[i] /= positives;
+      returnCurve.falsePositiveRates[i] /= negatives;
+    }
+
+    if ((returnCurve.positives == 0) || (returnCurve.negatives == 0))
+    {
+      std::cerr << "AUC is undefined when only one class is present in the real labels.\n";
+      returnCurve.auc = std::numeric_limits< double >::quiet_NaN();
+    }
+    else
+    {
+      returnCurve.auc = area / (2.0 * static_cast< double >(returnCurve.positives) * static_cast< double >(returnCurve.negatives));
+    }
+
+    return returnCurve;
+  }
+
+  ROCCurve GetROCCurve(const std::vector< float > &realLabels, const std::vector< float > &scores, const size_t numberOfBins)
+  {
+    if (realLabels.size() != scores.size())
+    {
+      std::cerr << "The sizes of the real labels and scores do not match; exiting.\n";
+      return ROCCurve();
+    }
+    return GetROCCurve(realLabels.data(), scores.data(), realLabels.size(), numberOfBins);
+  }
+
   float area_under_curve(const std::vector< float > &inputRealLabels, const std::vector< float > &inputPredictedLabels)
   {
-    area_under_curve(ROC_Values(inputRealLabels, inputPredictedLabels));
+    if (inputRealLabels.size() != inputPredictedLabels.size())
+    {
+      std::cerr << "The sizes of the real and predicted labels do not match; exiting.\n";
+      return std::numeric_limits< float >::quiet_NaN();
+    }
+    return static_cast< float >(GetROCCurve(inputRealLabels.data(), inputPredictedLabels.data(), inputRealLabels.size(), 0, 1, false).auc);
   }
 
   float area_under_curve(const std::map< std::string, float > &roc_values)
   {
-    float auc = 0.0;
-    for (size_t i = 0; i < roc_values.size() - 1; i++)
+    auto tpr = roc_values.find("TPR"), fpr = roc_values.find("FPR");
+    if ((tpr == roc_values.end()) || (fpr == roc_values.end()))
     {
-      auc += roc_values[i + 1]["FPR"]
+      std::cerr << "TPR and FPR need to be present; use ROC_Values() to get them.\n";
+      return std::numeric_limits< float >::quiet_NaN();
     }
-    for (int i = 0; i<int(roc.size()) - 1; i++) {
-      _auc += (roc[i + 1].y + roc[i].y) * (roc[i + 1].x - roc[i].x);
+    return (1 + tpr->second - fpr->second) / 2;
+  }
+
+  std::map< std::string, double > GetOverlapMeasures(const ConfusionMatrixCounts &counts)
+  {
+    const double intersection = static_cast< double >(counts.TP), source = static_cast< double >(counts.RP),
+      target = static_cast< double >(counts.PP), unionSize = source + target - intersection;
+
+    std::map< std::string, double > returnMap;
+    returnMap["Overlap"] = (target > 0) ? intersection / target : ((source > 0) ? 0 : 1);
+    returnMap["Jaccard"] = (unionSize > 0) ? intersection / unionSize : 1;
+    returnMap["Dice"] = (source + target > 0) ? 2 * intersection / (source + target) : 1;
+    returnMap["VolumeSimilarity"] = (source + target > 0) ? 2 * (source - target) / (source + target) : 0;
+    returnMap["FalseNegativeError"] = (target > 0) ? (target - intersection) / target : 0;
+    returnMap["FalsePositiveError"] = (source > 0) ? (source - intersection) / source : 0;
+
+    return returnMap;
+  }
+
+  size_t LabelCooccurrence::GetCount(const double label_1, const double label_2) const
+  {
+    auto row = std::lower_bound(labels_1.begin(), labels_1.end(), label_1),
+      column = std::lower_bound(labels_2.begin(), labels_2.end(), label_2);
+    if ((row == labels_1.end()) || (*row != label_1) || (column == labels_2.end()) || (*column != label_2))
+    {
+      return 0;
     }
-    return _auc * 0.5f;
+    return counts[(row - labels_1.begin()) * labels_2.size() + (column - labels_2.begin())];
+  }
+
+  ConfusionMatrixCounts LabelCooccurrence::GetRegionCounts(const std::vector< double > &regionLabels) const
+  {
+    std::vector< bool > isRegion_1(labels_1.size()), isRegion_2(labels_2.size());
+    for (size_t i = 0; i < labels_1.size(); i++)
+    {
+      isRegion_1[i] = (std::find(regionLabels.begin(), regionLabels.end(), labels_1[i]) != regionLabels.end());
+    }
+    for (size_t j = 0; j < labels_2.size(); j++)
+    {
+      isRegion_2[j] = (std::find(regionLabels.begin(), regionLabels.end(), labels_2[j]) != regionLabels.end());
+    }
+
+    ConfusionMatrixCounts returnCounts;
+    for (size_t i = 0; i < labels_1.size(); i++)
+    {
+      for (size_t j = 0; j < labels_2.size(); j++)
+      {
+        const auto count = counts[i * labels_2.size() + j];
+        if (isRegion_1[i])
+        {
+          returnCounts.RP += count;
+        }
+        if (isRegion_2[j])
+        {
+          returnCounts.PP += count;
+        }
+        if (isRegion_1[i] && isRegion_2[j])
+        {
+          returnCounts.TP += count;
+        }
+      }
+    }
+    returnCounts.FN = returnCounts.RP - returnCounts.TP;
+    returnCounts.FP = returnCounts.PP - returnCounts.TP;
+    returnCounts.TN = total - returnCounts.RP - returnCounts.FP;
+
+    return returnCounts;
+  }
+
+  ConfusionMatrixCounts LabelCooccurrence::GetConfusionMatrixCounts(const double positiveLabel) const
+  {
+    ConfusionMatrixCounts returnCounts;
+    size_t equal = 0;
+    for (size_t i = 0; i < labels_1.size(); i++)
+    {
+      for (size_t j = 0; j < labels_2.size(); j++)
+      {
+        const auto count = counts[i * labels_2.size() + j];
+        if (labels_1[i] == positiveLabel)
+        {
+          returnCounts.RP += count;
+        }
+        if (labels_2[j] == positiveLabel)
+        {
+          returnCounts.PP += count;
+        }
+        if (labels_1[i] == labels_2[j])
+        {
+          equal += count;
+          if (labels_1[i] == positiveLabel)
+          {
+            returnCounts.TP += count;
+          }
+        }
+      }
+    }
+    returnCounts.TN = equal - returnCounts.TP;
+    returnCounts.FN = returnCounts.RP - returnCounts.TP;
+    returnCounts.FP = total - equal - returnCounts.FN;
+
+    return returnCounts;
+  }
+
+  void LabelCooccurrence::AddCount(const double label_1, const double label_2, const size_t count)
+  {
+    auto row = std::lower_bound(labels_1.begin(), labels_1.end(), label_1);
+    auto column = std::lower_bound(labels_2.begin(), labels_2.end(), label_2);
+    const size_t rowIndex = row - labels_1.begin(), columnIndex = column - labels_2.begin();
+
+    // insert the missing labels and rebuild the table around them
+    const bool newRow = (row == labels_1.end()) || (*row != label_1), newColumn = (column == labels_2.end()) || (*column != label_2);
+    if (newRow || newColumn)
+    {
+      const size_t oldColumns = labels_2.size();
+      if (newRow)
+      {
+        labels_1.insert(row, label_1);
+      }
+      if (newColumn)
+      {
+        labels_2.insert(column, label_2);
+      }
+
+      std::vector< size_t > newCounts(labels_1.size() * labels_2.size(), 0);
+      for (size_t i = 0; i < labels_1.size(); i++)
+      {
+        if (newRow && (i == rowIndex))
+        {
+          continue;
+        }
+        const size_t oldRow = (newRow && (i > rowIndex)) ? i - 1 : i;
+        for (size_t j = 0; j < labels_2.size(); j++)
+        {
+          if (newColumn && (j == columnIndex))
+          {
+            continue;
+          }
+          const size_t oldColumn = (newColumn && (j > columnIndex)) ? j - 1 : j;
+          newCounts[i * labels_2.size() + j] = counts[oldRow * oldColumns + oldColumn];
+        }
+      }
+      counts.swap(newCounts);
+    }
+
+    counts[rowIndex * labels_2.size() + columnIndex] += count;
+    total += count;
   }
 
   //inline std::string iterateOverStringAndSeparators(const std::string &inputString, size_t &count, int enum_separator = 10)
@@ -2287,37 +2803,86 @@ namespace cbica
 #endif
   }
 
-  size_t getCurrentlyUsedMemoryByCurrentProcess()
+#if !defined(WIN32) && !(defined(__APPLE__) && defined(__MACH__))
+  //! Reads a "<field>: <value> kB" entry from /proc/self/status and returns it in bytes
+  inline size_t getProcStatusEntryInBytes(const char *field)
   {
-#if WIN32
-    PROCESS_MEMORY_COUNTERS pmc;
-    GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
-    return pmc.WorkingSetSize;
-
-#elif (defined(__APPLE__) && defined(__MACH__))
-    
     FILE* file = fopen("/proc/self/status", "r");
-    int result = -1;
+    if (file == NULL)
+    {
+      return 0;
+    }
+    const size_t fieldLength = strlen(field);
+    size_t result = 0;
     char line[128];
 
-    while (fgets(line, 128, file) != NULL) 
+    while (fgets(line, 128, file) != NULL)
     {
-      if (strncmp(line, "VmRSS:", 6) == 0) 
+      if (strncmp(line, field, fieldLength) == 0)
       {
-        result = strlen(line);
-        const char* p = line;
-        while (*p <'0' || *p > '9') 
+        const char* p = line + fieldLength;
+        while ((*p != '\0') && (*p < '0' || *p > '9'))
           p++;
-        line[result - 3] = '\0';
-        result = atoi(p);
+        result = static_cast< size_t >(std::strtoull(p, NULL, 10));
         break;
       }
     }
     fclose(file);
-    return static_cast< size_t >(result * 1000);
+    return result * 1024;
+  }
+#endif
+
+  size_t getCurrentlyUsedMemoryByCurrentProcess()
+  {
+#if WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+    return pmc.WorkingSetSize;
+
+#elif (defined(__APPLE__) && defined(__MACH__))
+    mach_task_basic_info info;
+    mach_msg_type_number_t infoCount = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &infoCount) != KERN_SUCCESS)
+    {
+      return 0;
+    }
+    return static_cast< size_t >(info.resident_size);
 
 #else
-    return 0;
+    return getProcStatusEntryInBytes("VmRSS:");
+#endif
+  }
+
+  size_t getPeakMemoryUsedByCurrentProcess()
+  {
+#if WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+    return pmc.PeakWorkingSetSize;
+
+#elif (defined(__APPLE__) && defined(__MACH__))
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast< size_t >(usage.ru_maxrss); // reported in bytes on macOS
+
+#else
+    return getProcStatusEntryInBytes("VmHWM:");
+#endif
+  }
+
+  bool resetPeakMemoryUsedByCurrentProcess()
+  {
+#if WIN32 || (defined(__APPLE__) && defined(__MACH__))
+    return false;
+#else
+    std::ofstream clearRefs("/proc/self/clear_refs");
+    if (!clearRefs.is_open())
+    {
+      return false;
+    }
+    clearRefs << "5";
+    clearRefs.close();
+    return !clearRefs.fail();
 #endif
   }
 
@@ -31,12 +31,17 @@ See COPYING file or https://www.med.upenn.edu/cbica/software-agreement.html
 #include <random>
 #include <iomanip>
 #include <limits>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
 
 #if _WIN32
 #include <process.h>
 #endif
 
-//#include <type_traits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 /**
 \struct CSVDict
@@ -653,67 +658,230 @@ namespace cbica
   std::vector< CSVDict > parseCSVFile(const std::string &csvFileName, const std::string &inputColumns, const std::string &inputLabels, bool checkFile = true, bool pathsRelativeToCSV = false, const std::string &rowsDelimiter = "\n", const std::string &colsDelimiter = ",", const std::string &optionsDelimiter = ",");
 
   /**
-  \brief Read a CSV file which has no header information
+  \brief Read-only memory map of an entire file; the mapping is released on destruction
 
-  To read CSV file with header information, check parseCSVFile() function. This should not be used for obtaining strings
+  Falls back to reading the file into memory if it cannot be mapped.
+  */
+  class MemoryMappedFile
+  {
+  public:
+    //! Constructor with the file to map
+    explicit MemoryMappedFile(const std::string &fileName);
 
-  \param csvFileName The full path of the file to parse, all paths are absolute or relative to current working directory
-  \param columnMajor If true, then return is a vector of all the columns; otherwise it is a vector of the rows
+    //! Releases the mapping
+    ~MemoryMappedFile();
+
+    MemoryMappedFile(const MemoryMappedFile &) = delete;
+    MemoryMappedFile &operator=(const MemoryMappedFile &) = delete;
+
+    //! Whether the file was opened successfully (an empty file is still valid)
+    bool IsOpen() const { return m_isOpen; }
+
+    //! Start of the file contents
+    const char *GetData() const { return m_data; }
+
+    //! Size of the file in bytes
+    size_t GetSize() const { return m_size; }
+
+  private:
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+    bool m_isOpen = false, m_isMapped = false;
+    std::vector< char > m_fallbackBuffer;
+#if _WIN32
+    void *m_fileHandle = nullptr, *m_mappingHandle = nullptr;
+#endif
+  };
+
+  /**
+  \brief Parse a single numeric CSV cell without any allocation or locale lookup
+
+  Leading/trailing spaces and double quotes are ignored; empty or non-numeric cells give 0 (same as std::atof).
+  Common decimal values are converted exactly with a fast path; everything else falls back to std::strtod.
+
+  \param begin Start of the cell
+  \param end One past the end of the cell
+  */
+  double parseCSVNumber(const char *begin, const char *end);
+
+  /**
+  \brief Contiguous (row- or column-major) storage of a numeric CSV file
   */
   template< class TDataType = double >
-  std::vector< std::vector< TDataType > > readCSVDataFile(const std::string &csvFileName, bool columnMajor = false)
+  struct CSVDataMatrix
   {
-    std::vector< std::vector< TDataType > > returnVector;
-    if (!cbica::isFile(csvFileName))
+    size_t rows = 0, cols = 0;
+    bool columnMajor = false;
+    std::vector< TDataType > data;
+
+    //! Access the element at (row, col)
+    TDataType &operator()(size_t row, size_t col)
     {
-      std::cerr << "Supplied file wasn't found.\n";
-      return returnVector;
+      return columnMajor ? data[col * rows + row] : data[row * cols + col];
     }
 
-    const size_t rows = numberOfRowsInFile(csvFileName);
-    const size_t cols = numberOfColsInFile(csvFileName);
+    //! Access the element at (row, col)
+    const TDataType &operator()(size_t row, size_t col) const
+    {
+      return columnMajor ? data[col * rows + row] : data[row * cols + col];
+    }
+  };
+
+  /**
+  \brief Read a numeric CSV file which has no header information into a single contiguous buffer
 
-    std::ifstream data(csvFileName.c_str());
-    std::string line, cell;
+  The file is memory-mapped and tokenized in a single scan. The file is split across threads at line boundaries; each thread
+  counts its lines, and then parses them straight into their final location. The number of columns is taken from the first line; 
+  missing cells are set to 0, extra cells are ignored and empty lines are skipped.
 
-    if (columnMajor)
+  \param csvFileName The full path of the file to parse
+  \param columnMajor If true, the columns are contiguous in the returned buffer; otherwise the rows are
+  \param delimiter The column delimiter
+  */
+  template< class TDataType = double >
+  CSVDataMatrix< TDataType > readCSVDataMatrix(const std::string &csvFileName, bool columnMajor = false, const char delimiter = ',')
+  {
+    CSVDataMatrix< TDataType > returnMatrix;
+    returnMatrix.columnMajor = columnMajor;
+
+    MemoryMappedFile file(csvFileName);
+    if (!file.IsOpen())
     {
-      returnVector.resize(cols);
+      std::cerr << "Supplied file '" << csvFileName << "' couldn't be read.\n";
+      return returnMatrix;
     }
-    else
+    const char *const fileBegin = file.GetData();
+    const char *const fileEnd = fileBegin + file.GetSize();
+
+    // end of the line starting at 'lineBegin' without the line break
+    auto getLineEnd = [fileEnd](const char *lineBegin)
     {
-      returnVector.resize(rows);
-    }
+      auto newLine = static_cast< const char * >(memchr(lineBegin, '\n', fileEnd - lineBegin));
+      return (newLine == nullptr) ? fileEnd : newLine;
+    };
+    auto stripCarriageReturn = [](const char *lineBegin, const char *lineEnd)
+    {
+      return ((lineEnd > lineBegin) && (*(lineEnd - 1) == '\r')) ? lineEnd - 1 : lineEnd;
+    };
+    // start of the line after the one ending at 'lineEnd'
+    auto getNextLine = [fileEnd](const char *lineEnd)
+    {
+      return (lineEnd < fileEnd) ? lineEnd + 1 : fileEnd;
+    };
 
-    size_t i = 0, j = 0;
-    while (std::getline(data, line))
+    // columns come from the first non-empty line
+    const char *firstLine = fileBegin;
+    while (firstLine < fileEnd)
     {
-      j = 0;
-      if (!columnMajor)
+      auto lineEnd = stripCarriageReturn(firstLine, getLineEnd(firstLine));
+      if (lineEnd > firstLine)
       {
-        returnVector[i].resize(cols);
+        returnMatrix.cols = std::count(firstLine, lineEnd, delimiter) + 1;
+        break;
       }
-      std::stringstream lineStream(line);
-      while (std::getline(lineStream, cell, ','))
+      firstLine = getNextLine(getLineEnd(firstLine));
+    }
+    if (returnMatrix.cols == 0)
+    {
+      return returnMatrix;
+    }
+
+    // split the file into chunks which start at the beginning of a line
+    const size_t fileSize = static_cast< size_t >(fileEnd - firstLine);
+    size_t numberOfChunks = 1;
+#ifdef _OPENMP
+    numberOfChunks = static_cast< size_t >(omp_get_max_threads());
+#endif
+    numberOfChunks = std::max< size_t >(1, std::min(numberOfChunks, fileSize / (1 << 20))); // at least 1MB per chunk
+    std::vector< const char * > chunkBegins(numberOfChunks + 1, fileEnd);
+    chunkBegins[0] = firstLine;
+    for (size_t i = 1; i < numberOfChunks; i++)
+    {
+      auto approximateBegin = std::max(firstLine + i * (fileSize / numberOfChunks), chunkBegins[i - 1]);
+      chunkBegins[i] = (approximateBegin >= fileEnd) ? fileEnd : getNextLine(getLineEnd(approximateBegin));
+    }
+
+    // first scan: number of non-empty lines in each chunk
+    std::vector< size_t > rowsInChunk(numberOfChunks + 1, 0);
+#pragma omp parallel for schedule(static, 1)
+    for (long long chunk = 0; chunk < static_cast< long long >(numberOfChunks); chunk++)
+    {
+      size_t count = 0;
+      for (auto lineBegin = chunkBegins[chunk]; lineBegin < chunkBegins[chunk + 1];)
       {
-        if (columnMajor && returnVector[j].empty())
+        auto lineEnd = getLineEnd(lineBegin);
+        if (stripCarriageReturn(lineBegin, lineEnd) > lineBegin)
         {
-          returnVector[j].resize(rows);
+          count++;
         }
+        lineBegin = getNextLine(lineEnd);
+      }
+      rowsInChunk[chunk + 1] = count;
+    }
+    std::partial_sum(rowsInChunk.begin(), rowsInChunk.end(), rowsInChunk.begin()); // now holds the first row of each chunk
 
-        auto temp = static_cast<TDataType>(std::atof(cell.c_str()));
+    returnMatrix.rows = rowsInChunk[numberOfChunks];
+    returnMatrix.data.assign(returnMatrix.rows * returnMatrix.cols, TDataType(0));
 
-        if (columnMajor)
-        {
-          returnVector[j][i] = temp;
-        }
-        else
+    // second scan: tokenize and parse each chunk directly into its place
+#pragma omp parallel for schedule(static, 1)
+    for (long long chunk = 0; chunk < static_cast< long long >(numberOfChunks); chunk++)
+    {
+      size_t row = rowsInChunk[chunk];
+      for (auto lineBegin = chunkBegins[chunk]; lineBegin < chunkBegins[chunk + 1];)
+      {
+        auto rawLineEnd = getLineEnd(lineBegin);
+        auto lineEnd = stripCarriageReturn(lineBegin, rawLineEnd);
+        if (lineEnd > lineBegin)
         {
-          returnVector[i][j] = temp;
+          auto cellBegin = lineBegin;
+          for (size_t col = 0; col < returnMatrix.cols; col++)
+          {
+            auto cellEnd = std::find(cellBegin, lineEnd, delimiter);
+            returnMatrix(row, col) = static_cast< TDataType >(parseCSVNumber(cellBegin, cellEnd));
+            if (cellEnd == lineEnd)
+            {
+              break;
+            }
+            cellBegin = cellEnd + 1;
+          }
+          row++;
         }
-        j++;
+        lineBegin = getNextLine(rawLineEnd);
       }
-      i++;
+    }
+
+    return returnMatrix;
+  }
+
+  /**
+  \brief Read a CSV file which has no header information
+
+  To read CSV file with header information, check parseCSVFile() function. This should not be used for obtaining strings.
+  For large files, readCSVDataMatrix() avoids the per-row allocations of this function.
+
+  \param csvFileName The full path of the file to parse, all paths are absolute or relative to current working directory
+  \param columnMajor If true, then return is a vector of all the columns; otherwise it is a vector of the rows
+  */
+  template< class TDataType = double >
+  std::vector< std::vector< TDataType > > readCSVDataFile(const std::string &csvFileName, bool columnMajor = false)
+  {
+    std::vector< std::vector< TDataType > > returnVector;
+    if (!cbica::isFile(csvFileName))
+    {
+      std::cerr << "Supplied file wasn't found.\n";
+      return returnVector;
+    }
+
+    // the matrix is laid out such that each returned vector is a contiguous block
+    auto matrix = readCSVDataMatrix< TDataType >(csvFileName, columnMajor);
+    const size_t outer = columnMajor ? matrix.cols : matrix.rows;
+    const size_t inner = columnMajor ? matrix.rows : matrix.cols;
+
+    returnVector.resize(outer);
+    for (size_t i = 0; i < outer; i++)
+    {
+      returnVector[i].assign(matrix.data.begin() + i * inner, matrix.data.begin() + (i + 1) * inner);
     }
 
     return returnVector;
@@ -804,6 +972,35 @@ namespace cbica
   */
   void sleep(size_t ms = std::rand() % 1000 + 1);
 
+  /**
+  \brief Get the total physical memory of the machine in bytes
+  */
+  size_t getTotalMemory();
+
+  /**
+  \brief Get the physical memory currently in use on the machine in bytes
+  */
+  size_t getCurrentlyUsedMemory();
+
+  /**
+  \brief Get the physical memory (resident set size) currently used by the calling process in bytes
+  */
+  size_t getCurrentlyUsedMemoryByCurrentProcess();
+
+  /**
+  \brief Get the peak physical memory (resident set size high-water mark) used by the calling process in bytes
+  */
+  size_t getPeakMemoryUsedByCurrentProcess();
+
+  /**
+  \brief Resets the peak physical memory of the calling process to its current usage, so that getPeakMemoryUsedByCurrentProcess() measures from this point on
+
+  Only possible on Linux (by writing '5' to /proc/self/clear_refs); the high-water mark cannot be reset on Windows or macOS.
+
+  \return True if the high-water mark was reset
+  */
+  bool resetPeakMemoryUsedByCurrentProcess();
+
   /**
   \brief Ensuring files written using Windows don't mess stuff up
 
@@ -959,6 +1156,83 @@ namespace cbica
 #endif
 
   //==================================== Statistical/Compute stuff ==================================//
+  /**
+  \brief Plain confusion matrix counts for a positive label
+
+  True Positive (TP), False Positive (FP), True Negative (TN), False Negative (FN), Real Positive (RP), Preditcted Positive (PP)
+  */
+  struct ConfusionMatrixCounts
+  {
+    size_t TP = 0, FP = 0, TN = 0, FN = 0, RP = 0, PP = 0;
+
+    //! Total number of elements that were compared
+    size_t GetTotal() const
+    {
+      return TP + FP + TN + FN;
+    }
+
+    //! Accumulate counts (from another thread, image, etc.)
+    ConfusionMatrixCounts &operator+=(const ConfusionMatrixCounts &other)
+    {
+      TP += other.TP;
+      FP += other.FP;
+      TN += other.TN;
+      FN += other.FN;
+      RP += other.RP;
+      PP += other.PP;
+      return *this;
+    }
+
+    //! The string-keyed version returned by ConfusionMatrix()
+    std::map< std::string, size_t > ToMap() const;
+  };
+
+  /**
+  \brief Calculates the confusion matrix counts directly on raw label buffers (for example, uint8 or int16 images)
+
+  An element is positive if it is equal to positiveLabel; a prediction is "true" if the real and predicted values are equal.
+  The loop is branch-free and only keeps 4 counters (RP, PP, TP and the number of equal elements), from which the rest are derived, 
+  so that it is vectorized by the compiler and reduced over threads with OpenMP.
+
+  \param realLabels Buffer of the real labels
+  \param predictedLabels Buffer of the predicted labels
+  \param size Number of elements in each buffer
+  \param positiveLabel The value considered as positive; defaults to 1
+  */
+  template< class TRealType, class TPredictedType >
+  ConfusionMatrixCounts GetConfusionMatrixCounts(const TRealType *realLabels, const TPredictedType *predictedLabels, const size_t size,
+    const double positiveLabel = 1)
+  {
+    ConfusionMatrixCounts returnCounts;
+    const TRealType positiveReal = static_cast< TRealType >(positiveLabel);
+    const TPredictedType positivePredicted = static_cast< TPredictedType >(positiveLabel);
+    const bool positiveIsRepresentable = (static_cast< double >(positiveReal) == positiveLabel),
+      positivePredictedIsRepresentable = (static_cast< double >(positivePredicted) == positiveLabel);
+
+    size_t realPositive = 0, predictedPositive = 0, truePositive = 0, equal = 0;
+    const long long numberOfElements = static_cast< long long >(size);
+
+#pragma omp parallel for reduction(+: realPositive, predictedPositive, truePositive, equal) if (numberOfElements > 65536)
+    for (long long i = 0; i < numberOfElements; i++)
+    {
+      const size_t isRealPositive = positiveIsRepresentable & (realLabels[i] == positiveReal);
+      const size_t isEqual = (static_cast< double >(realLabels[i]) == static_cast< double >(predictedLabels[i]));
+      realPositive += isRealPositive;
+      predictedPositive += positivePredictedIsRepresentable & (predictedLabels[i] == positivePredicted);
+      truePositive += isRealPositive & isEqual;
+      equal += isEqual;
+    }
+
+    returnCounts.RP = realPositive;
+    returnCounts.PP = predictedPositive;
+    returnCounts.TP = truePositive;
+    returnCounts.TN = equal - truePositive;
+    returnCounts.FN = realPositive - truePositive;
+    returnCounts.FP = size - equal - returnCounts.FN;
+
+    return returnCounts;
+  }
+
   /**
   \brief Calculates the Confusion Matrix for a set of real and predicted labels
 
@@ -989,23 +1263,482 @@ namespace cbica
   std::map< std::string, float > ROC_Values(const std::vector< float > &inputRealLabels, const std::vector< float > &inputPredictedLabels);
 
   /**
+  \brief Calculates the ROC Values from pre-computed confusion matrix counts; see ROC_Values() above for details
+
+  \param counts Counts from GetConfusionMatrixCounts()
+  */
+  std::map< std::string, float > ROC_Values(const ConfusionMatrixCounts &counts);
+
+  /**
+  \brief Receiver operating characteristic curve obtained by sweeping a threshold over continuous scores; see GetROCCurve()
+  */
+  struct ROCCurve
+  {
+    //! Points of the curve, ordered from the highest threshold [i.e., (0,0)] to the lowest [i.e., (1,1)]
+    std::vector< float > thresholds, falsePositiveRates, truePositiveRates;
+
+    //! Area under the curve (trapezoidal, which handles tied scores correctly)
+    double auc = 0;
+
+    size_t positives = 0, negatives = 0;
+  };
+
+  /**
+  \brief Calculates the ROC curve and AUC of continuous scores against real labels
+
+  Exact mode (numberOfBins = 0) sorts the (score, label) pairs once and emits a point at every distinct score; binned mode
+  accumulates positive and negative histograms over [min, max] of the scores in a single (parallel) pass, which is O(n) 
+  and only produces (numberOfBins + 1) points; the AUC error of the binned mode is bounded by the pairs that share a bin.
+  NaN scores are excluded (with a warning), since they cannot be ordered against the others.
+
+  \param realLabels Buffer of the real labels
+  \param scores Buffer of the predicted scores (higher means more likely to be positive)
+  \param size Number of elements in each buffer
+  \param numberOfBins Use the histogram-binned mode with this many bins; 0 (default) gives the exact curve
+  \param positiveLabel The value of realLabels considered as positive; defaults to 1
+  \param storeCurve Whether the points of the curve are stored or only the AUC is computed
+  */
+  ROCCurve GetROCCurve(const float *realLabels, const float *scores, const size_t size, const size_t numberOfBins = 0,
+    const float positiveLabel = 1, const bool storeCurve = true);
+
+  /**
+  \brief Calculates the ROC curve and AUC of continuous scores against real labels; see the buffer version for details
+
+  \param realLabels Vector structure containing real labels
+  \param scores Vector structure containing predicted scores
+  \param numberOfBins Use the histogram-binned mode with this many bins; 0 (default) gives the exact curve
+  */
+  ROCCurve GetROCCurve(const std::vector< float > &realLabels, const std::vector< float > &scores, const size_t numberOfBins = 0);
+
+  /**
+  \brief Calculates the area under the ROC curve of continuous (or binary) predictions using the exact threshold sweep
   
   \param inputRealLabels Vector structure containing real labels
-  \param inputPredictedLabels Vector structure containing predicted labels
+  \param inputPredictedLabels Vector structure containing predicted scores
 
   \return A float denoting the area under the curve
   */
   float area_under_curve(const std::vector< float > &inputRealLabels, const std::vector< float > &inputPredictedLabels);
 
   /**
+  \brief Calculates the area under the ROC curve defined by a single operating point, as given by ROC_Values() for hard labels
 
-  \param inputRealLabels Vector structure containing real labels
-  \param inputPredictedLabels Vector structure containing predicted labels
+  The curve is (0,0) -> (FPR,TPR) -> (1,1), so the area is (1 + TPR - FPR) / 2.
+
+  \param roc_values Output of ROC_Values()
 
   \return A float denoting the area under the curve
   */
   float area_under_curve(const std::map< std::string, float > &roc_values);
 
+  /**
+  \brief Overlap measures (as defined by itk::LabelOverlapMeasuresImageFilter) of a region from its counts
+
+  The source is the region in the real labels and the target is the region in the predicted labels, i.e., the 
+  intersection is TP, the source is RP and the target is PP. Values returned: Overlap (target overlap), Jaccard,
+  Dice, VolumeSimilarity, FalseNegativeError, FalsePositiveError. A region missing in both gives a perfect score.
+
+  \param counts Counts of the region, from GetConfusionMatrixCounts() or LabelCooccurrence; these can be summed over labels
+  */
+  std::map< std::string, double > GetOverlapMeasures(const ConfusionMatrixCounts &counts);
+
+  /**
+  \brief Joint histogram (co-occurrence table) of 2 label buffers; see GetLabelCooccurrence()
+
+  Every overlap statistic of any label or union of labels (for example, BraTS tumor core = NET + ET) can be derived
+  from this without going back to the buffers, which only needs O(labels^2) memory.
+  */
+  struct LabelCooccurrence
+  {
+    //! Sorted unique labels in the first (real) and second (predicted) buffers
+    std::vector< double > labels_1, labels_2;
+
+    //! Number of elements for every label pair, labels_1.size() x labels_2.size(), row-major
+    std::vector< size_t > counts;
+
+    //! Total number of elements that were compared
+    size_t total = 0;
+
+    //! Number of elements where the first buffer is label_1 and the second buffer is label_2
+    size_t GetCount(const double label_1, const double label_2) const;
+
+    /**
+    \brief Confusion matrix of the region made up of the specified labels (in both buffers), as if they were binary masks
+
+    \param regionLabels Labels that are considered as positive
+    */
+    ConfusionMatrixCounts GetRegionCounts(const std::vector< double > &regionLabels) const;
+
+    /**
+    \brief Same as cbica::GetConfusionMatrixCounts() on the original buffers, i.e., an element is a true negative if 
+    both buffers have the same non-positive label
+
+    \param positiveLabel The value considered as positive; defaults to 1
+    */
+    ConfusionMatrixCounts GetConfusionMatrixCounts(const double positiveLabel = 1) const;
+
+    /**
+    \brief Adds elements to a label pair (which is inserted if needed), for example, the background of a cropped region
+
+    \param label_1 Label in the first buffer
+    \param label_2 Label in the second buffer
+    \param count Number of elements to add
+    */
+    void AddCount(const double label_1, const double label_2, const size_t count);
+  };
+
+  /**
+  \brief Builds the joint label histogram of 2 label buffers in a single (parallel) pass
+
+  Label images are made up of long runs of the same label pair (mostly background), so each thread counts runs and
+  only touches its (small) table when the pair changes.
+
+  \param labels_1 Buffer of the first (real) labels
+  \param labels_2 Buffer of the second (predicted) labels
+  \param size Number of elements in each buffer
+  */
+  template< class TType_1, class TType_2 >
+  LabelCooccurrence GetLabelCooccurrence(const TType_1 *labels_1, const TType_2 *labels_2, const size_t size)
+  {
+    LabelCooccurrence returnTable;
+    returnTable.total = size;
+
+    std::map< std::pair< double, double >, size_t > pairCounts;
+    const long long numberOfElements = static_cast< long long >(size);
+
+#pragma omp parallel if (numberOfElements > 65536)
+    {
+      std::map< std::pair< double, double >, size_t > threadCounts;
+      TType_1 current_1 = TType_1();
+      TType_2 current_2 = TType_2();
+      size_t runLength = 0;
+
+#pragma omp for schedule(static)
+      for (long long i = 0; i < numberOfElements; i++)
+      {
+        if ((runLength > 0) && (labels_1[i] == current_1) && (labels_2[i] == current_2))
+        {
+          runLength++;
+        }
+        else
+        {
+          if (runLength > 0)
+          {
+            threadCounts[std::make_pair(static_cast< double >(current_1), static_cast< double >(current_2))] += runLength;
+          }
+          current_1 = labels_1[i];
+          current_2 = labels_2[i];
+          runLength = 1;
+        }
+      }
+      if (runLength > 0)
+      {
+        threadCounts[std::make_pair(static_cast< double >(current_1), static_cast< double >(current_2))] += runLength;
+      }
+
+#pragma omp critical
+      {
+        for (const auto &pair : threadCounts)
+        {
+          pairCounts[pair.first] += pair.second;
+        }
+      }
+    }
+
+    std::set< double > uniqueLabels_2;
+    for (const auto &pair : pairCounts)
+    {
+      if (returnTable.labels_1.empty() || (returnTable.labels_1.back() != pair.first.first))
+      {
+        returnTable.labels_1.push_back(pair.first.first); // the map is sorted on the first label
+      }
+      uniqueLabels_2.insert(pair.first.second);
+    }
+    returnTable.labels_2.assign(uniqueLabels_2.begin(), uniqueLabels_2.end());
+
+    returnTable.counts.assign(returnTable.labels_1.size() * returnTable.labels_2.size(), 0);
+    for (const auto &pair : pairCounts)
+    {
+      const size_t row = std::lower_bound(returnTable.labels_1.begin(), returnTable.labels_1.end(), pair.first.first) - returnTable.labels_1.begin(),
+        column = std::lower_bound(returnTable.labels_2.begin(), returnTable.labels_2.end(), pair.first.second) - returnTable.labels_2.begin();
+      returnTable.counts[row * returnTable.labels_2.size() + column] = pair.second;
+    }
+
+    return returnTable;
+  }
+
+  /**
+  \brief Counting histogram used by GetUniqueValuesAndCounts() for integer types of up to 16 bits
+  */
+  template< class TDataType >
+  std::vector< std::pair< TDataType, size_t > > GetUniqueValuesAndCounts(const TDataType *buffer, const size_t size,
+    std::true_type /*isSmallInteger*/)
+  {
+    const size_t numberOfBins = size_t(1) << (8 * sizeof(TDataType));
+    const long long minimumValue = static_cast< long long >(std::numeric_limits< TDataType >::min());
+    std::vector< size_t > histogram(numberOfBins, 0);
+    const long long numberOfElements = static_cast< long long >(size);
+
+#pragma omp parallel if (numberOfElements > 65536)
+    {
+      std::vector< size_t > threadHistogram(numberOfBins, 0);
+
+#pragma omp for schedule(static)
+      for (long long i = 0; i < numberOfElements; i++)
+      {
+        threadHistogram[static_cast< long long >(buffer[i]) - minimumValue]++;
+      }
+
+#pragma omp critical
+      {
+        for (size_t b = 0; b < numberOfBins; b++)
+        {
+          histogram[b] += threadHistogram[b];
+        }
+      }
+    }
+
+    // the histogram is already in ascending order
+    std::vector< std::pair< TDataType, size_t > > returnValues;
+    for (size_t b = 0; b < numberOfBins; b++)
+    {
+      if (histogram[b] > 0)
+      {
+        returnValues.emplace_back(static_cast< TDataType >(static_cast< long long >(b) + minimumValue), histogram[b]);
+      }
+    }
+    return returnValues;
+  }
+
+  /**
+  \brief Per-thread sorted run lists used by GetUniqueValuesAndCounts() for all other types
+
+  Each thread compresses its part of the buffer into runs of the same value (label images are mostly long runs), sorts
+  and combines them; the sorted lists of the threads are then merged. For buffers with millions of distinct values 
+  (such as probability maps), this is an order of magnitude faster than hash tables.
+  */
+  template< class TDataType >
+  std::vector< std::pair< TDataType, size_t > > GetUniqueValuesAndCounts(const TDataType *buffer, const size_t size,
+    std::false_type /*isSmallInteger*/)
+  {
+    using ValueCount = std::pair< TDataType, size_t >;
+    auto compareValues = [](const ValueCount &a, const ValueCount &b) { return a.first < b.first; };
+    // combines consecutive entries of a sorted list that have the same value
+    auto combineSorted = [](std::vector< ValueCount > &valueCounts)
+    {
+      if (valueCounts.empty())
+      {
+        return;
+      }
+      size_t last = 0;
+      for (size_t i = 1; i < valueCounts.size(); i++)
+      {
+        if (valueCounts[i].first == valueCounts[last].first)
+        {
+          valueCounts[last].second += valueCounts[i].second;
+        }
+        else
+        {
+          valueCounts[++last] = valueCounts[i];
+        }
+      }
+      valueCounts.resize(last + 1);
+    };
+
+    std::vector< ValueCount > returnValues;
+    const long long numberOfElements = static_cast< long long >(size);
+
+#pragma omp parallel if (numberOfElements > 65536)
+    {
+      std::vector< ValueCount > threadCounts;
+      TDataType currentValue = TDataType();
+      size_t runLength = 0;
+
+#pragma omp for schedule(static)
+      for (long long i = 0; i < numberOfElements; i++)
+      {
+        if ((runLength > 0) && (buffer[i] == currentValue))
+        {
+          runLength++;
+        }
+        else
+        {
+          if (runLength > 0)
+          {
+            threadCounts.emplace_back(currentValue, runLength);
+          }
+          currentValue = buffer[i];
+          runLength = 1;
+        }
+      }
+      if (runLength > 0)
+      {
+        threadCounts.emplace_back(currentValue, runLength);
+      }
+
+      std::sort(threadCounts.begin(), threadCounts.end(), compareValues);
+      combineSorted(threadCounts);
+
+#pragma omp critical
+      {
+        std::vector< ValueCount > mergedCounts;
+        mergedCounts.reserve(returnValues.size() + threadCounts.size());
+        std::merge(returnValues.begin(), returnValues.end(), threadCounts.begin(), threadCounts.end(),
+          std::back_inserter(mergedCounts), compareValues);
+        combineSorted(mergedCounts);
+        returnValues.swap(mergedCounts);
+      }
+    }
+
+    return returnValues;
+  }
+
+  /**
+  \brief Get the unique values in a buffer along with the number of times each one appears, in a single (parallel) pass
+
+  Integer types of up to 16 bits use a direct counting histogram; other types use per-thread sorted run lists that 
+  are merged at the end. Both are produced in ascending order of the values, so the result is always sorted.
+
+  \param buffer The input buffer
+  \param size Number of elements in the buffer
+  */
+  template< class TDataType >
+  std::vector< std::pair< TDataType, size_t > > GetUniqueValuesAndCounts(const TDataType *buffer, const size_t size)
+  {
+    return GetUniqueValuesAndCounts(buffer, size,
+      std::integral_constant< bool, std::is_integral< TDataType >::value && (sizeof(TDataType) <= 2) >());
+  }
+
+  /**
+  \brief Hash table relabeling used by ChangeValuesInBuffer() for floating point types and sparse integer mappings
+
+  Each thread caches the last value it looked up, which skips the hash for the long runs of label images
+  */
+  template< class TDataType >
+  void ChangeValuesInBuffer(const TDataType *input, TDataType *output, const size_t size,
+    const std::map< TDataType, TDataType > &valueMap, std::false_type /*useLookupTable*/)
+  {
+    const std::unordered_map< TDataType, TDataType > valueHash(valueMap.begin(), valueMap.end());
+    const long long numberOfElements = static_cast< long long >(size);
+
+#pragma omp parallel if (numberOfElements > 65536)
+    {
+      TDataType lastInput = TDataType(), lastOutput = TDataType();
+      bool lastValid = false;
+
+#pragma omp for schedule(static)
+      for (long long i = 0; i < numberOfElements; i++)
+      {
+        const TDataType currentValue = input[i];
+        if (!lastValid || !(currentValue == lastInput))
+        {
+          auto found = valueHash.find(currentValue);
+          lastInput = currentValue;
+          lastOutput = (found != valueHash.end()) ? found->second : currentValue;
+          lastValid = true;
+        }
+        output[i] = lastOutput;
+      }
+    }
+  }
+
+  /**
+  \brief Dense lookup table relabeling used by ChangeValuesInBuffer() for integer types
+
+  The table spans the range of the old values and holds the identity for everything that is not remapped, so each 
+  element costs one range check and one load. Mappings spanning more than 2^20 values fall back to the hash table.
+  */
+  template< class TDataType >
+  void ChangeValuesInBuffer(const TDataType *input, TDataType *output, const size_t size,
+    const std::map< TDataType, TDataType > &valueMap, std::true_type /*useLookupTable*/)
+  {
+    if (valueMap.empty())
+    {
+      if (input != output)
+      {
+        std::memcpy(output, input, size * sizeof(TDataType));
+      }
+      return;
+    }
+
+    // std::map is sorted, so the range of old values is given by its first and last keys; the span is computed in 
+    // unsigned arithmetic, since the difference of two 64-bit values can overflow a signed type
+    const TDataType minimumValue = valueMap.begin()->first, maximumValue = valueMap.rbegin()->first;
+    const unsigned long long valueSpan = static_cast< unsigned long long >(maximumValue) - static_cast< unsigned long long >(minimumValue);
+    if (valueSpan >= (1ull << 20))
+    {
+      ChangeValuesInBuffer(input, output, size, valueMap, std::false_type());
+      return;
+    }
+
+    std::vector< TDataType > lookupTable(static_cast< size_t >(valueSpan) + 1);
+    for (size_t t = 0; t < lookupTable.size(); t++)
+    {
+      lookupTable[t] = static_cast< TDataType >(static_cast< unsigned long long >(minimumValue) + t);
+    }
+    for (auto &value : valueMap)
+    {
+      lookupTable[static_cast< size_t >(static_cast< unsigned long long >(value.first) - static_cast< unsigned long long >(minimumValue))] = value.second;
+    }
+
+    const long long numberOfElements = static_cast< long long >(size);
+#pragma omp parallel for if (numberOfElements > 65536)
+    for (long long i = 0; i < numberOfElements; i++)
+    {
+      const TDataType currentValue = input[i];
+      output[i] = ((currentValue >= minimumValue) && (currentValue <= maximumValue)) ?
+        lookupTable[static_cast< size_t >(static_cast< unsigned long long >(currentValue) - static_cast< unsigned long long >(minimumValue))] : currentValue;
+    }
+  }
+
+  /**
+  \brief Replace values in a buffer according to a mapping of old to new values, in a single (parallel) pass
+
+  All replacements are done simultaneously against the original values, so mappings like {1->2, 2->1} swap labels.
+  Old values that are not representable in TDataType (for example, 1.5 for an integer buffer) are ignored and if an 
+  old value is given more than once, its first mapping is used. Integer types use a dense lookup table and floating 
+  point types use a hash table.
+
+  \param input The input buffer
+  \param output The output buffer, which can be the same as input for in-place relabeling
+  \param size Number of elements in the buffers
+  \param oldValues The values to replace
+  \param newValues The values to replace them with; needs to be the same size as oldValues
+  \return False if oldValues and newValues have different sizes
+  */
+  template< class TDataType >
+  bool ChangeValuesInBuffer(const TDataType *input, TDataType *output, const size_t size,
+    const std::vector< double > &oldValues, const std::vector< double > &newValues)
+  {
+    if (oldValues.size() != newValues.size())
+    {
+      std::cerr << "Change values needs the same number of inputs for old and new values.\n";
+      return false;
+    }
+
+    // the maximum of a 64-bit type rounds up to a power of 2 as a double, so the upper bound is exclusive and exact: 
+    // -lowest for signed types and 2^digits for unsigned ones
+    const double upperBound = std::is_signed< TDataType >::value ?
+      -static_cast< double >(std::numeric_limits< TDataType >::lowest()) : std::ldexp(1.0, std::numeric_limits< TDataType >::digits);
+
+    std::map< TDataType, TDataType > valueMap;
+    for (size_t v = 0; v < oldValues.size(); v++)
+    {
+      const bool isRepresentable = !std::is_integral< TDataType >::value ||
+        ((oldValues[v] == std::floor(oldValues[v])) &&
+        (oldValues[v] >= static_cast< double >(std::numeric_limits< TDataType >::lowest())) &&
+        (oldValues[v] < upperBound));
+      if (isRepresentable)
+      {
+        // emplace keeps the first mapping of an old value
+        valueMap.emplace(static_cast< TDataType >(oldValues[v]), static_cast< TDataType >(newValues[v]));
+      }
+    }
+
+    ChangeValuesInBuffer(input, output, size, valueMap, std::integral_constant< bool, std::is_integral< TDataType >::value >());
+    return true;
+  }
+
   /**
   \brief A good random number generator using c++11 that gives a random value within a range
 
@@ -52,6 +52,7 @@ public:
   typedef typename TFixedImage::PointType FixedImagePointType;
   typedef typename TFixedImage::SizeType FixedImageSizeType;
   typedef typename TFixedImage::SpacingType FixedImageSpacingType;
+  typedef itk::Image<float, TFixedImage::ImageDimension> DistanceMapType;
 
   void SetPercentile(double p);
 
@@ -70,6 +71,12 @@ public:
   void BlurringOn() { m_DoBlurring = true; }
   void BlurringOff() { m_DoBlurring = false; }
 
+  // Fast mode: surface voxels are found directly on the buffers (inside the bounding box of the mask), the distance
+  // map is looked up at grid points instead of a cubic B-spline, the percentile is selected with nth_element and both
+  // directed distances are computed concurrently. Identical to the default mode when both images share the same grid.
+  void FastModeOn() { m_FastMode = true; }
+  void FastModeOff() { m_FastMode = false; }
+
 protected:
 
   HausdorffDistanceImageToImageMetric();
@@ -77,10 +84,20 @@ protected:
 
   double ComputeMaxDistance(const FixedImageType*, const MovingImageType*) const;
 
+  typename DistanceMapType::Pointer ComputeDistanceMap(const FixedImageType*, const MovingImageType*) const;
+
+  double ComputeMaxDistanceFast(const FixedImageType*, const FixedImageIndexType&, const FixedImageIndexType&,
+    const MovingImageType*) const;
+
+  // Bounding box (in buffer indeces) of the non-zero voxels; returns false for an empty image
+  bool GetBoundingBox(const FixedImageType*, FixedImageIndexType&, FixedImageIndexType&) const;
+
 private:
 
   bool m_DoBlurring;
 
+  bool m_FastMode;
+
   double m_Percentile;
 
 };
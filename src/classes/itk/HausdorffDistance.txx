@@ -31,6 +31,8 @@ HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>
 {
   m_DoBlurring = false;
 
+  m_FastMode = false;
+
   m_Percentile = 0.95;
 }
 
@@ -53,12 +55,12 @@ HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>
 }
 
 template <class TFixedImage, class TMovingImage>
-double
+typename HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>::DistanceMapType::Pointer
 HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>
-::ComputeMaxDistance(
+::ComputeDistanceMap(
   const TFixedImage* img1, const TMovingImage* img2) const
 {
-  typedef itk::Image<float, FixedImageType::ImageDimension> FloatImageType;
+  typedef DistanceMapType FloatImageType;
 
   typedef itk::SignedMaurerDistanceMapImageFilter<
     FixedImageType, FloatImageType> DistanceMapFilterType;
@@ -101,6 +103,19 @@ HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>
     }
   }
 
+  return distMap2;
+}
+
+template <class TFixedImage, class TMovingImage>
+double
+HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>
+::ComputeMaxDistance(
+  const TFixedImage* img1, const TMovingImage* img2) const
+{
+  typedef DistanceMapType FloatImageType;
+
+  typename FloatImageType::Pointer distMap2 = this->ComputeDistanceMap(img1, img2);
+
   //typedef itk::LinearInterpolateImageFunction<FloatImageType, double>
   typedef itk::BSplineInterpolateImageFunction<FloatImageType, double>
     InterpolatorType;
@@ -156,6 +171,212 @@ HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>
   return distances[(int)(m_Percentile*(distances.size() - 1))];
 }
 
+template <class TFixedImage, class TMovingImage>
+bool
+HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>
+::GetBoundingBox(
+  const TFixedImage* img, FixedImageIndexType& minIndex, FixedImageIndexType& maxIndex) const
+{
+  const unsigned int dimension = FixedImageType::ImageDimension;
+  const FixedImageSizeType size = img->GetBufferedRegion().GetSize();
+  const FixedImagePixelType* buffer = img->GetBufferPointer();
+
+  const long long lineLength = size[0];
+  const long long numberOfLines = static_cast<long long>(img->GetBufferedRegion().GetNumberOfPixels()) / lineLength;
+
+  for (unsigned int dim = 0; dim < dimension; dim++)
+  {
+    minIndex[dim] = size[dim];
+    maxIndex[dim] = -1;
+  }
+
+  // the image is scanned line by line, so that the index is only computed once per line
+#pragma omp parallel
+  {
+    FixedImageIndexType threadMin = minIndex, threadMax = maxIndex;
+
+#pragma omp for schedule(static)
+    for (long long line = 0; line < numberOfLines; line++)
+    {
+      const FixedImagePixelType* lineBuffer = buffer + line * lineLength;
+      long long first = 0, last = lineLength - 1;
+      while ((first < lineLength) && (lineBuffer[first] == 0))
+        first++;
+      if (first == lineLength)
+        continue;
+      while (lineBuffer[last] == 0)
+        last--;
+
+      threadMin[0] = std::min<long long>(threadMin[0], first);
+      threadMax[0] = std::max<long long>(threadMax[0], last);
+      long long remainder = line;
+      for (unsigned int dim = 1; dim < dimension; dim++)
+      {
+        const long long index = remainder % size[dim];
+        remainder /= size[dim];
+        threadMin[dim] = std::min<long long>(threadMin[dim], index);
+        threadMax[dim] = std::max<long long>(threadMax[dim], index);
+      }
+    }
+
+#pragma omp critical
+    {
+      for (unsigned int dim = 0; dim < dimension; dim++)
+      {
+        minIndex[dim] = std::min(minIndex[dim], threadMin[dim]);
+        maxIndex[dim] = std::max(maxIndex[dim], threadMax[dim]);
+      }
+    }
+  }
+
+  return (maxIndex[0] >= 0);
+}
+
+template <class TFixedImage, class TMovingImage>
+double
+HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>
+::ComputeMaxDistanceFast(
+  const TFixedImage* img1, const FixedImageIndexType& minIndex1, const FixedImageIndexType& maxIndex1,
+  const TMovingImage* img2) const
+{
+  const unsigned int dimension = FixedImageType::ImageDimension;
+
+  typename DistanceMapType::Pointer distMap2 = this->ComputeDistanceMap(img1, img2);
+
+  const FixedImageSizeType size = img1->GetBufferedRegion().GetSize();
+  const FixedImageIndexType bufferStart = img1->GetBufferedRegion().GetIndex();
+  const FixedImagePixelType* buffer = img1->GetBufferPointer();
+  const float* distBuffer = distMap2->GetBufferPointer();
+
+  // when both are on the same grid, the distance map is read at the same offset; otherwise the nearest grid point is used
+  const bool sameGrid = (distMap2->GetBufferedRegion() == img1->GetBufferedRegion()) &&
+    (distMap2->GetOrigin() == img1->GetOrigin()) && (distMap2->GetSpacing() == img1->GetSpacing()) &&
+    (distMap2->GetDirection() == img1->GetDirection());
+
+  // offsets of the neighborhood used for the boundary, i.e., the radius 1 ball (18-connected in 3D)
+  std::vector< std::vector<int> > neighborSteps;
+  std::vector<long long> neighborOffsets;
+  {
+    std::vector<int> step(dimension, -1);
+    bool done = false;
+    while (!done)
+    {
+      int nonZero = 0;
+      for (unsigned int dim = 0; dim < dimension; dim++)
+        nonZero += (step[dim] != 0);
+      if ((nonZero > 0) && (nonZero <= 2))
+      {
+        long long offset = 0, stride = 1;
+        for (unsigned int dim = 0; dim < dimension; dim++)
+        {
+          offset += step[dim] * stride;
+          stride *= size[dim];
+        }
+        neighborSteps.push_back(step);
+        neighborOffsets.push_back(offset);
+      }
+      done = true;
+      for (unsigned int dim = 0; dim < dimension; dim++)
+      {
+        if (++step[dim] <= 1)
+        {
+          done = false;
+          break;
+        }
+        step[dim] = -1;
+      }
+    }
+  }
+
+  // strides of the buffer and number of lines (along the first axis) inside the bounding box
+  std::vector<long long> strides(dimension, 1);
+  long long numberOfLines = 1;
+  for (unsigned int dim = 1; dim < dimension; dim++)
+  {
+    strides[dim] = strides[dim - 1] * size[dim - 1];
+    numberOfLines *= (maxIndex1[dim] - minIndex1[dim] + 1);
+  }
+
+  std::vector<double> distances;
+
+#pragma omp parallel
+  {
+    std::vector<double> threadDistances;
+    std::vector<long long> index(dimension);
+
+#pragma omp for schedule(static)
+    for (long long line = 0; line < numberOfLines; line++)
+    {
+      long long remainder = line, lineOffset = 0;
+      for (unsigned int dim = 1; dim < dimension; dim++)
+      {
+        const long long extent = maxIndex1[dim] - minIndex1[dim] + 1;
+        index[dim] = minIndex1[dim] + remainder % extent;
+        remainder /= extent;
+        lineOffset += index[dim] * strides[dim];
+      }
+
+      for (long long x = minIndex1[0]; x <= maxIndex1[0]; x++)
+      {
+        const long long offset = lineOffset + x;
+        const FixedImagePixelType value = buffer[offset];
+        if (value == 0)
+          continue;
+        index[0] = x;
+
+        // boundary voxel: at least one neighbor (inside the image) has a different value
+        bool isBoundary = false;
+        for (size_t n = 0; (n < neighborOffsets.size()) && !isBoundary; n++)
+        {
+          bool isInside = true;
+          for (unsigned int dim = 0; dim < dimension; dim++)
+          {
+            const long long neighborIndex = index[dim] + neighborSteps[n][dim];
+            isInside &= ((neighborIndex >= 0) && (neighborIndex < static_cast<long long>(size[dim])));
+          }
+          isBoundary = isInside && (buffer[offset + neighborOffsets[n]] != value);
+        }
+        if (!isBoundary)
+          continue;
+
+        if (sameGrid)
+        {
+          threadDistances.push_back(vnl_math_abs(distBuffer[offset]));
+        }
+        else
+        {
+          FixedImageIndexType ind;
+          for (unsigned int dim = 0; dim < dimension; dim++)
+            ind[dim] = bufferStart[dim] + index[dim];
+
+          FixedImagePointType p;
+          img1->TransformIndexToPhysicalPoint(ind, p);
+
+          typename DistanceMapType::IndexType distIndex;
+          if (!distMap2->TransformPhysicalPointToIndex(p, distIndex) || !distMap2->GetBufferedRegion().IsInside(distIndex))
+            continue;
+
+          threadDistances.push_back(vnl_math_abs(distMap2->GetPixel(distIndex)));
+        }
+      }
+    }
+
+#pragma omp critical
+    {
+      distances.insert(distances.end(), threadDistances.begin(), threadDistances.end());
+    }
+  }
+
+  if (distances.size() == 0)
+    return vnl_huge_val(1.0);
+
+  // only the requested percentile needs to be in place
+  const size_t percentileIndex = (size_t)(m_Percentile*(distances.size() - 1));
+  std::nth_element(distances.begin(), distances.begin() + percentileIndex, distances.end());
+
+  return distances[percentileIndex];
+}
+
 template <class TFixedImage, class TMovingImage>
 typename HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>::MeasureType
 HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>
@@ -164,6 +385,35 @@ HausdorffDistanceImageToImageMetric<TFixedImage, TMovingImage>
   if (Superclass::m_FixedImage.IsNull() || Superclass::m_MovingImage.IsNull())
     itkExceptionMacro(<< "Need two input classification images");
 
+  if (m_FastMode)
+  {
+    // empty masks are found from the bounding boxes, which also limit the search for the boundary voxels
+    FixedImageIndexType minFixed, maxFixed, minMoving, maxMoving;
+    const bool hasFixed = this->GetBoundingBox(Superclass::m_FixedImage, minFixed, maxFixed);
+    const bool hasMoving = this->GetBoundingBox(Superclass::m_MovingImage, minMoving, maxMoving);
+
+    if (!hasFixed || !hasMoving)
+    {
+      if (hasFixed == hasMoving)
+        return 0.0;
+      else
+        return vnl_huge_val(1.0);
+    }
+
+    double d12 = 0, d21 = 0;
+#pragma omp parallel sections num_threads(2)
+    {
+#pragma omp section
+      d12 = this->ComputeMaxDistanceFast(
+        Superclass::m_FixedImage, minFixed, maxFixed, Superclass::m_MovingImage);
+#pragma omp section
+      d21 = this->ComputeMaxDistanceFast(
+        Superclass::m_MovingImage, minMoving, maxMoving, Superclass::m_FixedImage);
+    }
+
+    return std::max(d12, d21);
+  }
+
   // Handle special case where inputs are zeros
   typedef itk::ImageRegionConstIteratorWithIndex<FixedImageType>
     FixedIteratorType;
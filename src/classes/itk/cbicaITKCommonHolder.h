@@ -17,6 +17,8 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
 #include <iostream>
 #include <string>
 #include <vector>
+#include <future>
+#include <functional>
 
 #include "itkImageIOBase.h"
 #include "itkImageIOFactory.h"
@@ -179,6 +181,49 @@ namespace cbica
                                  const std::string &output, 
                                  const std::string &prefix);
 
+    /**
+    \brief Reads NIfTI images in order and passes each one to a callback, reading the next one on a background thread
+
+    Only the image being processed and the one being read are held here, regardless of the number of files.
+
+    \param inputFiles The files to read
+    \param processImage Called with the index and the image of every file, in order; returning false stops the stream
+    \return False if processImage stopped the stream
+    */
+    template< class TImageType >
+    static bool streamImagesWithPrefetch( const std::vector<std::string> &inputFiles, 
+                                          const std::function< bool( size_t, typename TImageType::Pointer ) > &processImage )
+    {
+      auto readImage = []( const std::string &fileName )
+      {
+        typename itk::ImageFileReader< TImageType >::Pointer reader = itk::ImageFileReader< TImageType >::New();
+        reader->SetImageIO( itk::NiftiImageIO::New() );
+        reader->SetFileName( fileName );
+        reader->Update();
+        typename TImageType::Pointer image = reader->GetOutput();
+        return image;
+      };
+
+      if( inputFiles.empty() )
+      {
+        return true;
+      }
+      auto nextImage = std::async( std::launch::async, readImage, inputFiles[0] );
+      for( size_t i = 0; i < inputFiles.size(); i++ )
+      {
+        auto currentImage = nextImage.get();
+        if( i + 1 < inputFiles.size() )
+        {
+          nextImage = std::async( std::launch::async, readImage, inputFiles[i + 1] );
+        }
+        if( !processImage( i, currentImage ) )
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+
   };
 
 }
\ No newline at end of file
@@ -119,38 +119,72 @@ namespace cbica
     
     /**
     \brief Main mean algorithm
+
+    The subjects are streamed: each one is added to a double precision running sum while the next one is read on a 
+    background thread, so only the first subject (which holds the output), the current and the next one are in memory, 
+    regardless of the number of subjects.
     */
     template< typename PixelType, unsigned int Dimension >
     inline void computeMeanRunner( std::vector<std::string> &inpFiles, std::string &outputBase )
     {
       typedef typename itk::Image< PixelType,  Dimension >   InputImageType;
-      typedef typename itk::ImageFileReader< InputImageType  >  ReaderType;
-      typedef typename ReaderType::Pointer  ReaderPointerType;
       typedef typename itk::ImageFileWriter< InputImageType  >  WriterType;
-      typedef typename itk::NaryMeanImageFilter< InputImageType, InputImageType > FilterType;
-      typename FilterType::Pointer meanFilter = FilterType::New();
-    
-      // Lets hold on to all the readers
-      typename std::vector< ReaderPointerType > readers;
-      for( unsigned int i=0; i<inpFiles.size(); i++ )
+
+      if( inpFiles.empty() )
       {
-        typename ReaderType::Pointer reader = ReaderType::New();
-        itk::NiftiImageIO::Pointer imageIOr = itk::NiftiImageIO::New();
-        reader->SetFileName( inpFiles[i] );
-    
-        readers.push_back(reader);
-    
-        reader->SetImageIO( imageIOr );
-        meanFilter->SetInput(i,reader->GetOutput());
+        std::cerr << "No input images were provided.\n";
+        return;
       }
-    
+
+      // the first subject holds the geometry and, at the end, the mean
+      typename InputImageType::Pointer outputImage;
+      std::vector< double > runningSum;
+      const bool allAdded = streamImagesWithPrefetch< InputImageType >( inpFiles, 
+        [&]( size_t i, typename InputImageType::Pointer currentImage )
+      {
+        if( i == 0 )
+        {
+          outputImage = currentImage;
+          runningSum.assign( outputImage->GetBufferedRegion().GetNumberOfPixels(), 0 );
+        }
+        else if( currentImage->GetBufferedRegion().GetSize() != outputImage->GetBufferedRegion().GetSize() )
+        {
+          std::cerr << "Size of '" << inpFiles[i] << "' does not match that of '" << inpFiles[0] << "'.\n";
+          return false;
+        }
+
+        const PixelType *currentBuffer = currentImage->GetBufferPointer();
+        const long long numberOfPixels = static_cast< long long >( runningSum.size() );
+#pragma omp parallel for if (numberOfPixels > 65536)
+        for( long long j = 0; j < numberOfPixels; j++ )
+        {
+          runningSum[j] += static_cast< double >( currentBuffer[j] );
+        }
+        return true;
+      } );
+      if( !allAdded )
+      {
+        return;
+      }
+
+      // same conversion as itk::Functor::Mean
+      PixelType *outputBuffer = outputImage->GetBufferPointer();
+      const long long numberOfPixels = static_cast< long long >( runningSum.size() );
+      const double numberOfSubjects = static_cast< double >( inpFiles.size() );
+#pragma omp parallel for if (numberOfPixels > 65536)
+      for( long long j = 0; j < numberOfPixels; j++ )
+      {
+        outputBuffer[j] = static_cast< PixelType >( runningSum[j] / numberOfSubjects );
+      }
+      outputImage->Modified();
+
       // Write out the result
       typename WriterType::Pointer writer = WriterType::New();
       itk::NiftiImageIO::Pointer imageIOw = itk::NiftiImageIO::New();
       writer->SetImageIO( imageIOw );
       writer->SetFileName( outputBase );
     
-      writer->SetInput( meanFilter->GetOutput() );
+      writer->SetInput( outputImage );
     
       writer->Update();
     
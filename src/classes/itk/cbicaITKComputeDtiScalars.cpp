@@ -16,6 +16,7 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
 #include "cbicaITKComputeDtiScalars.h"
 
 #include "cbicaUtilities.h"
+#include "cbicaTensorScalars.h"
 #include "cbicaITKImageInfo.h"
 
 namespace cbica
@@ -157,7 +158,6 @@ namespace cbica
     typedef itk::VectorImage< ScalarPixelType,ImageDimension > VectorImageType;
     typedef itk::Image< TensorPixelType,ImageDimension > TensorImageType;
     typedef itk::ImageFileReader< TensorImageType > ReaderType;
-    typedef itk::ImageRegionConstIteratorWithIndex < TensorImageType > ConstIterType;
     
     typename ReaderType::Pointer reader = ReaderType::New();
     reader->SetFileName(dataFile);
@@ -260,171 +260,40 @@ namespace cbica
         allocateScalarIm<ScalarImageType,TensorImageType>(k3Im,tensorIm);
       }
       
-      //Loop though all the voxels and if compute the needed measures!
-      ConstIterType iter( tensorIm, tensorIm->GetLargestPossibleRegion() );
-      for ( iter.GoToBegin(); !iter.IsAtEnd(); ++iter)
+      //Compute the needed measures, all from one closed-form eigen-analysis per voxel; the outputs share the buffered
+      //region of the tensors, so they are indexed like the tensor buffer
+      auto bufferOf = [](typename ScalarImageType::Pointer &image, bool isWritten)
       {
-        TensorPixelType tmp = iter.Get();
-        typename TensorPixelType::EigenValuesArrayType     lambda;
-        typename TensorPixelType::EigenVectorsMatrixType   vMat;
-        tmp.ComputeEigenAnalysis(lambda, vMat);
-        
-        typename ScalarImageType::IndexType index = iter.GetIndex();
-        
-        if (writeTR)
-          trIm->SetPixel(index, lambda[0]+lambda[1]+lambda[2] );
-          
-        if (writeFA)
-        {
-          faIm->SetPixel(index, tmp.GetFractionalAnisotropy());
-        }
-        
-        if (writeEign)
-        {
-          l1Im->SetPixel(index,lambda[2]);
-          l2Im->SetPixel(index,lambda[1]);
-          l3Im->SetPixel(index,lambda[0]);
-    
-          typename VectorImageType::PixelType vec1(3);
-          typename VectorImageType::PixelType vec2(3);
-          typename VectorImageType::PixelType vec3(3);
-    
-          vec1[0] = vMat[2][0];
-          vec1[1] = vMat[2][1];
-          vec1[2] = vMat[2][2];
-          
-          vec2[0] = vMat[1][0];
-          vec2[1] = vMat[1][1];
-          vec2[2] = vMat[1][2];
-          
-          vec3[0] = vMat[0][0];
-          vec3[1] = vMat[0][1];
-          vec3[2] = vMat[0][2];
-    
-          v1Im->SetPixel(index,vec1);
-          v2Im->SetPixel(index,vec2);
-          v3Im->SetPixel(index,vec3);
-          
-        }
-    		
-    		if (writeSkew)
-    		{
-    			ScalarPixelType m1,m3,l1,l2,l3;
-    			l1 = abs(lambda[0]);
-    			l2 = abs(lambda[1]);
-    			l3 = abs(lambda[2]);
-    			m1 = (l1 + l2 + l3) / 3.0;
-    			
-    			if (m1 > 0)
-    			{
-    				m3 = ( vcl_pow(l1-m1,3) + vcl_pow(l2-m1,3) + vcl_pow(l3-m1,3) ) / ( vcl_pow(l1,3) + vcl_pow(l2,3) + vcl_pow(l3,3) );
-    				if (m3 > 0)
-    				{
-    					skIm->SetPixel(index,vcl_pow(m3,static_cast<ScalarPixelType>(1.0/3.0)));
-    				}
-    				else
-    				{
-    					skIm->SetPixel(index,-1*vcl_pow((-1*m3),static_cast<ScalarPixelType>(1.0/3.0)));
-    				}
-    			}
-    			else
-    			{
-    				skIm->SetPixel(index,static_cast<ScalarPixelType>(0));
-    			}
-    		}
-    		
-    		if (writeKurt)
-    		{
-    			ScalarPixelType m1,m4,l1,l2,l3;
-    			l1 = abs(lambda[0]);
-    			l2 = abs(lambda[1]);
-    			l3 = abs(lambda[2]);
-    			m1 = (l1 + l2 + l3) / 3.0;
-    			if (m1 > 0)
-    			{
-    				m4 = (  vcl_pow(l1-m1,4) + vcl_pow(l2-m1,4) + vcl_pow(l3-m1,4) ) / ( vcl_pow(l1,4) + vcl_pow(l2,4) + vcl_pow(l3,4) );
-    				kuIm->SetPixel(index,vcl_pow(m4,static_cast<ScalarPixelType>(1.0/4.0)));
-    			}
-    			else
-    			{
-    			  kuIm->SetPixel(index,static_cast<ScalarPixelType>(0));
-    			}
-    		}
-    
-        if (writeGeo)
-        {
-          //These seem kinda arbitrary to me?
-          //ScalarPixelType tr = lambda[0]+lambda[1]+lambda[2];
-          //if (tr > 0 )
-          if (lambda[2] > 0 )
-          {
-            //backwards
-            //clIm->SetPixel(index,     (lambda[0]-lambda[1]) / tr);
-            //cpIm->SetPixel(index, 2 * (lambda[1]-lambda[2]) / tr);
-            //csIm->SetPixel(index, 3 * lambda[2] / tr);
-            clIm->SetPixel(index, (lambda[2]-lambda[1]) / lambda[2]);
-            cpIm->SetPixel(index, (lambda[1]-lambda[0]) / lambda[2]);
-            csIm->SetPixel(index,  lambda[0] / lambda[2]);
-          }
-          else
-          {
-            clIm->SetPixel(index, 0);
-            cpIm->SetPixel(index, 0);
-            csIm->SetPixel(index, 0);
-          }
-        }
-        
-        if (writeRadAx)
-        {
-          rdIm->SetPixel(index, (lambda[1]+lambda[0]) / 2);
-          adIm->SetPixel(index, lambda[2]);
-        }
-        
-        if (writeGordR)
-        {
-          //Compute the moments...
-          ScalarPixelType m1, m2, m3;
-          ScalarPixelType r1, r2, r3;
-          m1 = (lambda[0] + lambda[1] + lambda[2] ) / 3.0;
-          m2 = (  vcl_pow(lambda[0]-m1,2) + vcl_pow(lambda[1]-m1,2)
-                + vcl_pow(lambda[2]-m1,2) ) / 3.0;
-          m3 = (  vcl_pow(lambda[0]-m1,3) + vcl_pow(lambda[1]-m1,3)
-                + vcl_pow(lambda[2]-m1,3) ) / 3.0;
-          
-          r1 = sqrt(3 * (vcl_pow(m1,2) + m2) );
-          r2 = sqrt( 3 * m2 / 2 / (vcl_pow(m1,2)+m2) );
-            r3 = sqrt(2) * m3 / vcl_pow(static_cast<double>(m2), static_cast<double>(1.5));
-          r3 = (lambda[0] * lambda[1] * lambda[2]) / vcl_pow(static_cast<double>(sqrt( 3 * m2 )), 3);
-    
-          r1Im->SetPixel(index, r1);
-          r2Im->SetPixel(index, r2);
-          r3Im->SetPixel(index, r3);
-        }
-    
-        if (writeGordK)
-        {
-          //Compute the moments...
-          ScalarPixelType m1, m2, m3;
-          ScalarPixelType k1, k2, k3;
-          
-          m1 = (lambda[0] + lambda[1] + lambda[2] ) / 3.0;
-          m2 = (  vcl_pow(lambda[0]-m1,2) + vcl_pow(lambda[1]-m1,2)
-                + vcl_pow(lambda[2]-m1,2) ) / 3.0;
-          m3 = (  vcl_pow(lambda[0]-m1,3) + vcl_pow(lambda[1]-m1,3)
-                + vcl_pow(lambda[2]-m1,3) ) / 3.0;
-          
-          k1 = 3 * m1;
-          k2 = sqrt( 3 * m2 );
-            k3 = sqrt(2) * m3 / vcl_pow(static_cast<double>(m2), static_cast<double>(1.5));
-    			k3 = (lambda[0] * lambda[1] * lambda[2]) / vcl_pow(static_cast<double>(sqrt( 3 * m2 )), 3);
-    			
-    
-          k1Im->SetPixel(index, k1);
-          k2Im->SetPixel(index, k2);
-          k3Im->SetPixel(index, k3);
-        }
+        return isWritten ? image->GetBufferPointer() : static_cast< ScalarPixelType * >(nullptr);
+      };
+      cbica::TensorScalarBuffers< ScalarPixelType, ScalarPixelType > scalarBuffers;
+      scalarBuffers.FA = bufferOf(faIm, writeFA);
+      scalarBuffers.TR = bufferOf(trIm, writeTR);
+      scalarBuffers.Skewness = bufferOf(skIm, writeSkew);
+      scalarBuffers.Kurtosis = bufferOf(kuIm, writeKurt);
+      scalarBuffers.CL = bufferOf(clIm, writeGeo);
+      scalarBuffers.CP = bufferOf(cpIm, writeGeo);
+      scalarBuffers.CS = bufferOf(csIm, writeGeo);
+      scalarBuffers.RD = bufferOf(rdIm, writeRadAx);
+      scalarBuffers.AD = bufferOf(adIm, writeRadAx);
+      scalarBuffers.R1 = bufferOf(r1Im, writeGordR);
+      scalarBuffers.R2 = bufferOf(r2Im, writeGordR);
+      scalarBuffers.R3 = bufferOf(r3Im, writeGordR);
+      scalarBuffers.K1 = bufferOf(k1Im, writeGordK);
+      scalarBuffers.K2 = bufferOf(k2Im, writeGordK);
+      scalarBuffers.K3 = bufferOf(k3Im, writeGordK);
+      if (writeEign)
+      {
+        // L1/V1 is the largest eigen-pair
+        scalarBuffers.eigenValues[0] = l1Im->GetBufferPointer();
+        scalarBuffers.eigenValues[1] = l2Im->GetBufferPointer();
+        scalarBuffers.eigenValues[2] = l3Im->GetBufferPointer();
+        scalarBuffers.eigenVectors[0] = v1Im->GetBufferPointer();
+        scalarBuffers.eigenVectors[1] = v2Im->GetBufferPointer();
+        scalarBuffers.eigenVectors[2] = v3Im->GetBufferPointer();
       }
-      
+      cbica::ComputeTensorScalarMaps(tensorIm->GetBufferPointer(), tensorIm->GetBufferedRegion().GetNumberOfPixels(), scalarBuffers);
+
       //Done Computation
       if (verbose)
         std::cout << "Done Computing Scalars.\n";
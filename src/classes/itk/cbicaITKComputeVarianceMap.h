@@ -115,37 +115,38 @@ namespace cbica
     bool m_verbose;
 
     /**
-    \brief Function to call the Variance filter
+    \brief Computes the variance by streaming the subjects through a StreamingVarianceImageAccumulator
+
+    The next subject is read on a background thread while the current one is accumulated, so only 2 input volumes 
+    and the per-voxel running moments are in memory, regardless of the number of subjects.
     */
     template <typename PixelType,unsigned int Dimension>
     void computeVarianceRunner( std::vector<std::string> inpFiles, std::string outputFile )
     {    
-      /*bool isScalar;
-      if ( m_pixelType == itk::ImageIOBase::SCALAR )
-        isScalar = true;
-      else
-        isScalar = false;*/
-    
       // typedefs
       typedef typename itk::Image< PixelType,  Dimension >   InputImageType;
-      typedef typename itk::ImageFileReader< InputImageType  >  ReaderType;
-      typedef typename ReaderType::Pointer  ReaderPointerType;
       typedef typename itk::ImageFileWriter< InputImageType  >  WriterType;
-      typedef typename itk::NaryVarianceImageFilter< InputImageType, InputImageType > FilterType;
-      typename FilterType::Pointer varianceFilter = FilterType::New();
-      
-      // Lets hold on to all the readers?
-      typename std::vector< ReaderPointerType > readers;
-      for (size_t i=0; i<inpFiles.size() ;i++)
+
+      if ( inpFiles.empty() )
       {
-        typename ReaderType::Pointer reader = ReaderType::New();
-        itk::NiftiImageIO::Pointer imageIOr = itk::NiftiImageIO::New();
-        reader->SetFileName( inpFiles[i] );
-    
-        readers.push_back(reader);
-        
-        reader->SetImageIO( imageIOr );
-        varianceFilter->SetInput(i,reader->GetOutput());
+        std::cerr << "No input images were provided.\n";
+        return;
+      }
+
+      itk::StreamingVarianceImageAccumulator< InputImageType, InputImageType > accumulator;
+      const bool allAdded = streamImagesWithPrefetch< InputImageType >( inpFiles, 
+        [&]( size_t i, typename InputImageType::Pointer currentImage )
+      {
+        if ( !accumulator.AddImage( currentImage ) )
+        {
+          std::cerr << "Could not add '" << inpFiles[i] << "' to the variance map.\n";
+          return false;
+        }
+        return true;
+      } );
+      if ( !allAdded )
+      {
+        return;
       }
     
       // Write out the result
@@ -153,7 +154,7 @@ namespace cbica
       itk::NiftiImageIO::Pointer imageIOw = itk::NiftiImageIO::New();
       writer->SetImageIO( imageIOw );
       writer->SetFileName( outputFile );       
-      writer->SetInput( varianceFilter->GetOutput() );      
+      writer->SetInput( accumulator.GetVarianceImage() );      
       writer->Update();  
       
     }
@@ -16,6 +16,9 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
 
 #include <algorithm>
 #include <functional>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -37,75 +40,102 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
 namespace cbica
 {
   /**
-  \brief Vectorizes a set of images
+  \brief Vectorizes a set of images using compact masks, i.e., the linear buffer offsets of the mask voxels
+
+  The output is allocated once and every (subject, modality) pair is gathered directly from its buffer in parallel. The 
+  flags are in the same order as the overload which takes mask images.
 
   \param inputSubjectsAndImages The subjects and images which are to be vectorized
-  \param maskImages The masks to be used for the input images
+  \param maskOffsets The mask offsets to be used for the input images (from cbica::GetMaskOffsets() or cbica::CreateMaskOffsets())
   \param columnMajor If true, image intensities are converted to column vectors; otherwise they are converted to row vectors; and then they are concatinated
   \param appendInputImagesFromSubjects If true, concatenate all image voxels together in a single column/row
   \param maskDefinedPerSubject If true, the mask is defined on a per-subject basis instead of per-modality
-  \return An OpenCV Mat: size is [inputSubjectsAndImages[i][j]->GetLargestPossibleRegion().GetSize(), inputSubjectsAndImages[j].size()] if columnMajor is true; transpose otherwise
+  \return An OpenCV Mat of floats: every row is a subject (if appendInputImagesFromSubjects is true) or a subject's modality; transpose if columnMajor is true
   */
   template< class TImageType
 #if (_MSC_VER >= 1800) || (__GNUC__ > 4)
     = itk::Image< float, 3 >
 #endif
   >
-  cv::Mat VectorizeImages(const std::vector< std::vector< typename TImageType::Pointer > > inputSubjectsAndImages,
-  const std::vector< typename TImageType::Pointer > maskImages,
-  const bool columnMajor, const bool appendInputImagesFromSubjects, const bool maskDefinedPerSubject)
+  cv::Mat VectorizeImages(const std::vector< std::vector< typename TImageType::Pointer > > &inputSubjectsAndImages,
+    const std::vector< std::vector< std::uint32_t > > &maskOffsets,
+    const bool columnMajor = false, const bool appendInputImagesFromSubjects = false, const bool maskDefinedPerSubject = false)
   {
-    if (inputSubjectsAndImages.size() != maskImages.size())
+    if (inputSubjectsAndImages.empty())
+    {
+      return cv::Mat();
+    }
+    if ((maskDefinedPerSubject && (inputSubjectsAndImages.size() != maskOffsets.size())) ||
+      (!maskDefinedPerSubject && (inputSubjectsAndImages[0].size() != maskOffsets.size())))
     {
       std::cerr << "The number of input and mask images do not match.\n";
       exit(EXIT_FAILURE);
     }
-    cv::Mat returnMat;
 
+    // position of every (subject, modality) pair in the output
+    struct GatherTask
+    {
+      size_t subject, modality, mask, row, column;
+    };
+    std::vector< GatherTask > tasks;
+    size_t numberOfRows = 0, numberOfColumns = 0;
     for (size_t i = 0; i < inputSubjectsAndImages.size(); i++)
     {
-      std::vector< float > tempMat; //tempMat is ALWAYS initialized to float because OpenCV functions are defined for float
+      size_t column = 0;
       for (size_t j = 0; j < inputSubjectsAndImages[i].size(); j++)
       {
-        if (!appendInputImagesFromSubjects)
+        GatherTask task;
+        task.subject = i;
+        task.modality = j;
+        task.mask = maskDefinedPerSubject ? i : j;
+        task.row = appendInputImagesFromSubjects ? i : numberOfRows;
+        task.column = appendInputImagesFromSubjects ? column : 0;
+        tasks.push_back(task);
+
+        const size_t taskLength = maskOffsets[task.mask].size();
+        if (appendInputImagesFromSubjects)
         {
-          tempMat.clear(); // re-initialize tempMat if intensities from different modalities are not to be concatenated
+          column += taskLength;
         }
-        int maskIndexToConsider = j;
-        if (maskDefinedPerSubject)
+        else
         {
-          maskIndexToConsider = i;
+          column = taskLength;
+          numberOfRows++;
         }
-
-        itk::ImageRegionIterator<TImageType>
-          inputImageIterator(inputSubjectsAndImages[i][j], inputSubjectsAndImages[i][j]->GetLargestPossibleRegion()),
-          maskImageIterator(maskImages[maskIndexToConsider], maskImages[maskIndexToConsider]->GetLargestPossibleRegion());
-
-        maskImageIterator.GoToBegin();
-
-        while (!maskImageIterator.IsAtEnd())
+        if (!appendInputImagesFromSubjects || (j == inputSubjectsAndImages[i].size() - 1))
         {
-          if (maskImageIterator.Get() != static_cast<typename TImageType::PixelType>(0))
+          if ((numberOfColumns != 0) && (numberOfColumns != column))
           {
-            inputImageIterator.SetIndex(maskImageIterator.GetIndex());
-            tempMat.push_back(static_cast<float>(inputImageIterator.Get()));
+            std::cerr << "The number of masked voxels is not the same for all rows.\n";
+            exit(EXIT_FAILURE);
           }
-          ++maskImageIterator;
-        }
-        if (!appendInputImagesFromSubjects)
-        {
-          returnMat.push_back(tempMat);
+          numberOfColumns = column;
         }
       }
       if (appendInputImagesFromSubjects)
       {
-        returnMat.push_back(tempMat);
+        numberOfRows++;
+      }
+    }
+
+    cv::Mat returnMat(static_cast< int >(numberOfRows), static_cast< int >(numberOfColumns), CV_32F);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < static_cast< int >(tasks.size()); t++)
+    {
+      const auto &task = tasks[t];
+      const auto &offsets = maskOffsets[task.mask];
+      auto inputBuffer = inputSubjectsAndImages[task.subject][task.modality]->GetBufferPointer();
+      float *outputRow = returnMat.ptr< float >(static_cast< int >(task.row)) + task.column;
+      for (size_t k = 0; k < offsets.size(); k++)
+      {
+        outputRow[k] = static_cast< float >(inputBuffer[offsets[k]]); //ALWAYS float because OpenCV functions are defined for float
       }
     }
 
     if (columnMajor)
     {
-      cv::transpose(returnMat, returnMat);
+      return returnMat.t();
     }
     return returnMat;
   }
@@ -113,6 +143,51 @@ namespace cbica
   /**
   \brief Vectorizes a set of images
 
+  \param inputSubjectsAndImages The subjects and images which are to be vectorized
+  \param maskImages The masks to be used for the input images
+  \param columnMajor If true, image intensities are converted to column vectors; otherwise they are converted to row vectors; and then they are concatinated
+  \param appendInputImagesFromSubjects If true, concatenate all image voxels together in a single column/row
+  \param maskDefinedPerSubject If true, the mask is defined on a per-subject basis instead of per-modality
+  \return An OpenCV Mat: size is [inputSubjectsAndImages[i][j]->GetLargestPossibleRegion().GetSize(), inputSubjectsAndImages[j].size()] if columnMajor is true; transpose otherwise
+  */
+  template< class TImageType
+#if (_MSC_VER >= 1800) || (__GNUC__ > 4)
+    = itk::Image< float, 3 >
+#endif
+  >
+  cv::Mat VectorizeImages(const std::vector< std::vector< typename TImageType::Pointer > > inputSubjectsAndImages,
+  const std::vector< typename TImageType::Pointer > maskImages,
+  const bool columnMajor, const bool appendInputImagesFromSubjects, const bool maskDefinedPerSubject)
+  {
+    // the masks are only scanned once and stored as linear buffer offsets
+    std::vector< std::vector< std::uint32_t > > maskOffsets(maskImages.size());
+    for (const auto &maskImage : maskImages)
+    {
+      if (maskImage->GetBufferedRegion().GetNumberOfPixels() > static_cast< size_t >(std::numeric_limits< std::uint32_t >::max()))
+      {
+        throw std::overflow_error("The mask buffer cannot be addressed by 32-bit offsets.");
+      }
+    }
+#pragma omp parallel for schedule(dynamic)
+    for (int m = 0; m < static_cast< int >(maskImages.size()); m++)
+    {
+      auto maskBuffer = maskImages[m]->GetBufferPointer();
+      const size_t numberOfPixels = maskImages[m]->GetBufferedRegion().GetNumberOfPixels();
+      for (size_t k = 0; k < numberOfPixels; k++)
+      {
+        if (maskBuffer[k] != static_cast< typename TImageType::PixelType >(0))
+        {
+          maskOffsets[m].push_back(static_cast< std::uint32_t >(k));
+        }
+      }
+    }
+
+    return VectorizeImages< TImageType >(inputSubjectsAndImages, maskOffsets, columnMajor, appendInputImagesFromSubjects, maskDefinedPerSubject);
+  }
+
+  /**
+  \brief Vectorizes a set of images
+
   \param inputSubjectsAndImages The subjects and images which are to be vectorized
   \param maskIndeces The mask indeces to be used for the input images
   \param columnMajor If true, image intensities are converted to column vectors; otherwise they are converted to row vectors; and then they are concatinated
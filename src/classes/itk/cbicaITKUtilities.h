@@ -18,6 +18,7 @@ See COPYING file or https://www.med.upenn.edu/cbica/software-agreement.html
 #include <functional>
 #include <cmath>
 #include <array>
+#include <cstdint>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -70,6 +71,7 @@ See COPYING file or https://www.med.upenn.edu/cbica/software-agreement.html
 
 #include "itkJoinSeriesImageFilter.h"
 #include "itkExtractImageFilter.h"
+#include "itkRegionOfInterestImageFilter.h"
 #include "itkStatisticsImageFilter.h"
 
 using ImageTypeFloat3D = itk::Image< float, 3 >;
@@ -271,70 +273,210 @@ namespace cbica
   }
 
   /**
-  \brief Calculate and preserve the mask indeces
+  \brief Checks that every voxel of a buffer can be addressed by a 32-bit linear offset (see GetMaskOffsets())
 
-  \param inputModalitiesAndImages A collection of images which are stored in a per-modality basis (each entry corresponds to a subject, whose entries contain different modalities)
-  \return A collection of indeces which constitute the non-zero locations per modality (each entry corresponds to a subject, which contains the locations of non-zero pixel values for all modalities)
+  Throws std::overflow_error otherwise, since truncated offsets would silently read the wrong voxels.
+
+  \param numberOfPixels The number of pixels in the buffer
+  */
+  inline void CheckBufferSizeForOffsets(const size_t numberOfPixels)
+  {
+    if (numberOfPixels > static_cast< size_t >(std::numeric_limits< std::uint32_t >::max()))
+    {
+      throw std::overflow_error("The image buffer has " + std::to_string(numberOfPixels) + " pixels, which cannot be addressed by 32-bit offsets.");
+    }
+  }
+
+  /**
+  \brief Get the linear buffer offsets of the non-zero voxels of a mask, in ascending order
+
+  This is a compact (4 bytes per voxel) alternative to a list of itk::Index, which is used to gather the values of any
+  image on the same grid directly from its buffer (see GetPixelValuesFromOffsets()). Throws std::overflow_error if the 
+  buffer has more voxels than can be addressed by 32 bits.
+
+  \param maskImage The mask image
   */
   template< class TImageType = ImageTypeFloat3D >
-  std::vector< std::vector< typename TImageType::IndexType > > CreateMaskIndeces(const std::vector< std::vector< typename TImageType::Pointer > > &inputModalitiesAndImages)
+  std::vector< std::uint32_t > GetMaskOffsets(const typename TImageType::Pointer maskImage)
   {
-    std::vector< std::vector< typename TImageType::IndexType > > returnMaskIndeces;
-    returnMaskIndeces.resize(inputModalitiesAndImages.size()); // pre-allocate data for speed
+    auto maskBuffer = maskImage->GetBufferPointer();
+    CheckBufferSizeForOffsets(maskImage->GetBufferedRegion().GetNumberOfPixels());
+    const long long numberOfPixels = static_cast< long long >(maskImage->GetBufferedRegion().GetNumberOfPixels());
 
-    // start data processing
-    // made parallel for efficiency
-    int threads = omp_get_max_threads(); // obtain maximum number of threads available on machine  
-    //threads > inputModalitiesAndImages.size() ? threads = inputModalitiesAndImages.size() : threads = threads;
-    //#pragma omp parallel for num_threads(threads)
-    for (int i = 0; i < inputModalitiesAndImages.size(); i++)
-    {
-      std::vector< float > means;
-      std::vector< typename TImageType::IndexType > tempIndeces;
-      typename TImageType::SizeType size = inputModalitiesAndImages[i][0]->GetLargestPossibleRegion().GetSize();
-      size_t totalImageSize = size[0] * size[1] * size[2];
-      means.resize(totalImageSize);
-      //std::fill(means.begin(), means.end(), 0);
-      means.assign(totalImageSize, 0);
+    // the buffer is split into blocks which are processed in parallel and concatenated in order
+    const long long blockSize = 65536;
+    const long long numberOfBlocks = (numberOfPixels + blockSize - 1) / blockSize;
+    std::vector< std::vector< std::uint32_t > > blockOffsets(numberOfBlocks);
 
-      for (size_t j = 0; j < inputModalitiesAndImages[i].size(); j++)
+#pragma omp parallel for schedule(dynamic)
+    for (long long block = 0; block < numberOfBlocks; block++)
+    {
+      const long long end = std::min(numberOfPixels, (block + 1) * blockSize);
+      for (long long i = block * blockSize; i < end; i++)
       {
-        std::vector< float > tempVec;
-        itk::ImageRegionIterator< TImageType > it(inputModalitiesAndImages[i][j], inputModalitiesAndImages[i][j]->GetLargestPossibleRegion());
-        it.GoToBegin();
-
-        while (!it.IsAtEnd())
-        {
-          tempVec.push_back(it.Get());
-          tempIndeces.push_back(it.GetIndex());
-          ++it;
-        }
-        if (tempVec.size() == means.size())
+        if (maskBuffer[i] != 0)
         {
-          std::transform(means.begin(), means.end(), tempVec.begin(), means.begin(), std::plus< float >()); // add tempVec to means dector
+          blockOffsets[block].push_back(static_cast< std::uint32_t >(i));
         }
-        else
+      }
+    }
+
+    std::vector< std::uint32_t > returnOffsets;
+    for (const auto &offsets : blockOffsets)
+    {
+      returnOffsets.insert(returnOffsets.end(), offsets.begin(), offsets.end());
+    }
+    return returnOffsets;
+  }
+
+  /**
+  \brief Calculate the mask offsets, i.e., the voxels where the mean over all modalities is positive, in a single pass
+
+  \param inputModalitiesAndImages A collection of images which are stored in a per-modality basis (each entry corresponds to a subject, whose entries contain different modalities)
+  \return A collection of linear buffer offsets (in ascending order) of the mask of each subject; see GetMaskOffsets() (which also describes the size limit)
+  */
+  template< class TImageType = ImageTypeFloat3D >
+  std::vector< std::vector< std::uint32_t > > CreateMaskOffsets(const std::vector< std::vector< typename TImageType::Pointer > > &inputModalitiesAndImages)
+  {
+    std::vector< std::vector< std::uint32_t > > returnMaskOffsets(inputModalitiesAndImages.size());
+
+    for (size_t i = 0; i < inputModalitiesAndImages.size(); i++)
+    {
+      const size_t totalImageSize = inputModalitiesAndImages[i][0]->GetBufferedRegion().GetNumberOfPixels();
+      CheckBufferSizeForOffsets(totalImageSize);
+      std::vector< const typename TImageType::PixelType * > modalityBuffers;
+      for (size_t j = 0; j < inputModalitiesAndImages[i].size(); j++)
+      {
+        if (inputModalitiesAndImages[i][j]->GetBufferedRegion().GetNumberOfPixels() != totalImageSize)
         {
           std::cerr << "Mean vector calculation error.\n";
           exit(EXIT_FAILURE);
         }
-      } // loop over all subjects in each modality
+        modalityBuffers.push_back(inputModalitiesAndImages[i][j]->GetBufferPointer());
+      }
+
+      // the buffer is split into blocks which are processed in parallel and concatenated in order
+      const long long blockSize = 65536;
+      const long long numberOfBlocks = (static_cast< long long >(totalImageSize) + blockSize - 1) / blockSize;
+      std::vector< std::vector< std::uint32_t > > blockOffsets(numberOfBlocks);
 
-      //std::transform(means.begin(), means.end(), means.begin(), std::bind1st(std::divides< float >(), means.size())); // divide entire means vector by its size
-      std::vector< typename TImageType::IndexType > tempMaskIndeces;
-      for (size_t j = 0; j < means.size(); j++)
+#pragma omp parallel for schedule(dynamic)
+      for (long long block = 0; block < numberOfBlocks; block++)
       {
-        if (means[j] > 0)
+        const long long end = std::min(static_cast< long long >(totalImageSize), (block + 1) * blockSize);
+        for (long long k = block * blockSize; k < end; k++)
         {
-          tempMaskIndeces.push_back(tempIndeces[j]); // store indeces of non-zero mean values
+          float sum = 0;
+          for (size_t j = 0; j < modalityBuffers.size(); j++)
+          {
+            sum += modalityBuffers[j][k];
+          }
+          if (sum > 0)
+          {
+            blockOffsets[block].push_back(static_cast< std::uint32_t >(k)); // store offsets of non-zero mean values
+          }
         }
       }
-      returnMaskIndeces[i] = tempMaskIndeces;
-    } // loop over all modalities
+
+      for (const auto &offsets : blockOffsets)
+      {
+        returnMaskOffsets[i].insert(returnMaskOffsets[i].end(), offsets.begin(), offsets.end());
+      }
+    } // loop over all subjects
+
+    return returnMaskOffsets;
+  }
+
+  /**
+  \brief Calculate and preserve the mask indeces
+
+  \param inputModalitiesAndImages A collection of images which are stored in a per-modality basis (each entry corresponds to a subject, whose entries contain different modalities)
+  \return A collection of indeces which constitute the non-zero locations per modality (each entry corresponds to a subject, which contains the locations of non-zero pixel values for all modalities)
+  */
+  template< class TImageType = ImageTypeFloat3D >
+  std::vector< std::vector< typename TImageType::IndexType > > CreateMaskIndeces(const std::vector< std::vector< typename TImageType::Pointer > > &inputModalitiesAndImages)
+  {
+    // the mask is found on the buffers and only the voxels in it are converted to indeces
+    auto maskOffsets = CreateMaskOffsets< TImageType >(inputModalitiesAndImages);
+
+    std::vector< std::vector< typename TImageType::IndexType > > returnMaskIndeces(maskOffsets.size());
+    for (size_t i = 0; i < maskOffsets.size(); i++)
+    {
+      returnMaskIndeces[i].resize(maskOffsets[i].size());
+      const auto referenceImage = inputModalitiesAndImages[i][0];
+      const long long numberOfIndeces = static_cast< long long >(maskOffsets[i].size());
+
+#pragma omp parallel for
+      for (long long k = 0; k < numberOfIndeces; k++)
+      {
+        returnMaskIndeces[i][k] = referenceImage->ComputeIndex(maskOffsets[i][k]);
+      }
+    }
 
     return returnMaskIndeces;
   }
 
+  /**
+  \brief Gather the pixel values at the specified buffer offsets into a pre-allocated output, in parallel
+
+  \param inputImage The input image in itk::Image format
+  \param offsets The linear buffer offsets, for example from GetMaskOffsets()
+  \param output Pointer to the output, which should have space for offsets.size() values
+  */
+  template< class TImageType = ImageTypeFloat3D, class TOutputType = typename TImageType::PixelType >
+  void GetPixelValuesFromOffsets(const typename TImageType::Pointer inputImage, const std::vector< std::uint32_t > &offsets, TOutputType *output)
+  {
+    auto inputBuffer = inputImage->GetBufferPointer();
+    const long long numberOfOffsets = static_cast< long long >(offsets.size());
+
+    // a plain indexed load, which compilers turn into gather instructions where available (e.g., AVX2)
+#pragma omp parallel for if (numberOfOffsets > 65536)
+    for (long long k = 0; k < numberOfOffsets; k++)
+    {
+      output[k] = static_cast< TOutputType >(inputBuffer[offsets[k]]);
+    }
+  }
+
+  /**
+  \brief Get the pixel values at the specified buffer offsets
+
+  \param inputImage The input image in itk::Image format
+  \param offsets The linear buffer offsets, for example from GetMaskOffsets()
+  \return Vector of values whose data type is the same as image type
+  */
+  template< class TImageType = ImageTypeFloat3D >
+  std::vector< typename TImageType::PixelType > GetPixelValuesFromOffsets(const typename TImageType::Pointer inputImage, const std::vector< std::uint32_t > &offsets)
+  {
+    std::vector< typename TImageType::PixelType > returnVector(offsets.size());
+    GetPixelValuesFromOffsets< TImageType >(inputImage, offsets, returnVector.data());
+    return returnVector;
+  }
+
+  /**
+  \brief Convert indeces to linear buffer offsets of an image
+
+  The offsets only depend on the buffered region, so they can be computed once and reused (see 
+  GetPixelValuesFromOffsets()) for all the images on the same grid, such as the modalities of a subject.
+
+  \param inputImage The image which defines the grid
+  \param indeces The indeces to convert
+  */
+  template < typename TImageType = ImageTypeFloat3D >
+  std::vector< std::uint32_t > GetOffsetsFromIndeces(const typename TImageType::Pointer inputImage, const std::vector< typename TImageType::IndexType > &indeces)
+  {
+    CheckBufferSizeForOffsets(inputImage->GetBufferedRegion().GetNumberOfPixels());
+    std::vector< std::uint32_t > returnOffsets(indeces.size());
+    const long long numberOfIndeces = static_cast< long long >(indeces.size());
+
+#pragma omp parallel for if (numberOfIndeces > 65536)
+    for (long long k = 0; k < numberOfIndeces; k++)
+    {
+      returnOffsets[k] = static_cast< std::uint32_t >(inputImage->ComputeOffset(indeces[k]));
+    }
+
+    return returnOffsets;
+  }
+
   /**
   \brief Get Pixel Values of specified indeces of input Image
 
@@ -345,23 +487,41 @@ namespace cbica
   template < typename TImageType = ImageTypeFloat3D >
   std::vector< typename TImageType::PixelType > GetPixelValuesFromIndeces(const typename TImageType::Pointer inputImage, const std::vector< typename TImageType::IndexType > &indeces)
   {
-    std::vector< typename TImageType::PixelType > returnVector;
-    returnVector.resize(indeces.size()); // pre-allocation done for speed
+    // the indeces are converted to offsets once and read straight from the buffer, which is thread-safe (unlike a shared iterator)
+    return GetPixelValuesFromOffsets< TImageType >(inputImage, GetOffsetsFromIndeces< TImageType >(inputImage, indeces));
+  }
+
+  /**
+  \brief Get Pixel Values of specified indeces of a set of images on the same grid (for example, all modalities of a subject)
 
-    typedef itk::ImageRegionIterator< TImageType > IteratorType;
-    IteratorType imageIterator(inputImage, inputImage->GetBufferedRegion());
+  The indeces are converted to offsets only once.
+
+  \param inputImages The input images in itk::Image format; these need to have the same buffered region
+  \param indeced The indeces from which pixel values need to be extracted
+  \return Vector of values per image
+  */
+  template < typename TImageType = ImageTypeFloat3D >
+  std::vector< std::vector< typename TImageType::PixelType > > GetPixelValuesFromIndeces(const std::vector< typename TImageType::Pointer > &inputImages, 
+    const std::vector< typename TImageType::IndexType > &indeces)
+  {
+    std::vector< std::vector< typename TImageType::PixelType > > returnVectors(inputImages.size());
+    if (inputImages.empty())
+    {
+      return returnVectors;
+    }
 
-    // made parallel for efficiency
-    int threads = omp_get_max_threads(); // obtain maximum number of threads available on machine  
-    //threads > returnVector.size() ? threads = returnVector.size() : threads = threads;
-    //#pragma omp parallel for num_threads(threads)
-    for (int i = 0; i < returnVector.size(); i++)
+    const auto offsets = GetOffsetsFromIndeces< TImageType >(inputImages[0], indeces);
+    for (size_t i = 0; i < inputImages.size(); i++)
     {
-      imageIterator.SetIndex(indeces[i]);
-      returnVector[i] = imageIterator.Get();
+      if (inputImages[i]->GetBufferedRegion() != inputImages[0]->GetBufferedRegion())
+      {
+        std::cerr << "All images need to have the same buffered region to share indeces.\n";
+        return std::vector< std::vector< typename TImageType::PixelType > >();
+      }
+      returnVectors[i] = GetPixelValuesFromOffsets< TImageType >(inputImages[i], offsets);
     }
 
-    return returnVector;
+    return returnVectors;
   }
 
   //! Function that does "soft" threshold checking of 2 numbers - only used for imaging characteristics check
@@ -603,10 +763,126 @@ namespace cbica
     return true;
   }
 
+  /**
+  \brief A non-owning view of the time points (or any other slowest varying axis) of an N-D image series
+
+  Every time point is a contiguous block of the series buffer, so it can be accessed as a raw buffer (for the 
+  buffer-level functions in cbicaUtilities.h) or wrapped as an (N-1)-D itk::Image whose pixel container points into 
+  the series buffer, without any allocation or copy. The geometry of the time points is the same as the one given by
+  itk::ExtractImageFilter. The view keeps the series alive, but the wrapped images do not; they need to be used while 
+  the view (or the series) exists.
+
+  Usage example:
+  \verbatim
+  cbica::TimePointView< ImageTypeFloat4D > timePoints(dwiImage);
+  for (size_t t = 0; t < timePoints.GetNumberOfTimePoints(); t++)
+  {
+    auto volume = timePoints.GetImage(t); // itk::Image< float, 3 > sharing the memory of dwiImage
+  }
+  \endverbatim
+  */
+  template< class TSeriesImageType = itk::Image< float, 4 >,
+    class TImageType = itk::Image< typename TSeriesImageType::PixelType, TSeriesImageType::ImageDimension - 1 > >
+  class TimePointView
+  {
+  public:
+    using PixelType = typename TSeriesImageType::PixelType;
+
+    /**
+    \brief Constructor; the series is referenced, not copied
+
+    \param seriesImage The image series; it needs to be fully buffered, otherwise the view is empty
+    \param directionsCollapseIdentity Whether the direction cosines of the time points are set to identity; defaults to using the submatrix of the series
+    */
+    explicit TimePointView(const typename TSeriesImageType::Pointer seriesImage, bool directionsCollapseIdentity = false) :
+      m_seriesImage(seriesImage), m_numberOfTimePoints(0)
+    {
+      if (seriesImage->GetBufferedRegion() != seriesImage->GetLargestPossibleRegion())
+      {
+        std::cerr << "Time points can only be viewed in a fully buffered image.\n";
+        return;
+      }
+
+      const auto seriesRegion = seriesImage->GetLargestPossibleRegion();
+      m_direction.SetIdentity();
+      for (size_t d = 0; d < TImageType::ImageDimension; d++)
+      {
+        m_region.SetIndex(d, seriesRegion.GetIndex()[d]);
+        m_region.SetSize(d, seriesRegion.GetSize()[d]);
+        m_spacing[d] = seriesImage->GetSpacing()[d];
+        m_origin[d] = seriesImage->GetOrigin()[d];
+        if (!directionsCollapseIdentity)
+        {
+          for (size_t d2 = 0; d2 < TImageType::ImageDimension; d2++)
+          {
+            m_direction[d][d2] = seriesImage->GetDirection()[d][d2];
+          }
+        }
+      }
+      m_numberOfTimePoints = seriesRegion.GetSize()[TImageType::ImageDimension];
+    }
+
+    //! The number of time points in the series
+    size_t GetNumberOfTimePoints() const { return m_numberOfTimePoints; }
+
+    //! The number of pixels in every time point
+    size_t GetNumberOfPixels() const { return m_region.GetNumberOfPixels(); }
+
+    //! The region of every time point
+    const typename TImageType::RegionType &GetRegion() const { return m_region; }
+
+    //! The spacing of every time point
+    const typename TImageType::SpacingType &GetSpacing() const { return m_spacing; }
+
+    //! The origin of every time point
+    const typename TImageType::PointType &GetOrigin() const { return m_origin; }
+
+    //! The direction cosines of every time point
+    const typename TImageType::DirectionType &GetDirection() const { return m_direction; }
+
+    //! The start of the buffer of the specified time point in the series buffer
+    PixelType *GetBufferPointer(const size_t timePoint) const
+    {
+      return m_seriesImage->GetBufferPointer() + timePoint * GetNumberOfPixels();
+    }
+
+    /**
+    \brief Wrap the specified time point as an itk::Image that does not own its memory
+
+    \return The time point; nullptr if it is out of range
+    */
+    typename TImageType::Pointer GetImage(const size_t timePoint) const
+    {
+      if (timePoint >= m_numberOfTimePoints)
+      {
+        std::cerr << "Time point '" << timePoint << "' is out of range.\n";
+        return nullptr;
+      }
+
+      auto timePointImage = TImageType::New();
+      timePointImage->SetRegions(m_region);
+      timePointImage->SetSpacing(m_spacing);
+      timePointImage->SetOrigin(m_origin);
+      timePointImage->SetDirection(m_direction);
+      // the container does not take ownership, so nothing is freed when the image is deleted
+      timePointImage->GetPixelContainer()->SetImportPointer(GetBufferPointer(timePoint), GetNumberOfPixels(), false);
+      return timePointImage;
+    }
+
+  private:
+    typename TSeriesImageType::Pointer m_seriesImage;
+    size_t m_numberOfTimePoints;
+    typename TImageType::RegionType m_region;
+    typename TImageType::SpacingType m_spacing;
+    typename TImageType::PointType m_origin;
+    typename TImageType::DirectionType m_direction;
+  };
+
   /**
   \brief This function returns a joined N-D image with an input of a vector of (N-1)-D images
 
-  Uses the itk::JoinSeriesImageFilter to accomplish this
+  Each input is checked once against the first one; the output is allocated once and the buffers of the inputs 
+  are copied into it in parallel, without the pipeline of itk::JoinSeriesImageFilter.
 
   \param inputImage The vector of images from which the larger image is to be extracted
   \param newSpacing The spacing in the new dimension
@@ -621,42 +897,87 @@ namespace cbica
       //return typename TOutputImageType::New();
       exit(EXIT_FAILURE);
     }
-    auto joinFilter = /*typename*/ itk::JoinSeriesImageFilter< TInputImageType, TOutputImageType >::New();
-    joinFilter->SetSpacing(newSpacing);
+    if (inputImages.empty())
+    {
+      std::cerr << "No images were provided to join.\n";
+      exit(EXIT_FAILURE);
+    }
 
+    const auto inputRegion = inputImages[0]->GetLargestPossibleRegion();
+    const size_t pixelsPerImage = inputRegion.GetNumberOfPixels();
     for (size_t N = 0; N < inputImages.size(); N++)
     {
-      if (!ImageSanityCheck< TInputImageType >(inputImages[0], inputImages[N], 0, 0, spacingTolerance))
+      if ((N > 0) && !ImageSanityCheck< TInputImageType >(inputImages[0], inputImages[N], 0, 0, spacingTolerance))
       {
         std::cerr << "Image Sanity check failed in index '" << N << "'\n";
         //return typename TOutputImageType::New();
         exit(EXIT_FAILURE);
       }
-      joinFilter->SetInput(N, inputImages[N]);
+      if (inputImages[N]->GetBufferedRegion().GetNumberOfPixels() != pixelsPerImage)
+      {
+        std::cerr << "Image in index '" << N << "' is not fully buffered.\n";
+        exit(EXIT_FAILURE);
+      }
     }
-    try
+
+    // same output information as itk::JoinSeriesImageFilter
+    typename TOutputImageType::RegionType outputRegion;
+    typename TOutputImageType::SpacingType outputSpacing;
+    typename TOutputImageType::PointType outputOrigin;
+    typename TOutputImageType::DirectionType outputDirection;
+    outputDirection.SetIdentity();
+    for (size_t d = 0; d < TInputImageType::ImageDimension; d++)
     {
-      joinFilter->Update();
+      outputRegion.SetIndex(d, inputRegion.GetIndex()[d]);
+      outputRegion.SetSize(d, inputRegion.GetSize()[d]);
+      outputSpacing[d] = inputImages[0]->GetSpacing()[d];
+      outputOrigin[d] = inputImages[0]->GetOrigin()[d];
+      for (size_t d2 = 0; d2 < TInputImageType::ImageDimension; d2++)
+      {
+        outputDirection[d][d2] = inputImages[0]->GetDirection()[d][d2];
+      }
     }
-    catch (const std::exception& e)
+    outputRegion.SetIndex(TInputImageType::ImageDimension, 0);
+    outputRegion.SetSize(TInputImageType::ImageDimension, inputImages.size());
+    outputSpacing[TInputImageType::ImageDimension] = newSpacing;
+    outputOrigin[TInputImageType::ImageDimension] = 0;
+
+    auto outputImage = TOutputImageType::New();
+    outputImage->SetRegions(outputRegion);
+    outputImage->SetSpacing(outputSpacing);
+    outputImage->SetOrigin(outputOrigin);
+    outputImage->SetDirection(outputDirection);
+    outputImage->Allocate();
+
+    // the new axis is the slowest varying one, so every input is a contiguous block of the output
+    auto outputBuffer = outputImage->GetBufferPointer();
+    const int numberOfImages = static_cast< int >(inputImages.size());
+#pragma omp parallel for
+    for (int N = 0; N < numberOfImages; N++)
     {
-      std::cerr << "Joining failed: " << e.what() << "\n";
+      auto inputBuffer = inputImages[N]->GetBufferPointer();
+      std::copy(inputBuffer, inputBuffer + pixelsPerImage, outputBuffer + N * pixelsPerImage);
     }
-    return joinFilter->GetOutput();
+
+    return outputImage;
   }
 
   /**
   \brief This function returns a vector of (N-1)-D images with an input of an N-D image
 
-  Uses the itk::ExtractImageFilter to accomplish this
+  When the extraction axis is the slowest varying one (for example, time in a 4D series), every sub-image is a 
+  contiguous block of the input buffer; the sub-images are then either copied out in parallel or, with shareBuffer, 
+  set to point directly into the input buffer without any copy. For other axes, itk::ExtractImageFilter is used.
 
   \param inputImage The larger image series from which the sub-images in the specified axis are extracted
   \param axisToExtract The axis along with the images are to be extracted from; defaults to TInputImageType::ImageDimension - for extraction along Z, use '3'
   \param directionsCollapseIdentity Whether direction cosines are to be normalized to identity or not; defaults to not
+  \param shareBuffer If true, the sub-images along the slowest varying axis are views of the input buffer (if the pixel 
+  types are the same), so inputImage needs to be kept alive as long as they are used; defaults to false
   */
   template< class TInputImageType, class TOutputImageType >
   std::vector< typename TOutputImageType::Pointer > GetExtractedImages(typename TInputImageType::Pointer inputImage,
-    int axisToExtract = TInputImageType::ImageDimension - 1, bool directionsCollapseIdentity = false)
+    int axisToExtract = TInputImageType::ImageDimension - 1, bool directionsCollapseIdentity = false, bool shareBuffer = false)
   {
     std::vector<typename TOutputImageType::Pointer> returnImages;
 
@@ -671,6 +992,44 @@ namespace cbica
     regionSize[axisToExtract] = 0;
     returnImages.resize(imageSize[axisToExtract]);
 
+    if ((axisToExtract == TInputImageType::ImageDimension - 1) && 
+      (inputImage->GetBufferedRegion() == inputImage->GetLargestPossibleRegion()))
+    {
+      TimePointView< TInputImageType > timePoints(inputImage, directionsCollapseIdentity);
+      const size_t pixelsPerImage = timePoints.GetNumberOfPixels();
+      // views are only possible without a pixel type conversion
+      shareBuffer = shareBuffer && std::is_same< typename TInputImageType::PixelType, typename TOutputImageType::PixelType >::value;
+      for (size_t i = 0; i < returnImages.size(); i++)
+      {
+        returnImages[i] = TOutputImageType::New();
+        returnImages[i]->SetRegions(timePoints.GetRegion());
+        returnImages[i]->SetSpacing(timePoints.GetSpacing());
+        returnImages[i]->SetOrigin(timePoints.GetOrigin());
+        returnImages[i]->SetDirection(timePoints.GetDirection());
+        if (shareBuffer)
+        {
+          // same as TimePointView::GetImage(), for any output image type with the same pixel type
+          returnImages[i]->GetPixelContainer()->SetImportPointer(
+            reinterpret_cast< typename TOutputImageType::PixelType * >(timePoints.GetBufferPointer(i)), pixelsPerImage, false);
+        }
+        else
+        {
+          returnImages[i]->Allocate();
+        }
+      }
+
+      if (!shareBuffer)
+      {
+        const int numberOfImages = static_cast< int >(returnImages.size());
+#pragma omp parallel for
+        for (int i = 0; i < numberOfImages; i++)
+        {
+          std::copy(timePoints.GetBufferPointer(i), timePoints.GetBufferPointer(i) + pixelsPerImage, returnImages[i]->GetBufferPointer());
+        }
+      }
+      return returnImages;
+    }
+
     typename TInputImageType::IndexType regionIndex;
     regionIndex.Fill(0);
 
@@ -1220,13 +1579,15 @@ namespace cbica
   /**
   \brief Create an empty (optionally pass a value) ITK image based on an input image with same properties
 
+  The output can be of a different pixel type, for example, to create a compact unsigned char mask of a float image.
+
   \param inputImage The image to base the output on
   \param value The value to populate the new image with; defaults to '0'
   */
-  template< class TImageType = ImageTypeFloat3D >
-  typename TImageType::Pointer CreateImage(const typename TImageType::Pointer inputImage, const typename TImageType::PixelType value = 0)
+  template< class TImageType = ImageTypeFloat3D, class TOutputImageType = TImageType >
+  typename TOutputImageType::Pointer CreateImage(const typename TImageType::Pointer inputImage, const typename TOutputImageType::PixelType value = 0)
   {
-    typename TImageType::Pointer new_image = TImageType::New();
+    typename TOutputImageType::Pointer new_image = TOutputImageType::New();
     new_image->SetLargestPossibleRegion(inputImage->GetLargestPossibleRegion());
     new_image->SetRequestedRegion(inputImage->GetRequestedRegion());
     new_image->SetBufferedRegion(inputImage->GetBufferedRegion());
@@ -1239,42 +1600,73 @@ namespace cbica
   }
 
   /**
-  \brief Create an empty (optionally pass a value) ITK image based on an input image with same properties
+  \brief Replace values in an image according to a mapping of old to new values
 
-  \param inputImage The image to base the output on
-  \param oldValues Values separated by 'x'
-  \param newValues Values separated by 'x'
+  The mapping is applied to the raw buffer in a single parallel pass (see cbica::ChangeValuesInBuffer()); all 
+  replacements are done against the original values, so {1->2, 2->1} swaps the two labels.
+
+  \param inputImage The image to relabel
+  \param oldValues The values to replace
+  \param newValues The values to replace them with; needs to be the same size as oldValues
+  \param inPlace If true, the buffer of inputImage is modified and inputImage is returned; otherwise, a new image is returned
+  \return The relabeled image; nullptr if oldValues and newValues have different sizes
   */
   template< class TImageType = ImageTypeFloat3D >
-  typename TImageType::Pointer ChangeImageValues(const typename TImageType::Pointer inputImage, const std::string &oldValues, const std::string &newValues)
+  typename TImageType::Pointer ChangeImageValues(const typename TImageType::Pointer inputImage, 
+    const std::vector< double > &oldValues, const std::vector< double > &newValues, const bool inPlace = false)
   {
-    auto oldValues_split = cbica::stringSplit(oldValues, "x");
-    auto newValues_split = cbica::stringSplit(newValues, "x");
-    if (oldValues_split.size() != newValues_split.size())
+    if (oldValues.size() != newValues.size())
     {
       std::cerr << "Change values needs the old and new values to be of same size, for example '-cv 1x2,2x3.\n";
       return nullptr;
     }
 
-    itk::ImageRegionConstIterator< TImageType > iterator(inputImage, inputImage->GetBufferedRegion());
     auto outputImage = inputImage;
-    outputImage->DisconnectPipeline();
-    itk::ImageRegionIterator< TImageType > outputIterator(outputImage, outputImage->GetBufferedRegion());
-    outputIterator.GoToBegin();
-    for (iterator.GoToBegin(); !iterator.IsAtEnd(); ++iterator, ++outputIterator)
+    if (!inPlace)
     {
-      for (size_t i = 0; i < oldValues_split.size(); i++)
-      {
-        if (iterator.Get() == std::atof(oldValues_split[i].c_str()))
-        {
-          outputIterator.Set(std::atof(newValues_split[i].c_str()));
-        }
-      }
+      // no need to fill the new buffer since every voxel gets written; CopyInformation() keeps the largest possible region
+      outputImage = TImageType::New();
+      outputImage->CopyInformation(inputImage);
+      outputImage->SetRequestedRegion(inputImage->GetRequestedRegion());
+      outputImage->SetBufferedRegion(inputImage->GetBufferedRegion());
+      outputImage->Allocate();
     }
 
+    cbica::ChangeValuesInBuffer(inputImage->GetBufferPointer(), outputImage->GetBufferPointer(),
+      inputImage->GetBufferedRegion().GetNumberOfPixels(), oldValues, newValues);
+    outputImage->Modified();
+
     return outputImage;
   }
 
+  /**
+  \brief Replace values in an image according to a mapping of old to new values
+
+  \param inputImage The image to relabel
+  \param oldValues Values separated by 'x'
+  \param newValues Values separated by 'x'
+  \param inPlace If true, the buffer of inputImage is modified and inputImage is returned; otherwise, a new image is returned
+  */
+  template< class TImageType = ImageTypeFloat3D >
+  typename TImageType::Pointer ChangeImageValues(const typename TImageType::Pointer inputImage, 
+    const std::string &oldValues, const std::string &newValues, const bool inPlace = false)
+  {
+    // parse the mapping once rather than for every voxel
+    auto oldValues_split = cbica::stringSplit(oldValues, "x");
+    auto newValues_split = cbica::stringSplit(newValues, "x");
+    std::vector< double > oldValues_parsed(oldValues_split.size()), newValues_parsed(newValues_split.size());
+    for (size_t i = 0; i < oldValues_split.size(); i++)
+    {
+      oldValues_parsed[i] = std::atof(oldValues_split[i].c_str());
+    }
+    for (size_t i = 0; i < newValues_split.size(); i++)
+    {
+      newValues_parsed[i] = std::atof(newValues_split[i].c_str());
+    }
+
+    return ChangeImageValues< TImageType >(inputImage, oldValues_parsed, newValues_parsed, inPlace);
+  }
+
   /**
   \brief Get distances in world coordinates across axes for an image
 
@@ -1307,6 +1699,145 @@ namespace cbica
     return distances;
   }
 
+  /**
+  \brief Resample a label image, keeping the label with the highest smoothed indicator at every output voxel
+
+  Each label is processed in turn: its binary indicator is smoothed (sigma = sqrt(3) * input spacing), linearly 
+  interpolated on the output grid and compared to the best score so far. Only one smoothed label, the running best 
+  score and the running best label are kept in memory, regardless of the number of labels. The output grid uses the 
+  origin, direction and start index of the input image (same as ResampleImage()), so the mapping from output to 
+  input index is separable and the interpolation weights are computed once per axis. Output voxels that fall outside
+  the input image are set to '0'.
+
+  \param inputImage The input label image
+  \param outputSpacing The output spacing
+  \param outputSize The output size
+  \return The resampled label image
+  */
+  template< class TImageType = ImageTypeFloat3D >
+  typename TImageType::Pointer ResampleLabelImage(const typename TImageType::Pointer inputImage, const typename TImageType::SpacingType outputSpacing,
+    typename TImageType::SizeType outputSize)
+  {
+    const unsigned int Dimension = TImageType::ImageDimension;
+    using ScoreImageType = itk::Image< float, Dimension >;
+
+    auto outputImage = TImageType::New();
+    typename TImageType::RegionType outputRegion;
+    outputRegion.SetIndex(inputImage->GetLargestPossibleRegion().GetIndex());
+    outputRegion.SetSize(outputSize);
+    outputImage->SetRegions(outputRegion);
+    outputImage->SetOrigin(inputImage->GetOrigin());
+    outputImage->SetDirection(inputImage->GetDirection());
+    outputImage->SetSpacing(outputSpacing);
+    outputImage->Allocate();
+    outputImage->FillBuffer(0);
+
+    // per axis: the two input neighbours of every output position and the weight of the upper one
+    const auto inputRegion = inputImage->GetBufferedRegion();
+    const auto inputSpacing = inputImage->GetSpacing();
+    std::vector< std::vector< long long > > lowerOffsets(Dimension), upperOffsets(Dimension);
+    std::vector< std::vector< float > > upperWeights(Dimension);
+    std::vector< std::vector< bool > > isInside(Dimension);
+    long long inputStride = 1;
+    for (unsigned int d = 0; d < Dimension; d++)
+    {
+      const long long inputSize = static_cast< long long >(inputRegion.GetSize()[d]);
+      lowerOffsets[d].resize(outputSize[d]);
+      upperOffsets[d].resize(outputSize[d]);
+      upperWeights[d].resize(outputSize[d]);
+      isInside[d].resize(outputSize[d]);
+      for (size_t i = 0; i < outputSize[d]; i++)
+      {
+        const double outputIndex = static_cast< double >(outputRegion.GetIndex()[d] + static_cast< long long >(i));
+        const double position = outputIndex * outputSpacing[d] / inputSpacing[d] - inputRegion.GetIndex()[d];
+        const long long lower = static_cast< long long >(std::floor(position));
+        isInside[d][i] = (position >= -0.5) && (position < inputSize - 0.5); // same as itk::ImageFunction::IsInsideBuffer()
+        lowerOffsets[d][i] = std::min(std::max(lower, 0ll), inputSize - 1) * inputStride;
+        upperOffsets[d][i] = std::min(std::max(lower + 1, 0ll), inputSize - 1) * inputStride;
+        upperWeights[d][i] = static_cast< float >(position - lower);
+      }
+      inputStride *= inputSize;
+    }
+
+    const long long numberOfOutputPixels = static_cast< long long >(outputRegion.GetNumberOfPixels());
+    std::vector< float > bestScores(static_cast< size_t >(numberOfOutputPixels), -1);
+    auto outputBuffer = outputImage->GetBufferPointer();
+
+    auto labelsAndCounts = cbica::GetUniqueValuesAndCounts(inputImage->GetBufferPointer(), inputRegion.GetNumberOfPixels());
+    for (const auto &labelAndCount : labelsAndCounts)
+    {
+      const auto label = labelAndCount.first;
+
+      auto thresholder = itk::BinaryThresholdImageFilter< TImageType, ScoreImageType >::New();
+      thresholder->SetInput(inputImage);
+      thresholder->SetLowerThreshold(label);
+      thresholder->SetUpperThreshold(label);
+      thresholder->SetInsideValue(1.0);
+      thresholder->SetOutsideValue(0.0);
+
+      auto smoother = itk::SmoothingRecursiveGaussianImageFilter< ScoreImageType, ScoreImageType >::New();
+      smoother->SetInput(thresholder->GetOutput());
+      typename itk::SmoothingRecursiveGaussianImageFilter< ScoreImageType, ScoreImageType >::SigmaArrayType sigmas;
+      for (unsigned int d = 0; d < Dimension; d++)
+      {
+        sigmas[d] = std::sqrt(3) * inputSpacing[d];
+      }
+      smoother->SetSigmaArray(sigmas);
+      smoother->Update();
+      const float *scores = smoother->GetOutput()->GetBufferPointer();
+
+#pragma omp parallel for if (numberOfOutputPixels > 65536)
+      for (long long o = 0; o < numberOfOutputPixels; o++)
+      {
+        // split the output offset into per-axis positions
+        size_t positions[Dimension];
+        long long remainder = o;
+        bool inside = true;
+        for (unsigned int d = 0; d < Dimension; d++)
+        {
+          positions[d] = static_cast< size_t >(remainder % static_cast< long long >(outputSize[d]));
+          remainder /= static_cast< long long >(outputSize[d]);
+          inside = inside && isInside[d][positions[d]];
+        }
+        if (!inside)
+        {
+          continue;
+        }
+
+        // linear interpolation over the 2^Dimension neighbours
+        float score = 0;
+        for (unsigned int corner = 0; corner < (1u << Dimension); corner++)
+        {
+          long long offset = 0;
+          float weight = 1;
+          for (unsigned int d = 0; d < Dimension; d++)
+          {
+            const size_t p = positions[d];
+            if (corner & (1u << d))
+            {
+              offset += upperOffsets[d][p];
+              weight *= upperWeights[d][p];
+            }
+            else
+            {
+              offset += lowerOffsets[d][p];
+              weight *= 1 - upperWeights[d][p];
+            }
+          }
+          score += weight * scores[offset];
+        }
+
+        if (score > bestScores[o])
+        {
+          bestScores[o] = score;
+          outputBuffer[o] = label;
+        }
+      }
+    }
+
+    return outputImage;
+  }
+
   /**
   \brief Resample an image to an isotropic resolution using the specified output spacing vector
 
@@ -1344,104 +1875,10 @@ namespace cbica
     }
     else if (interpolator_wrap.find("nearest") != std::string::npos)
     {
-      // if nearest label is found, do something special
+      // label images are resampled through per-label smoothed indicators
       if (interpolator_wrap.find("nearestlabel") != std::string::npos)
       {
-        ///
-        // this situation can only happen in case of a mask image
-        // The label image assumed to be an image of shortsC
-        typedef itk::Image<short, TImageType::ImageDimension> LabelImageType;
-        /// histogram calculation from ITK -- for texture feature pipeline
-        auto caster = itk::CastImageFilter< TImageType, LabelImageType >::New();
-        caster->SetInput(inputImage); //original input binary mask, not the masked image
-        caster->Update();
-
-        auto moving = caster->GetOutput();
-
-        // Scan the unique labels in the image
-        std::set<short> label_set;
-        short *labels = moving->GetBufferPointer();
-        int n_pixels = moving->GetPixelContainer()->Size();
-
-        // Get the list of unique pixels
-        short last_pixel = 0;
-        for (int j = 0; j < n_pixels; j++)
-        {
-          short pixel = labels[j];
-          if (last_pixel != pixel)
-          {
-            label_set.insert(pixel);
-            last_pixel = pixel;
-            //if (label_set.size() > 1000)
-            //  throw GreedyException("Label wise interpolation not supported for image %s "
-            //    "which has over 1000 distinct labels", filename);
-          }
-        }
-
-        // Turn this set into an array
-        std::vector<short> label_array(label_set.begin(), label_set.end());
-
-        // Create a N-way voting filter
-        typedef NaryLabelVotingFunctor<TImageType, LabelImageType> VotingFunctor;
-        VotingFunctor vf(label_array);
-
-        typedef itk::NaryFunctorImageFilter<TImageType, LabelImageType, VotingFunctor> VotingFilter;
-        typename VotingFilter::Pointer fltVoting = VotingFilter::New();
-        fltVoting->SetFunctor(vf);
-
-        // Create a mini-pipeline of streaming filters
-        for (size_t j = 0; j < label_array.size(); j++)
-        {
-          // Set up a threshold filter for this label
-          typedef itk::BinaryThresholdImageFilter<LabelImageType, TImageType> ThresholdFilterType;
-          typename ThresholdFilterType::Pointer fltThreshold = ThresholdFilterType::New();
-          fltThreshold->SetInput(moving);
-          fltThreshold->SetLowerThreshold(label_array[j]);
-          fltThreshold->SetUpperThreshold(label_array[j]);
-          fltThreshold->SetInsideValue(1.0);
-          fltThreshold->SetOutsideValue(0.0);
-
-          // Set up a smoothing filter for this label
-          typedef itk::SmoothingRecursiveGaussianImageFilter<TImageType, TImageType> SmootherType;
-          typename SmootherType::Pointer fltSmooth = SmootherType::New();
-          fltSmooth->SetInput(fltThreshold->GetOutput());
-
-          // Work out the sigmas for the filter
-          //if (r_param.images[i].interp.sigma.physical_units)
-          //{
-          //  fltSmooth->SetSigma(r_param.images[i].interp.sigma.sigma);
-          //}
-          //else
-          {
-            typename SmootherType::SigmaArrayType sigma_array;
-            auto default_sigma = std::sqrt(3);
-            for (unsigned int d = 0; d < TImageType::ImageDimension; d++)
-              sigma_array[d] = /*r_param.images[i].interp.sigma.sigma*/default_sigma * moving->GetSpacing()[d];
-            fltSmooth->SetSigmaArray(sigma_array);
-          }
-
-          //// TODO: we should really be coercing the output into a vector image to speed up interpolation!
-          //typedef FastWarpCompositeImageFilter<TImageType, TImageType, VectorImageType> InterpFilter;
-          //typename InterpFilter::Pointer fltInterp = InterpFilter::New();
-          //fltInterp->SetMovingImage(fltSmooth->GetOutput());
-          //fltInterp->SetDeformationField(warp);
-          //fltInterp->SetUsePhysicalSpace(true);
-
-          //fltInterp->Update();
-
-          // Add to the voting filter
-          fltVoting->SetInput(j, fltSmooth->GetOutput());
-        }
-
-        // TODO: test out streaming!
-        // Run this big pipeline
-        fltVoting->Update();
-
-        auto caster_back = itk::CastImageFilter< LabelImageType, TImageType >::New();
-        caster_back->SetInput(fltVoting->GetOutput()); //original input binary mask, not the masked image
-        caster_back->Update();
-        return caster_back->GetOutput();
-        ///
+        return ResampleLabelImage< TImageType >(inputImage, outputSpacing, outputSize);
       }
       else
       {
@@ -1579,67 +2016,181 @@ namespace cbica
 
   }
 
+  /**
+  \brief Get the unique values in an image along with the number of voxels of each, in ascending order of the values
+
+  This is a single (parallel) pass over the buffer; see cbica::GetUniqueValuesAndCounts() for details.
+
+  \param inputImage The input image
+  */
+  template< class TImageType = ImageTypeFloat3D >
+  std::vector< std::pair< typename TImageType::PixelType, size_t > > GetUniqueValuesAndCountsInImage(const typename TImageType::Pointer inputImage)
+  {
+    return cbica::GetUniqueValuesAndCounts(inputImage->GetBufferPointer(), inputImage->GetBufferedRegion().GetNumberOfPixels());
+  }
+
   /**
   \brief Get the unique values in an image
 
   \param inputImage The input image
-  \param sortResult Whether the output should be sorted in ascending order or not, defaults to true
+  \param sortResult Whether the output should be sorted in ascending order or not, defaults to true (the values are always sorted)
   */
   template< class TImageType = ImageTypeFloat3D >
   std::vector< typename TImageType::PixelType > GetUniqueValuesInImage(typename TImageType::Pointer inputImage, 
     bool sortResult = true)
   {
-    itk::ImageRegionConstIterator< TImageType > iterator(inputImage, inputImage->GetBufferedRegion());
+    auto valuesAndCounts = GetUniqueValuesAndCountsInImage< TImageType >(inputImage);
 
-    std::vector< typename TImageType::PixelType > uniqueValues;
+    std::vector< typename TImageType::PixelType > uniqueValues(valuesAndCounts.size());
+    for (size_t i = 0; i < valuesAndCounts.size(); i++)
+    {
+      uniqueValues[i] = valuesAndCounts[i].first;
+    }
 
-    for (iterator.GoToBegin(); !iterator.IsAtEnd(); ++iterator)
+    return uniqueValues;
+  }
+
+  /**
+  \brief Get a binary mask (0 and 1) of the specified labels, for example, to get the BraTS tumor core (labels 1 and 4)
+
+  \param inputLabel The label image
+  \param labels The labels that are set to '1' in the output
+  */
+  template < typename TImageType = ImageTypeFloat3D, typename TMaskImageType = TImageType >
+  typename TMaskImageType::Pointer GetBinaryMaskFromLabels(const typename TImageType::Pointer inputLabel, const std::vector< double > &labels)
+  {
+    auto outputMask = CreateImage< TImageType, TMaskImageType >(inputLabel);
+    auto inputBuffer = inputLabel->GetBufferPointer();
+    auto outputBuffer = outputMask->GetBufferPointer();
+    const long long numberOfPixels = static_cast< long long >(inputLabel->GetBufferedRegion().GetNumberOfPixels());
+
+#pragma omp parallel for if (numberOfPixels > 65536)
+    for (long long i = 0; i < numberOfPixels; i++)
+    {
+      const double value = static_cast< double >(inputBuffer[i]);
+      bool isInMask = false;
+      for (size_t l = 0; l < labels.size(); l++)
+      {
+        isInMask |= (value == labels[l]);
+      }
+      outputBuffer[i] = isInMask ? 1 : 0;
+    }
+
+    return outputMask;
+  }
+
+  /**
+  \brief Get the unique value labels in an image as separate masks (where the label is '1')
+
+  The unique labels are found first (see GetUniqueValuesInImage()) and all the masks are then written in a single pass
+  over the buffer. Use an unsigned char output type to get compact masks, or LabelImageView to only create the masks
+  that are needed.
+
+  \param inputImage The input image
+  \return Map of label (as int) and corresponding mask
+  */
+  template< class TImageType = ImageTypeFloat3D, class TOutputImageType = TImageType >
+  std::map< int, typename TOutputImageType::Pointer > GetUniqueLabelImagessFromImage(typename TImageType::Pointer inputImage)
+  {
+    std::map< int, typename TOutputImageType::Pointer > returnImages;
+
+    auto uniqueValues = GetUniqueValuesInImage< TImageType >(inputImage);
+
+    // every unique value points to the buffer of the mask of its label
+    std::vector< typename TOutputImageType::PixelType * > outputBuffers(uniqueValues.size());
+    for (size_t i = 0; i < uniqueValues.size(); i++)
     {
-      auto currentValue = iterator.Get();
-      if (std::find(uniqueValues.begin(), uniqueValues.end(), currentValue) == uniqueValues.end())
+      const int currentLabel = static_cast< int >(uniqueValues[i]);
+      if (returnImages.find(currentLabel) == returnImages.end())
       {
-        uniqueValues.push_back(currentValue);
+        returnImages[currentLabel] = CreateImage< TImageType, TOutputImageType >(inputImage);
       }
+      outputBuffers[i] = returnImages[currentLabel]->GetBufferPointer();
     }
 
-    if (sortResult)
+    auto inputBuffer = inputImage->GetBufferPointer();
+    const long long numberOfPixels = static_cast< long long >(inputImage->GetBufferedRegion().GetNumberOfPixels());
+
+#pragma omp parallel if (numberOfPixels > 65536)
     {
-      std::sort(uniqueValues.begin(), uniqueValues.end(), std::less< typename TImageType::PixelType >());
+      // neighboring voxels mostly have the same label, so the search is only done when it changes
+      size_t currentIndex = 0;
+
+#pragma omp for schedule(static)
+      for (long long i = 0; i < numberOfPixels; i++)
+      {
+        if (uniqueValues[currentIndex] != inputBuffer[i])
+        {
+          currentIndex = std::lower_bound(uniqueValues.begin(), uniqueValues.end(), inputBuffer[i]) - uniqueValues.begin();
+        }
+        outputBuffers[currentIndex][i] = 1;
+      }
     }
 
-    return uniqueValues;
+    return returnImages;
   }
 
   /**
-  \brief Get the unique value labels in an image
+  \brief A lazily materialized view of the labels of an image
 
-  \param inputImage The input image
+  Only the unique labels and their counts are computed up front; the mask of a label is created when it is requested,
+  so that only the masks in use are kept in memory.
+
+  Usage example:
+  \verbatim
+  cbica::LabelImageView< ImageTypeFloat3D > labelView(labelImage);
+  for (auto &label : labelView.GetLabels())
+  {
+    auto mask = labelView.GetMask(label); // unsigned char mask, released when it goes out of scope
+  }
+  \endverbatim
   */
-  template< class TImageType = ImageTypeFloat3D >
-  std::map< int, typename TImageType::Pointer > GetUniqueLabelImagessFromImage(typename TImageType::Pointer inputImage)
+  template< class TImageType = ImageTypeFloat3D, class TMaskImageType = itk::Image< unsigned char, TImageType::ImageDimension > >
+  class LabelImageView
   {
-    /// fix this up
-    itk::ImageRegionConstIterator< TImageType > iterator(inputImage, inputImage->GetBufferedRegion());
+  public:
+    using PixelType = typename TImageType::PixelType;
 
-    std::vector< typename TImageType::PixelType > uniqueValues;
-    std::map< int, typename TImageType::Pointer > returnImages;
+    //! Constructor; the input image is referenced, not copied
+    explicit LabelImageView(const typename TImageType::Pointer inputImage) :
+      m_inputImage(inputImage), m_labelsAndCounts(GetUniqueValuesAndCountsInImage< TImageType >(inputImage))
+    {
+    }
 
-    for (iterator.GoToBegin(); !iterator.IsAtEnd(); ++iterator)
+    //! The unique labels in ascending order
+    std::vector< PixelType > GetLabels() const
     {
-      auto currentValue = iterator.Get();
+      std::vector< PixelType > labels(m_labelsAndCounts.size());
+      for (size_t i = 0; i < m_labelsAndCounts.size(); i++)
+      {
+        labels[i] = m_labelsAndCounts[i].first;
+      }
+      return labels;
+    }
 
-      // if a new value has been found, initialize a new image
-      if (std::find(uniqueValues.begin(), uniqueValues.end(), currentValue) == uniqueValues.end())
+    //! The number of voxels of the specified label (0 if it is not present)
+    size_t GetCount(const PixelType label) const
+    {
+      for (const auto &labelAndCount : m_labelsAndCounts)
       {
-        uniqueValues.push_back(currentValue);
-        returnImages[currentValue] = CreateImage< TImageType >(inputImage);
+        if (labelAndCount.first == label)
+        {
+          return labelAndCount.second;
+        }
       }
+      return 0;
+    }
 
-      returnImages[currentValue]->SetPixel(iterator.GetIndex(), 1);
+    //! Create the mask of the specified label
+    typename TMaskImageType::Pointer GetMask(const PixelType label) const
+    {
+      return GetBinaryMaskFromLabels< TImageType, TMaskImageType >(m_inputImage, { static_cast< double >(label) });
     }
 
-    return returnImages;
-  }
+  private:
+    typename TImageType::Pointer m_inputImage;
+    std::vector< std::pair< PixelType, size_t > > m_labelsAndCounts;
+  };
 
   /**
   \brief Get Non-zero indeces of image
@@ -1660,6 +2211,136 @@ namespace cbica
     return outputIndeces;
   }
 
+  /**
+  \brief Get the bounding box of the non-zero voxels in either of 2 images (for example, a label and its reference), padded by a margin
+
+  Voxels outside this region are background in both images, so every label metric can be computed on the cropped 
+  images (see GetCroppedImage()) with the true negatives corrected analytically. If the images are not on the same
+  buffered region, their largest possible region is returned.
+
+  \param inputImage_1 The first image
+  \param inputImage_2 The second image
+  \param margin Number of voxels to pad the bounding box with on each side (clipped to the image); defaults to 1
+  \return The region of interest; its size is zero if both images are empty
+  */
+  template< class TImageType = ImageTypeFloat3D >
+  typename TImageType::RegionType GetNonZeroBoundingRegion(const typename TImageType::Pointer inputImage_1, const typename TImageType::Pointer inputImage_2,
+    const unsigned int margin = 1)
+  {
+    const unsigned int dimension = TImageType::ImageDimension;
+    const auto bufferedRegion = inputImage_1->GetBufferedRegion();
+    if ((bufferedRegion != inputImage_2->GetBufferedRegion()) || (bufferedRegion != inputImage_1->GetLargestPossibleRegion()))
+    {
+      return inputImage_1->GetLargestPossibleRegion();
+    }
+
+    const auto size = bufferedRegion.GetSize();
+    const auto buffer_1 = inputImage_1->GetBufferPointer();
+    const auto buffer_2 = inputImage_2->GetBufferPointer();
+    const long long lineLength = size[0];
+    const long long numberOfLines = static_cast< long long >(bufferedRegion.GetNumberOfPixels()) / lineLength;
+
+    std::vector< long long > minIndex(dimension), maxIndex(dimension, -1);
+    for (unsigned int d = 0; d < dimension; d++)
+    {
+      minIndex[d] = size[d];
+    }
+
+    // the images are scanned line by line, so that the index is only computed for lines with foreground
+#pragma omp parallel
+    {
+      std::vector< long long > threadMin = minIndex, threadMax = maxIndex;
+
+#pragma omp for schedule(static)
+      for (long long line = 0; line < numberOfLines; line++)
+      {
+        const auto lineBuffer_1 = buffer_1 + line * lineLength;
+        const auto lineBuffer_2 = buffer_2 + line * lineLength;
+        long long first = 0, last = lineLength - 1;
+        while ((first < lineLength) && (lineBuffer_1[first] == 0) && (lineBuffer_2[first] == 0))
+        {
+          first++;
+        }
+        if (first == lineLength)
+        {
+          continue;
+        }
+        while ((lineBuffer_1[last] == 0) && (lineBuffer_2[last] == 0))
+        {
+          last--;
+        }
+
+        threadMin[0] = std::min(threadMin[0], first);
+        threadMax[0] = std::max(threadMax[0], last);
+        long long remainder = line;
+        for (unsigned int d = 1; d < dimension; d++)
+        {
+          const long long index = remainder % static_cast< long long >(size[d]);
+          remainder /= static_cast< long long >(size[d]);
+          threadMin[d] = std::min(threadMin[d], index);
+          threadMax[d] = std::max(threadMax[d], index);
+        }
+      }
+
+#pragma omp critical
+      {
+        for (unsigned int d = 0; d < dimension; d++)
+        {
+          minIndex[d] = std::min(minIndex[d], threadMin[d]);
+          maxIndex[d] = std::max(maxIndex[d], threadMax[d]);
+        }
+      }
+    }
+
+    typename TImageType::RegionType returnRegion;
+    if (maxIndex[0] < 0)
+    {
+      typename TImageType::SizeType emptySize;
+      emptySize.Fill(0);
+      returnRegion.SetIndex(bufferedRegion.GetIndex());
+      returnRegion.SetSize(emptySize);
+      return returnRegion;
+    }
+
+    typename TImageType::IndexType regionIndex;
+    typename TImageType::SizeType regionSize;
+    for (unsigned int d = 0; d < dimension; d++)
+    {
+      const long long start = std::max< long long >(0, minIndex[d] - margin),
+        end = std::min< long long >(static_cast< long long >(size[d]) - 1, maxIndex[d] + margin);
+      regionIndex[d] = bufferedRegion.GetIndex()[d] + start;
+      regionSize[d] = end - start + 1;
+    }
+    returnRegion.SetIndex(regionIndex);
+    returnRegion.SetSize(regionSize);
+
+    return returnRegion;
+  }
+
+  /**
+  \brief Get the specified region of an image as a new image (with the same physical space)
+
+  \param inputImage The input image
+  \param regionOfInterest The region to crop, for example, from GetNonZeroBoundingRegion()
+  */
+  template< class TImageType = ImageTypeFloat3D >
+  typename TImageType::Pointer GetCroppedImage(const typename TImageType::Pointer inputImage, const typename TImageType::RegionType &regionOfInterest)
+  {
+    if (regionOfInterest == inputImage->GetLargestPossibleRegion())
+    {
+      return inputImage;
+    }
+
+    auto cropper = itk::RegionOfInterestImageFilter< TImageType, TImageType >::New();
+    cropper->SetInput(inputImage);
+    cropper->SetRegionOfInterest(regionOfInterest);
+    cropper->Update();
+
+    typename TImageType::Pointer outputImage = cropper->GetOutput();
+    outputImage->DisconnectPipeline();
+    return outputImage;
+  }
+
   /**
   \brief Get hausdorff distance between 2 labels
 
@@ -1676,10 +2357,15 @@ namespace cbica
     {
       percentile = percentile / 100.0;
     }
+    // the distance maps are only computed around the masks
+    auto regionOfInterest = GetNonZeroBoundingRegion< TImageType >(input_1, input_2);
+    const bool cropImages = (regionOfInterest.GetNumberOfPixels() > 0);
+
     auto filter = HausdorffDistanceImageToImageMetric< TImageType, TImageType >::New();
-    filter->SetFixedImage(input_1);
-    filter->SetMovingImage(input_2);
+    filter->SetFixedImage(cropImages ? GetCroppedImage< TImageType >(input_1, regionOfInterest) : input_1);
+    filter->SetMovingImage(cropImages ? GetCroppedImage< TImageType >(input_2, regionOfInterest) : input_2);
     filter->SetPercentile(percentile);
+    filter->FastModeOn();
 
     return filter->GetValue();
   }
@@ -1696,20 +2382,31 @@ namespace cbica
   {
     std::map< std::string, float > returnStruct;
 
-    itk::ImageRegionConstIterator< TImageType > inputIterator(input_1, input_1->GetBufferedRegion()),
-      outputIterator(input_2, input_2->GetBufferedRegion());
-
-    std::vector< float > inputVector_1, inputVector_2;
-    // iterate through the entire input image and if the label value matches the input value,
-    // put '1' in the corresponding location of the output
-    for (inputIterator.GoToBegin(); !inputIterator.IsAtEnd(); ++inputIterator)
+    cbica::ConfusionMatrixCounts counts;
+    if (input_1->GetBufferedRegion() == input_2->GetBufferedRegion())
     {
-      outputIterator.SetIndex(inputIterator.GetIndex());
-      inputVector_1.push_back(inputIterator.Get());
-      inputVector_2.push_back(outputIterator.Get());
+      // same layout in memory, so compare the pixel buffers directly
+      counts = cbica::GetConfusionMatrixCounts(input_1->GetBufferPointer(), input_2->GetBufferPointer(),
+        input_1->GetBufferedRegion().GetNumberOfPixels());
     }
+    else
+    {
+      itk::ImageRegionConstIterator< TImageType > inputIterator(input_1, input_1->GetBufferedRegion()),
+        outputIterator(input_2, input_2->GetBufferedRegion());
 
-    auto temp_roc = cbica::ROC_Values(inputVector_1, inputVector_2);
+      std::vector< typename TImageType::PixelType > inputVector_1, inputVector_2;
+      // iterate through the entire input image and if the label value matches the input value,
+      // put '1' in the corresponding location of the output
+      for (inputIterator.GoToBegin(); !inputIterator.IsAtEnd(); ++inputIterator)
+      {
+        outputIterator.SetIndex(inputIterator.GetIndex());
+        inputVector_1.push_back(inputIterator.Get());
+        inputVector_2.push_back(outputIterator.Get());
+      }
+      counts = cbica::GetConfusionMatrixCounts(inputVector_1.data(), inputVector_2.data(), inputVector_1.size());
+    }
+
+    auto temp_roc = cbica::ROC_Values(counts);
 
     returnStruct["Sensitivity"] = temp_roc["Sensitivity"];
     returnStruct["Specificity"] = temp_roc["Specificity"];
@@ -1719,9 +2416,38 @@ namespace cbica
     return returnStruct;
   }
 
+  /**
+  \brief Get the joint label histogram (co-occurrence table) of 2 label images in a single pass; see cbica::LabelCooccurrence
+
+  \param inputLabel_1 The first (real) label image
+  \param inputLabel_2 The second (predicted) label image
+  */
+  template < typename TImageType = ImageTypeFloat3D >
+  cbica::LabelCooccurrence GetLabelCooccurrence(const typename TImageType::Pointer inputLabel_1, const typename TImageType::Pointer inputLabel_2)
+  {
+    if (inputLabel_1->GetBufferedRegion() == inputLabel_2->GetBufferedRegion())
+    {
+      // same layout in memory, so go over the pixel buffers directly
+      return cbica::GetLabelCooccurrence(inputLabel_1->GetBufferPointer(), inputLabel_2->GetBufferPointer(),
+        inputLabel_1->GetBufferedRegion().GetNumberOfPixels());
+    }
+
+    itk::ImageRegionConstIterator< TImageType > inputIterator(inputLabel_1, inputLabel_1->GetBufferedRegion());
+    std::vector< typename TImageType::PixelType > inputVector_1, inputVector_2;
+    for (inputIterator.GoToBegin(); !inputIterator.IsAtEnd(); ++inputIterator)
+    {
+      inputVector_1.push_back(inputIterator.Get());
+      inputVector_2.push_back(inputLabel_2->GetPixel(inputIterator.GetIndex()));
+    }
+    return cbica::GetLabelCooccurrence(inputVector_1.data(), inputVector_2.data(), inputVector_1.size());
+  }
+
   /**
   \brief Get the statistics between 2 labels
 
+  All overlap, sensitivity and specificity values are derived from a single co-occurrence table of the 2 label images, 
+  and all metrics are computed on the bounding box of the labels (see GetNonZeroBoundingRegion()).
+
   \param inputLabel_1 The first label file
   \param inputLabel_2 The second label file
   \return Map of various statistics and corresponding values
@@ -1732,8 +2458,23 @@ namespace cbica
   {
     std::map< std::string, double > returnMap;
 
-    auto uniqueLabels = GetUniqueValuesInImage< TImageType >(inputLabel_1);
-    auto uniqueLabelsRef = GetUniqueValuesInImage< TImageType >(inputLabel_2);
+    // all metrics are computed around the labels; the background outside is added back to the table as true negatives
+    auto regionOfInterest = GetNonZeroBoundingRegion< TImageType >(inputLabel_1, inputLabel_2);
+    typename TImageType::Pointer croppedLabel_1 = inputLabel_1, croppedLabel_2 = inputLabel_2;
+    if (regionOfInterest.GetNumberOfPixels() > 0)
+    {
+      croppedLabel_1 = GetCroppedImage< TImageType >(inputLabel_1, regionOfInterest);
+      croppedLabel_2 = GetCroppedImage< TImageType >(inputLabel_2, regionOfInterest);
+    }
+
+    auto labelTable = GetLabelCooccurrence< TImageType >(croppedLabel_1, croppedLabel_2);
+    const size_t numberOfPixels = inputLabel_1->GetBufferedRegion().GetNumberOfPixels();
+    if (numberOfPixels > labelTable.total)
+    {
+      labelTable.AddCount(0, 0, numberOfPixels - labelTable.total);
+    }
+    const auto &uniqueLabels = labelTable.labels_1;
+    const auto &uniqueLabelsRef = labelTable.labels_2;
 
     // sanity check
     if (uniqueLabels.size() != uniqueLabelsRef.size())
@@ -1753,68 +2494,68 @@ namespace cbica
       }
     }
 
-    auto similarityFilter = itk::LabelOverlapMeasuresImageFilter< TImageType >::New();
-
-    similarityFilter->SetSourceImage(inputLabel_1);
-    similarityFilter->SetTargetImage(inputLabel_2);
-    similarityFilter->Update();
+    // the overall overlap is accumulated over all the (non-background) labels
+    std::map< double, cbica::ConfusionMatrixCounts > labelCounts;
+    cbica::ConfusionMatrixCounts overallCounts;
+    for (size_t i = 0; i < uniqueLabels.size(); i++)
+    {
+      labelCounts[uniqueLabels[i]] = labelTable.GetRegionCounts({ uniqueLabels[i] });
+      if (uniqueLabels[i] != 0)
+      {
+        overallCounts += labelCounts[uniqueLabels[i]];
+      }
+    }
 
-    returnMap["Overlap_Overall"] = similarityFilter->GetTotalOverlap();
-    //std::cout << "=== Entire Masked Area ===\n";
-    returnMap["Jaccard_Overall"] = similarityFilter->GetUnionOverlap();
-    returnMap["Dice_Overall"] = similarityFilter->GetMeanOverlap();
-    returnMap["VolumeSimilarity_Overall"] = similarityFilter->GetVolumeSimilarity();
-    returnMap["FalseNegativeError_Overall"] = similarityFilter->GetFalseNegativeError();
-    returnMap["FalsePositiveError_Overall"] = similarityFilter->GetFalsePositiveError();
+    for (const auto &measure : cbica::GetOverlapMeasures(overallCounts))
+    {
+      returnMap[measure.first + "_Overall"] = measure.second;
+    }
 
     if (uniqueLabels.size() > 2) // basically if there is something more than 0 and 1
     {
-      //std::cout << "=== Individual Labels ===\n";
-      //std::cout << "Property,Value\n";
       for (size_t i = 0; i < uniqueLabels.size(); i++)
       {
-        auto uniqueLabels_string = std::to_string(uniqueLabels[i]);
-        returnMap["Overlap_Label" + uniqueLabels_string] = similarityFilter->GetTargetOverlap(uniqueLabels[i]);
-        returnMap["Jaccard_Label" + uniqueLabels_string] = similarityFilter->GetUnionOverlap(uniqueLabels[i]);
-        returnMap["Dice_Label" + uniqueLabels_string] = similarityFilter->GetMeanOverlap(uniqueLabels[i]);
-        returnMap["VolumeSimilarity_Label" + uniqueLabels_string] = similarityFilter->GetVolumeSimilarity(uniqueLabels[i]);
-        returnMap["FalseNegativeError_Label" + uniqueLabels_string] = similarityFilter->GetFalseNegativeError(uniqueLabels[i]);
-        returnMap["FalsePositiveError_Label" + uniqueLabels_string] = similarityFilter->GetFalsePositiveError(uniqueLabels[i]);
+        auto uniqueLabels_string = std::to_string(static_cast< typename TImageType::PixelType >(uniqueLabels[i]));
+        for (const auto &measure : cbica::GetOverlapMeasures(labelCounts[uniqueLabels[i]]))
+        {
+          returnMap[measure.first + "_Label" + uniqueLabels_string] = measure.second;
+        }
       }
     }
 
+    const std::vector< std::string > rocMetrics = { "Sensitivity", "Specificity", "Accuracy", "Precision" };
+
     // overall stats
     {
-      auto temp_roc = GetSensitivityAndSpecificity< TImageType >(inputLabel_1, inputLabel_2);
+      auto temp_roc = cbica::ROC_Values(labelTable.GetConfusionMatrixCounts(1));
 
-      for (const auto &metric : temp_roc)
+      for (const auto &metric : rocMetrics)
       {
-        returnMap[metric.first + "_Overall"] = metric.second;
+        returnMap[metric + "_Overall"] = temp_roc[metric];
       }
 
-      returnMap["Hausdorff95_Overall"] = GetHausdorffDistance< TImageType >(inputLabel_1, inputLabel_2, 0.95);
+      returnMap["Hausdorff95_Overall"] = GetHausdorffDistance< TImageType >(croppedLabel_1, croppedLabel_2, 0.95);
     }
 
-    auto inputLabelsImages_1 = GetUniqueLabelImagessFromImage< TImageType >(inputLabel_1);
-    auto inputLabelsImages_2 = GetUniqueLabelImagessFromImage< TImageType >(inputLabel_2);
-    
-    for (const auto &label : inputLabelsImages_1)
+    for (const auto &label : labelCounts)
     {
       if (label.first != 0) // we don't care about the background value
       {
-        auto valueString = std::to_string(label.first);
+        auto valueString = std::to_string(static_cast< int >(label.first));
 
-        auto temp_roc = GetSensitivityAndSpecificity< TImageType >(label.second, inputLabelsImages_2[label.first]);
+        auto temp_roc = cbica::ROC_Values(label.second);
 
-        for (const auto &metric : temp_roc)
+        for (const auto &metric : rocMetrics)
         {
-          returnMap[metric.first + "_" + valueString] = metric.second;
+          returnMap[metric + "_" + valueString] = temp_roc[metric];
         }
 
-        returnMap["Hausdorff95_" + valueString] = GetHausdorffDistance< TImageType >(label.second, inputLabelsImages_2[label.first], 0.95);
+        // only the masks of the current label are kept in memory
+        returnMap["Hausdorff95_" + valueString] = GetHausdorffDistance< TImageType >(
+          GetBinaryMaskFromLabels< TImageType >(croppedLabel_1, { label.first }),
+          GetBinaryMaskFromLabels< TImageType >(croppedLabel_2, { label.first }), 0.95);
       }
-
-    }    
+    }
 
     return returnMap;
   }
@@ -1824,6 +2565,11 @@ namespace cbica
 
   Requires the following labesl to be initialized in both masks, otherwise the estimate is given as '0': 1,2,4
 
+  The overlap, sensitivity and specificity of the individual labels and the composite regions (TC = NET + ET, 
+  WT = TC + ED) are all derived from a single co-occurrence table of the 2 label images. The 95th percentile Hausdorff 
+  distance of the regions is computed in memory using GetHausdorffDistance(). All metrics are computed 
+  on the bounding box of the labels (see GetNonZeroBoundingRegion()).
+
   \param inputLabel_1 The first brain label file
   \param inputLabel_2 The second brain label file
   \return Map of various statistics and corresponding values
@@ -1838,285 +2584,97 @@ namespace cbica
       double > > // the value
       returnMap;
 
-    auto uniqueLabels = GetUniqueValuesInImage< TImageType >(inputLabel_1);
-    auto uniqueLabelsRef = GetUniqueValuesInImage< TImageType >(inputLabel_2);
-
-    ///// this is not needed as we need to generate stats for all the BraTS values regardless
-    //// sanity check
-    //if (uniqueLabels.size() != uniqueLabelsRef.size())
-    //{
-    //  std::cerr << "The number of unique labels in input and reference image are not consistent.\n";
-    //  return returnMap;
-    //}
-    //else
-    //{
-    //  for (size_t i = 0; i < uniqueLabels.size(); i++)
-    //  {
-    //    if (uniqueLabels[i] != uniqueLabelsRef[i])
-    //    {
-    //      std::cerr << "The label values in input and reference image are not consistent.\n";
-    //      return returnMap;
-    //    }
-    //  }
-    //}
-
-    // remove background
-    uniqueLabels.erase(uniqueLabels.begin());
-    uniqueLabelsRef.erase(uniqueLabelsRef.begin());
-
-    const std::vector< int > bratsValues = { 1,2,4 };
-    std::map< int, std::string > bratsLabels;
-    bratsLabels[1] = "NET";
-    bratsLabels[2] = "ED";
-    bratsLabels[4] = "ET";
-    std::vector< int > missingLabels, missingLabelsRef;
-
-    // check brats labels and populate missing labels to 
-    for (size_t i = 0; i < bratsValues.size(); i++)
-    {
-      if (std::find(uniqueLabels.begin(), uniqueLabels.end(), bratsValues[i]) == uniqueLabels.end())
-      {
-        // std::cerr << "Missing BraTS label in Label_1: " << bratsValues[i] << "\n";
-        missingLabels.push_back(bratsValues[i]);
-      }
-      if (std::find(uniqueLabelsRef.begin(), uniqueLabelsRef.end(), bratsValues[i]) == uniqueLabelsRef.end())
-      {
-        // std::cerr << "Missing BraTS label in Label_2: " << bratsValues[i] << "\n";
-        missingLabelsRef.push_back(bratsValues[i]);
-      }
-    }
-
-    auto inputLabelsImages_1 = GetUniqueLabelImagessFromImage< TImageType >(inputLabel_1);
-    auto inputLabelsImages_2 = GetUniqueLabelImagessFromImage< TImageType >(inputLabel_2);
-
-    // erase background label
-    inputLabelsImages_1.erase(inputLabelsImages_1.find(0));
-    inputLabelsImages_2.erase(inputLabelsImages_2.find(0));
-
-    // populate empty masks for the missing labels
-    for (size_t i = 0; i < missingLabels.size(); i++)
-    {
-      inputLabelsImages_1[missingLabels[i]] = CreateImage< TImageType >(inputLabel_1);
-    }
-    for (size_t i = 0; i < missingLabelsRef.size(); i++)
+    // all metrics are computed around the labels; the background outside is added back to the table as true negatives
+    auto regionOfInterest = GetNonZeroBoundingRegion< TImageType >(inputLabel_1, inputLabel_2);
+    typename TImageType::Pointer croppedLabel_1 = inputLabel_1, croppedLabel_2 = inputLabel_2;
+    if (regionOfInterest.GetNumberOfPixels() > 0)
     {
-      inputLabelsImages_2[missingLabelsRef[i]] = CreateImage< TImageType >(inputLabel_2);
+      croppedLabel_1 = GetCroppedImage< TImageType >(inputLabel_1, regionOfInterest);
+      croppedLabel_2 = GetCroppedImage< TImageType >(inputLabel_2, regionOfInterest);
     }
 
-    // put individual labels in a single structure for easy processing
-    std::map< std::string, typename TImageType::Pointer > regionsToCompare_1, regionsToCompare_2;
-
-    for (const auto &label : inputLabelsImages_1)
-    {
-      regionsToCompare_1[bratsLabels[label.first]] = label.second;
-    }
-    for (const auto &label : inputLabelsImages_2)
+    auto labelTable = GetLabelCooccurrence< TImageType >(croppedLabel_1, croppedLabel_2);
+    const size_t numberOfPixels = inputLabel_1->GetBufferedRegion().GetNumberOfPixels();
+    if (numberOfPixels > labelTable.total)
     {
-      regionsToCompare_2[bratsLabels[label.first]] = label.second;
+      labelTable.AddCount(0, 0, numberOfPixels - labelTable.total);
     }
 
-    // combine NET+ET to get TC and TC+ED to get WT
-    {
-      auto adder_1 = itk::AddImageFilter< TImageType >::New();
-      adder_1->SetInput1(regionsToCompare_1["NET"]);
-      adder_1->SetInput2(regionsToCompare_1["ET"]);
-      adder_1->Update();
-
-      auto adder_2 = itk::AddImageFilter< TImageType >::New();
-      adder_2->SetInput1(regionsToCompare_2["NET"]);
-      adder_2->SetInput2(regionsToCompare_2["ET"]);
-      adder_2->Update();
-
-      regionsToCompare_1["TC"] = adder_1->GetOutput();
-      regionsToCompare_1["TC"]->DisconnectPipeline();
-
-      regionsToCompare_2["TC"] = adder_2->GetOutput();
-      regionsToCompare_2["TC"]->DisconnectPipeline();
+    // the BraTS regions and the labels that make them up; missing labels in either image simply have no counts
+    std::map< std::string, std::vector< double > > regionsToCompare;
+    regionsToCompare["NET"] = { 1 };
+    regionsToCompare["ED"] = { 2 };
+    regionsToCompare["ET"] = { 4 };
+    regionsToCompare["TC"] = { 1, 4 };
+    regionsToCompare["WT"] = { 1, 2, 4 };
 
-
-      auto adder_1_WT = itk::AddImageFilter< TImageType >::New();
-      adder_1_WT->SetInput1(regionsToCompare_1["ED"]);
-      adder_1_WT->SetInput2(regionsToCompare_1["TC"]);
-      adder_1_WT->Update();
-
-      auto adder_2_WT = itk::AddImageFilter< TImageType >::New();
-      adder_2_WT->SetInput1(regionsToCompare_2["ED"]);
-      adder_2_WT->SetInput2(regionsToCompare_2["TC"]);
-      adder_2_WT->Update();
-
-      regionsToCompare_1["WT"] = adder_1_WT->GetOutput();
-      regionsToCompare_1["WT"]->DisconnectPipeline();
-
-      regionsToCompare_2["WT"] = adder_2_WT->GetOutput();
-      regionsToCompare_2["WT"]->DisconnectPipeline();
-    }
+    const std::vector< std::string > rocMetrics = { "Sensitivity", "Specificity", "Accuracy", "Precision" };
 
     // iterate over all regions (including missing brats regions in either image) and populate statistics
-    for (const auto &region : regionsToCompare_1)
+    for (const auto &region : regionsToCompare)
     {
       auto labelString = region.first; // the label for stats
-      if (!labelString.empty())
-      {
-        // get the images to compare up front
-        auto imageToCompare_1 = region.second;
-        auto imageToCompare_2 = regionsToCompare_2[labelString];
-
-        // in case one of the labels is missing, just put something
-        auto stats_1 = itk::StatisticsImageFilter< TImageType >::New();
-        stats_1->SetInput(imageToCompare_1);
-        stats_1->Update();
-        auto max_1 = stats_1->GetMaximum();
-        auto stats_2 = itk::StatisticsImageFilter< TImageType >::New();
-        stats_2->SetInput(imageToCompare_2);
-        stats_2->Update();
-        auto max_2 = stats_2->GetMaximum();
-
-        auto similarityFilter = itk::LabelOverlapMeasuresImageFilter< TImageType >::New();
-
-        similarityFilter->SetSourceImage(imageToCompare_1);
-        similarityFilter->SetTargetImage(imageToCompare_2);
-        similarityFilter->Update();
-
-        returnMap[labelString]["Overlap"] = similarityFilter->GetTotalOverlap();
-        returnMap[labelString]["Jaccard"] = similarityFilter->GetUnionOverlap();
-        returnMap[labelString]["Dice"] = similarityFilter->GetMeanOverlap();
-        if (std::isinf(returnMap[labelString]["Dice"]))
-        {
-          // this happens in the case where there is a label missing in both the reference and input annotations
-          returnMap[labelString]["Dice"] = 1;
-        }
-        returnMap[labelString]["VolumeSimilarity"] = similarityFilter->GetVolumeSimilarity();
-        returnMap[labelString]["FalseNegativeError"] = similarityFilter->GetFalseNegativeError();
-        returnMap[labelString]["FalsePositiveError"] = similarityFilter->GetFalsePositiveError();
+      auto regionCounts = labelTable.GetRegionCounts(region.second);
 
-        auto temp_roc = GetSensitivityAndSpecificity< TImageType >(imageToCompare_1, imageToCompare_2);
+      // in case one of the labels is missing, just put something
+      const bool max_1 = (regionCounts.RP > 0), max_2 = (regionCounts.PP > 0);
 
-        for (const auto &metric : temp_roc)
-        {
-          returnMap[labelString][metric.first] = metric.second;
-        }
+      auto overlapMeasures = cbica::GetOverlapMeasures(regionCounts);
+      for (const auto &measure : overlapMeasures)
+      {
+        returnMap[labelString][measure.first] = measure.second;
+      }
 
-        if ((max_1 == 0) && (max_2 == 0))
-        {
-          returnMap[labelString]["Sensitivity"] = 1;
-          returnMap[labelString]["Specificity"] = 1;
-        }
-        if (std::isnan(returnMap[labelString]["Sensitivity"]))
+      auto temp_roc = cbica::ROC_Values(regionCounts);
+      for (const auto &metric : rocMetrics)
+      {
+        returnMap[labelString][metric] = temp_roc[metric];
+      }
+
+      if (!max_1 && !max_2)
+      {
+        returnMap[labelString]["Sensitivity"] = 1;
+        returnMap[labelString]["Specificity"] = 1;
+      }
+      if (std::isnan(returnMap[labelString]["Sensitivity"]))
+      {
+        if (max_1 != max_2)
         {
-          if (max_1 != max_2)
-          {
-            returnMap[labelString]["Sensitivity"] = 0;
-          }
-          else
-          {
-            returnMap[labelString]["Sensitivity"] = 1;
-          }
+          returnMap[labelString]["Sensitivity"] = 0;
         }
-        if (std::isinf(returnMap[labelString]["Sensitivity"]))
+        else
         {
           returnMap[labelString]["Sensitivity"] = 1;
         }
+      }
+      if (std::isinf(returnMap[labelString]["Sensitivity"]))
+      {
+        returnMap[labelString]["Sensitivity"] = 1;
+      }
 
-        /// not used till implementation gets standardized
-        //returnMap[labelString]["Hausdorff95"] = GetHausdorffDistance< TImageType >(imageToCompare_1, imageToCompare_2, 0.95);
-        //returnMap[labelString]["Hausdorff99"] = GetHausdorffDistance< TImageType >(imageToCompare_1, imageToCompare_2, 0.99);
-        bool hausdorffFound = true;
-        std::string hausdorffExe = cbica::getExecutablePath() + "/Hausdorff95"
-#if WIN32
-          + ".exe"
-#endif
-          ;
-        if (!cbica::isFile(hausdorffExe))
-        {
-          hausdorffExe = cbica::getExecutablePath() + "../hausdorff95/Hausdorff95"
-#if WIN32
-            + ".exe"
-#endif
-            ;
-          if (!cbica::isFile(hausdorffExe))
-          {
-            std::cerr << "Could not find Hausdorff95 executable, so not computing this metric.\n";
-            hausdorffFound = false;
-          }
-        }
+      // the Hausdorff distance is computed in memory on the masks of the current region only; the regions run one after 
+      // the other, since the distance filters are already multi-threaded
+      double hausdorffDistance = 0; // correct prediction for missing label
+      if (max_1 != max_2)
+      {
+        // this is the case where one of the labels is missing
+        hausdorffDistance = NAN;
+      }
+      else if (max_1 && max_2)
+      {
+        hausdorffDistance = GetHausdorffDistance< TImageType >(
+          GetBinaryMaskFromLabels< TImageType >(croppedLabel_1, region.second),
+          GetBinaryMaskFromLabels< TImageType >(croppedLabel_2, region.second), 0.95);
+      }
 
-        if (hausdorffFound)
-        {
-          if ((max_1 == 0) || (max_2 == 0))
-          {
-            // this is the case where one of the labels is missing
-            returnMap[labelString]["Hausdorff95"] = NAN;
-          }
-          else
-          {
-            auto tempDir = cbica::createTmpDir();
-            auto file_1 = tempDir + "/mask_1.nii.gz";
-            auto file_2 = tempDir + "/mask_2.nii.gz";
-            auto writer = itk::ImageFileWriter< TImageType >::New();
-            writer->SetInput(imageToCompare_1);
-            writer->SetFileName(file_1);
-            try
-            {
-              writer->Write();
-            }
-            catch (itk::ExceptionObject &e)
-            {
-              std::cerr << "Error occurred while trying to write the image '" << file_1 << "': " << e.what() << "\n";
-            }
-            writer->SetInput(imageToCompare_2);
-            writer->SetFileName(file_2);
-            try
-            {
-              writer->Write();
-            }
-            catch (itk::ExceptionObject &e)
-            {
-              std::cerr << "Error occurred while trying to write the image '" << file_2 << "': " << e.what() << "\n";
-            }
-            std::array< char, 128 > buffer;
-            std::string result;
-            FILE *pPipe;
-#if WIN32
-#define POPEN _popen
-#define PCLOSE _pclose
-#else
-#define POPEN popen
-#define PCLOSE pclose
-#endif
-            pPipe = POPEN((hausdorffExe + " -gt " + file_1 + " -m " + file_2).c_str(), "r");
-            if (!pPipe)
-            {
-              std::cerr << "Couldn't start command.\n";
-            }
-            while (fgets(buffer.data(), 128, pPipe) != NULL)
-            {
-              result += buffer.data();
-            }
-            auto returnCode = PCLOSE(pPipe);
-            // remove "\n"
-            result.pop_back();
-            result.pop_back();
-            returnMap[labelString]["Hausdorff95"] = std::atof(result.c_str());
-            cbica::removeDirectoryRecursively(tempDir, true);
-          }
-          // in case a label is not defined, use the longest diagonal
-          if (std::isnan(returnMap[labelString]["Hausdorff95"]) || std::isinf(returnMap[labelString]["Hausdorff95"]))
-          {
-            // correct prediction for missing label
-            if ((max_1 == 0) && (max_2 == 0))
-            {
-              returnMap[labelString]["Hausdorff95"] = 0;
-            }
-            else
-            {
-              auto size = imageToCompare_1->GetLargestPossibleRegion().GetSize();
-              auto diag_plane_squared = std::pow(size[0], 2) + std::pow(size[1], 2);
-              auto diag_cube = std::sqrt(std::pow(size[2], 2) + diag_plane_squared);
-              returnMap[labelString]["Hausdorff95"] = diag_cube;
-            }
-          }
-        } // end hausdorff found
-      } // end labelString check
+      // in case a label is not defined, use the longest diagonal
+      if (std::isnan(hausdorffDistance) || std::isinf(hausdorffDistance))
+      {
+        auto size = inputLabel_1->GetLargestPossibleRegion().GetSize();
+        auto diag_plane_squared = std::pow(size[0], 2) + std::pow(size[1], 2);
+        hausdorffDistance = std::sqrt(std::pow(size[2], 2) + diag_plane_squared);
+      }
+      returnMap[labelString]["Hausdorff95"] = hausdorffDistance;
     }
 
     return returnMap;
@@ -20,6 +20,11 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
 #include "itkArray.h"
 #include "vnl/vnl_vector.h"
 #include "itkProgressReporter.h"
+#include "cbicaTensorScalars.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
 #include "itkDiffusionTensor3DReconstructionImageFilter.h"
 
@@ -40,11 +45,12 @@ namespace itk
     m_Threshold = NumericTraits< ReferencePixelType >::min();
     m_GradientImageTypeEnumeration = Else;
     m_GradientDirectionContainer = NULL;
-    m_TensorBasis.set_identity();
-    m_TensorBasisInverse.set_identity();
     m_BValue = 1.0;
     //~ m_CalculateResidualImage = false;
     m_CalculateResidualImage = true;
+    m_CalculateBaselineImage = false;
+    m_FittingMode = OrdinaryLeastSquares;
+    m_NumberOfIterations = 3;
   }
 
 
@@ -94,14 +100,25 @@ namespace itk
       std::cerr << "Done Allocating Residue Image" << std::endl;
     }
 
+    //Initialize the baseline (S0) image if we are going to calculate it.
+    if (m_CalculateBaselineImage)
+    {
+      m_BaselineImage = ReferenceImageType::New();
+      m_BaselineImage->CopyInformation(this->ProcessObject::GetInput(0));
+      m_BaselineImage->SetRegions(m_BaselineImage->GetLargestPossibleRegion() );
+      m_BaselineImage->Allocate();
+    }
+
     this->ComputeTensorBasis();
   }
 
 
-  // POTENTIAL WARNING:
-  //
-  // Until we fix netlib svd routines, we will need to set the number of thread
-  // to 1.
+  // Voxels are processed in tiles: the log signals of a tile are gathered into a
+  // [gradients x voxels] matrix and all of its tensors are solved with a single
+  // product against the pseudo-inverse computed in BeforeThreadedGenerateData().
+  // The fitted signals for the residuals come from a second product and the
+  // baseline (S0) image is written in the same pass. Only read-only members are
+  // shared, so it is safe to run with any number of threads.
   template< class TReferenceImagePixelType,
             class TGradientImagePixelType, class TTensorPixelType >
   void DiffusionTensor3DReconstructionImageFilter< TReferenceImagePixelType,
@@ -111,355 +128,330 @@ namespace itk
   {
     typename OutputImageType::Pointer outputImage =
               static_cast< OutputImageType * >(this->ProcessObject::GetOutput(0));
+    TensorPixelType *outputBuffer = outputImage->GetBufferPointer();
+    const ImageBase< 3 > *inputImage = static_cast< const ImageBase< 3 > * >(this->ProcessObject::GetInput(0));
+    const unsigned int numberOfGradients = m_NumberOfGradientDirections;
 
-    ImageRegionIterator< OutputImageType > oit(outputImage, outputRegionForThread);
-    oit.GoToBegin();
-
-    ImageRegionIterator< ResidualImageType > rit;
-  
-    //if we are calculateing the Residual set up an iterator...
-    if (m_CalculateResidualImage)
-    {
-      rit = ImageRegionIterator< ResidualImageType >( m_ResidualImage, outputRegionForThread);
-      rit.GoToBegin();
-    }
-
-    vnl_vector<double> B(m_NumberOfGradientDirections);
-    vnl_vector<double> D(6);
-
-    // Support for progress methods/callbacks
-    ProgressReporter progress(this, threadId, outputRegionForThread.GetNumberOfPixels());
-
-    // Two cases here .
-    // 1. If the Gradients have been specified in multiple images, we will create
-    // 'n' iterators for each of the gradient images and solve the Stejskal-Tanner
-    // equations for every pixel.
+    // Two cases here, which only differ in where the signals of a voxel are read from.
+    // 1. If the Gradients have been specified in multiple images, each gradient
+    // has its own buffer and the reference image holds the baseline.
     // 2. If the Gradients have been specified in a single multi-component image,
-    // one iterator will suffice to do the same.
-
+    // the components of a voxel are contiguous and the baselines are averaged.
+    const ReferencePixelType *referenceBuffer = NULL;
+    std::vector< const GradientImageType * > gradientImages;
+    std::vector< const GradientPixelType * > gradientBuffers;
+    const GradientPixelType *vectorBuffer = NULL;
+    OffsetValueType vectorLength = 1;
+    std::vector< unsigned int > baselineind, gradientind;
     if( m_GradientImageTypeEnumeration == GradientIsInManyImages )
       {
-      ImageRegionConstIteratorWithIndex< ReferenceImageType >
-        it(static_cast< ReferenceImageType * >(this->ProcessObject::GetInput(0)),
-           outputRegionForThread);
-        it.GoToBegin();
-
-      typedef ImageRegionConstIterator< GradientImageType > GradientIteratorType;
-      std::vector< GradientIteratorType * > gradientItContainer;
-
-      for( unsigned int i = 1; i<= m_NumberOfGradientDirections; i++ )
-        {
-        typename GradientImageType::Pointer gradientImagePointer = NULL;
-
-        // Would have liked a dynamic_cast here, but seems SGI doesn't like it
-        // The enum will ensure that an inappropriate cast is not done
-        gradientImagePointer = static_cast< GradientImageType * >(
-                                  this->ProcessObject::GetInput(i) );
-
-        GradientIteratorType *git = new GradientIteratorType(
-                            gradientImagePointer, outputRegionForThread );
-        git->GoToBegin();
-        gradientItContainer.push_back(git);
-        }
-
-      // Iterate over the reference and gradient images and solve the steskal
-      // equations to reconstruct the Diffusion tensor.
-      // See splweb.bwh.harvard.edu:8000/pages/papers/westin/ISMRM2002.pdf
-      // "A Dual Tensor Basis Solution to the Stejskal-Tanner Equations for DT-MRI"
-
-      while( !it.IsAtEnd() )
-        {
-
-        TensorPixelType tensor(0.0);
-
-        //If we aren't in the mask move on!
-        if ( this->m_ImageMask )
+      referenceBuffer = static_cast< const ReferenceImageType * >(inputImage)->GetBufferPointer();
+      for( unsigned int i = 1; i <= numberOfGradients; i++ )
         {
-          typename ReferenceImageType::IndexType index = it.GetIndex();
-          typename ReferenceImageType::PointType inputPoint;
-          (static_cast< ReferenceImageType * >
-            (this->ProcessObject::GetInput(0)))
-              ->TransformIndexToPhysicalPoint( index, inputPoint );
-
-          if ( !this->m_ImageMask->IsInside( inputPoint ) )
-          {
-            oit.Set( tensor );
-            ++oit;
-            ++it;
-            //Iterate all the gradient iterators
-            for( unsigned int i = 0; i< m_NumberOfGradientDirections; i++ )
-            {
-              ++(*gradientItContainer[i]);
-            }
-          
-            //iterate the residue iterator
-            if (m_CalculateResidualImage)
-            {
-              ++rit;
-            }
-
-            progress.CompletedPixel();
-            continue;
-          }
+        gradientImages.push_back( static_cast< const GradientImageType * >(this->ProcessObject::GetInput(i)) );
+        gradientBuffers.push_back( gradientImages.back()->GetBufferPointer() );
         }
-        ReferencePixelType b0 = it.Get();
-
-        if( (b0 != 0) && (b0 >= m_Threshold) )
+      }
+    else if( m_GradientImageTypeEnumeration == GradientIsInASingleImage )
+      {
+      const GradientImagesType *gradientImagePointer = static_cast< const GradientImagesType * >(inputImage);
+      vectorBuffer = gradientImagePointer->GetBufferPointer();
+      vectorLength = gradientImagePointer->GetNumberOfComponentsPerPixel();
+      for(GradientDirectionContainerType::ConstIterator gdcit = this->m_GradientDirectionContainer->Begin();
+          gdcit != this->m_GradientDirectionContainer->End(); ++gdcit)
         {
-          for( unsigned int i = 0; i< m_NumberOfGradientDirections; i++ )
-          {
-            GradientPixelType b = gradientItContainer[i]->Get();
-
-            if( b == 0 )
-            {
-              B[i] = 0;
-            }
-            else
-            {
-              B[i] = -log( static_cast<double>(b) / static_cast<double>(b0) )/this->m_BValue;
-            }
-
-            ++(*gradientItContainer[i]);
-          }
-
-          //vnl_svd< double > pseudoInverseSolver( m_TensorBasis );
-          if( m_NumberOfGradientDirections > 6 )
+        if(gdcit.Value().one_norm() <= 0.0)
           {
-  //          D = pseudoInverseSolver.solve( m_BMatrix * B );
-            D =  m_TensorBasisInverse * ( m_BMatrix * B );
+          baselineind.push_back(gdcit.Index());
           }
-          else
+        else
           {
-  //          D = pseudoInverseSolver.solve( B );
-            D =  m_TensorBasisInverse *  B;
+          gradientind.push_back(gdcit.Index());
           }
+        }
+      }
+    else
+      {
+      return;
+      }
 
-          tensor(0,0) = D[0];
-          tensor(0,1) = D[1];
-          tensor(0,2) = D[2];
-          tensor(1,1) = D[3];
-          tensor(1,2) = D[4];
-          tensor(2,2) = D[5];
-
-         //CHECK FOR SPD
-          TensorEigenValuesType     lambda;
-          TensorEigenVectorsType    eigenVectors;
-
-          tensor.ComputeEigenAnalysis(lambda, eigenVectors);
-          bool tensorIsNotSpd = false;
-          //Check all the eigenvalues
-          for (unsigned int r=0; r<3; ++r)
+    // the residual and baseline images share the geometry of the first input
+    const ImageBase< 3 > *auxiliaryImage = m_CalculateResidualImage ?
+      static_cast< const ImageBase< 3 > * >(m_ResidualImage.GetPointer()) : static_cast< const ImageBase< 3 > * >(m_BaselineImage.GetPointer());
+    GradientPixelType *residualBuffer = m_CalculateResidualImage ? m_ResidualImage->GetBufferPointer() : NULL;
+    ReferencePixelType *baselineBuffer = m_CalculateBaselineImage ? m_BaselineImage->GetBufferPointer() : NULL;
+
+    // per-thread tile storage, allocated once
+    const unsigned int tileSize = 256;
+    Eigen::MatrixXd logSignals(numberOfGradients, tileSize), fittedSignals;
+    // scratch for the weighted fits
+    const bool isWeighted = ( m_FittingMode != OrdinaryLeastSquares );
+    Eigen::MatrixXd signals, weights, normalMatrices, rightHandSides;
+    std::vector< double > absoluteResiduals;
+    if( isWeighted )
+      {
+      signals.resize(numberOfGradients, tileSize);
+      weights.resize(numberOfGradients, tileSize);
+      absoluteResiduals.reserve(numberOfGradients);
+      }
+    Eigen::Matrix< double, 6, Eigen::Dynamic > tensors(6, tileSize);
+    std::vector< OffsetValueType > outputOffsets(tileSize), auxiliaryOffsets(tileSize);
+    std::vector< double > baselines(tileSize);
+    std::vector< char > isValid(tileSize);
+    std::vector< OffsetValueType > gradientLineOffsets(gradientImages.size());
+    unsigned int tileCount = 0;
+
+    auto solveTile = [&]()
+    {
+      tensors.leftCols(tileCount).noalias() = m_PseudoInverse * logSignals.leftCols(tileCount);
+      if( isWeighted )
+        {
+        // 1 weighted fit, followed by the robust reweightings for IRLS
+        const unsigned int numberOfFits = 1 +
+          ( ( m_FittingMode == IterativelyReweightedLeastSquares ) ? m_NumberOfIterations : 0 );
+        for( unsigned int fit = 0; fit < numberOfFits; fit++ )
           {
-            if (lambda[r] <= 0)
+          fittedSignals.noalias() = m_DesignMatrix * tensors.leftCols(tileCount);
+          for( unsigned int v = 0; v < tileCount; v++ )
             {
-              tensorIsNotSpd = true;
-              lambda[r] = -lambda[r];
+            this->ComputeFittingWeights( signals.col(v), logSignals.col(v), fittedSignals.col(v), baselines[v],
+              isValid[v] && ( fit > 0 ), weights.col(v), absoluteResiduals );
             }
-          }
+          normalMatrices.noalias() = m_DesignOuterProducts * weights.leftCols(tileCount);
+          rightHandSides.noalias() = m_DesignMatrix.transpose() *
+            weights.leftCols(tileCount).cwiseProduct( logSignals.leftCols(tileCount) );
 
-          //if its notSPD then reconstitue the tensor..
-          if (tensorIsNotSpd)
-          {
-            TensorMatrixType  diag;
-            for (unsigned int r=0; r<3; ++r)
+          for( unsigned int v = 0; v < tileCount; v++ )
             {
-              diag[r][r] = lambda[r];
+            if( !isValid[v] )
+              {
+              continue;
+              }
+            Eigen::Matrix< double, 6, 6 > normalMatrix;
+            unsigned int packed = 0;
+            for( unsigned int r = 0; r < 6; r++ )
+              {
+              for( unsigned int c = r; c < 6; c++ )
+                {
+                normalMatrix(r, c) = normalMatrix(c, r) = normalMatrices(packed++, v);
+                }
+              }
+            // keep the previous fit if there are not enough weighted measurements
+            Eigen::LDLT< Eigen::Matrix< double, 6, 6 > > solver(normalMatrix);
+            if( ( solver.info() == Eigen::Success ) && solver.isPositive() && ( solver.rcond() > 1e-12 ) )
+              {
+              tensors.col(v) = solver.solve( rightHandSides.col(v) );
+              }
             }
-
-            TensorMatrixType tmp
-              = (static_cast<TensorMatrixType>(eigenVectors.GetTranspose()) ) * (diag * eigenVectors);
-
-            tensor[0] = tmp[0][0];
-            tensor[1] = tmp[0][1];
-            tensor[2] = tmp[0][2];
-            tensor[3] = tmp[1][1];
-            tensor[4] = tmp[1][2];
-            tensor[5] = tmp[2][2];
           }
         }
-        else
+      for( unsigned int v = 0; v < tileCount; v++ )
+        {
+        TensorPixelType tensor(0.0);
+        if( isValid[v] )
           {
-          for( unsigned int i = 0; i< m_NumberOfGradientDirections; i++ )
+          for( unsigned int k = 0; k < 6; k++ )
             {
-            ++(*gradientItContainer[i]);
+            tensor[k] = tensors(k, v);
             }
+          this->MakeTensorPositiveDefinite(tensor);
           }
-        if (m_CalculateResidualImage)
-        {
-          rit.Set( ComputeResidual( B, tensor, static_cast<double>(b0) ) );
-          ++rit;
-        }
-        oit.Set( tensor );
-        ++oit;
-        ++it;
-        progress.CompletedPixel();
-        }
-
-      for( unsigned int i = 0; i< gradientItContainer.size(); i++ )
-        {
-        delete gradientItContainer[i];
-        }
-      }
-    // The gradients are specified in a single multi-component image
-    else if( m_GradientImageTypeEnumeration == GradientIsInASingleImage )
-      {
-      typedef ImageRegionConstIteratorWithIndex< GradientImagesType > GradientIteratorType;
-      typedef typename GradientImagesType::PixelType         GradientVectorType;
-      typename GradientImagesType::Pointer gradientImagePointer = NULL;
-
-      // Would have liked a dynamic_cast here, but seems SGI doesn't like it
-      // The enum will ensure that an inappropriate cast is not done
-      gradientImagePointer = static_cast< GradientImagesType * >(
-                                this->ProcessObject::GetInput(0) );
-
-      GradientIteratorType git(gradientImagePointer, outputRegionForThread );
-      git.GoToBegin();
-
-      // Compute the indicies of the baseline images and gradient images
-      std::vector<unsigned int> baselineind; // contains the indicies of
-                                             // the baseline images
-      std::vector<unsigned int> gradientind; // contains the indicies of
-                                             // the gradient images
-
-      for(GradientDirectionContainerType::ConstIterator gdcit = this->m_GradientDirectionContainer->Begin();
-          gdcit != this->m_GradientDirectionContainer->End(); ++gdcit)
-        {
-        if(gdcit.Value().one_norm() <= 0.0)
+        // the residuals are computed from the corrected tensor
+        for( unsigned int k = 0; k < 6; k++ )
           {
-          baselineind.push_back(gdcit.Index());
+          tensors(k, v) = tensor[k];
           }
-        else
+        outputBuffer[outputOffsets[v]] = tensor;
+        if( baselineBuffer )
           {
-          gradientind.push_back(gdcit.Index());
+          baselineBuffer[auxiliaryOffsets[v]] = static_cast< ReferencePixelType >(baselines[v]);
           }
         }
 
-      while( !git.IsAtEnd() )
-        {
-        TensorPixelType tensor(0.0);
-
-        //If we aren't in the mask move on!
-        if ( this->m_ImageMask )
+      if( residualBuffer )
         {
-          typename GradientImagesType::IndexType index = git.GetIndex();
-          typename GradientImagesType::PointType inputPoint;
-          gradientImagePointer->TransformIndexToPhysicalPoint( index, inputPoint );
-
-          if ( !this->m_ImageMask->IsInside( inputPoint ) )
+        fittedSignals.noalias() = m_DesignMatrix * tensors.leftCols(tileCount);
+        for( unsigned int v = 0; v < tileCount; v++ )
           {
-            oit.Set( tensor );
-            ++oit;
-            ++git;
-            //iterate the residue iterator
-            if (m_CalculateResidualImage)
+          GradientPixelType *residual = residualBuffer + auxiliaryOffsets[v] * numberOfGradients;
+          for( unsigned int i = 0; i < numberOfGradients; i++ )
             {
-              ++rit;
+            residual[i] = static_cast< GradientPixelType >( baselines[v] *
+              ( std::exp( -logSignals(i, v) * this->m_BValue ) - std::exp( -fittedSignals(i, v) * this->m_BValue ) ) );
             }
-
-            progress.CompletedPixel();
-            continue;
           }
         }
+      tileCount = 0;
+    };
 
-        GradientVectorType b = git.Get();
-
-        typename NumericTraits<ReferencePixelType>::AccumulateType b0 = NumericTraits<ReferencePixelType>::Zero;
+    // Support for progress methods/callbacks
+    ProgressReporter progress(this, threadId, outputRegionForThread.GetNumberOfPixels());
 
-        // Average the baseline image pixels
-        for(unsigned int i = 0; i < baselineind.size(); ++i)
+    const typename OutputImageRegionType::SizeType regionSize = outputRegionForThread.GetSize();
+    typename OutputImageType::IndexType lineStart = outputRegionForThread.GetIndex();
+    for( SizeValueType z = 0; z < regionSize[2]; z++ )
+      {
+      for( SizeValueType y = 0; y < regionSize[1]; y++ )
+        {
+        lineStart[1] = outputRegionForThread.GetIndex()[1] + y;
+        lineStart[2] = outputRegionForThread.GetIndex()[2] + z;
+        const OffsetValueType outputLineOffset = outputImage->ComputeOffset(lineStart);
+        const OffsetValueType inputLineOffset = inputImage->ComputeOffset(lineStart);
+        const OffsetValueType auxiliaryLineOffset = auxiliaryImage ? auxiliaryImage->ComputeOffset(lineStart) : 0;
+        for( size_t i = 0; i < gradientImages.size(); i++ )
           {
-          b0 += b[baselineind[i]];
+          gradientLineOffsets[i] = gradientImages[i]->ComputeOffset(lineStart);
           }
-        b0 /= this->m_NumberOfBaselineImages;
 
-        if( (b0 != 0) && (b0 >= m_Threshold) )
+        for( SizeValueType x = 0; x < regionSize[0]; x++ )
           {
-          for( unsigned int i = 0; i< m_NumberOfGradientDirections; i++ )
+          if( tileCount == tileSize )
             {
-            if( b[gradientind[i]] == 0 )
-              {
-              B[i] = 0;
-              }
-            else
-              {
-              B[i] = -log( static_cast<double>(b[gradientind[i]]) / static_cast<double>(b0) ) / this->m_BValue;
-              }
+            solveTile();
             }
+          const unsigned int v = tileCount++;
+          outputOffsets[v] = outputLineOffset + x;
+          auxiliaryOffsets[v] = auxiliaryLineOffset + x;
 
-  //        vnl_svd< double > pseudoInverseSolver( m_TensorBasis );
-          if( m_NumberOfGradientDirections > 6 )
+          //If we aren't in the mask move on!
+          bool isInside = true;
+          if( this->m_ImageMask )
             {
-  //          D = pseudoInverseSolver.solve( m_BMatrix * B );
-            D = m_TensorBasisInverse * ( m_BMatrix * B );
-            }
-          else
-            {
-  //          D = pseudoInverseSolver.solve( B );
-            D = m_TensorBasisInverse * B ;
+            typename OutputImageType::IndexType index = lineStart;
+            index[0] += x;
+            typename ReferenceImageType::PointType inputPoint;
+            inputImage->TransformIndexToPhysicalPoint( index, inputPoint );
+            isInside = this->m_ImageMask->IsInside( inputPoint );
             }
 
-          tensor(0,0) = D[0];
-          tensor(0,1) = D[1];
-          tensor(0,2) = D[2];
-          tensor(1,1) = D[3];
-          tensor(1,2) = D[4];
-          tensor(2,2) = D[5];
-
-          //CHECK FOR SPD
-          TensorEigenValuesType     lambda;
-          TensorEigenVectorsType    eigenVectors;
-
-          tensor.ComputeEigenAnalysis(lambda, eigenVectors);
-          bool tensorIsNotSpd = false;
-          //Check all the eigenvalues
-          for (unsigned int r=0; r<3; ++r)
-          {
-            if (lambda[r] <= 0)
+          const OffsetValueType inputOffset = inputLineOffset + x;
+          double b0 = 0;
+          if( isInside )
             {
-              tensorIsNotSpd = true;
-              lambda[r] = -lambda[r];
+            if( referenceBuffer )
+              {
+              b0 = static_cast< double >( referenceBuffer[inputOffset] );
+              }
+            else
+              {
+              // Average the baseline image pixels in the accumulate type of the reference pixel, as before, so that
+              // integer images keep their truncated average
+              typename NumericTraits< ReferencePixelType >::AccumulateType baselineSum = NumericTraits< ReferencePixelType >::Zero;
+              for( size_t i = 0; i < baselineind.size(); i++ )
+                {
+                baselineSum += vectorBuffer[inputOffset * vectorLength + baselineind[i]];
+                }
+              baselineSum /= this->m_NumberOfBaselineImages;
+              b0 = static_cast< double >( baselineSum );
+              }
             }
-          }
+          baselines[v] = b0;
+          isValid[v] = isInside && (b0 != 0) && (b0 >= static_cast< double >(m_Threshold));
 
-          //if its notSPD then reconstitue the tensor..
-          if (tensorIsNotSpd)
-          {
-            TensorMatrixType  diag;
-            for (unsigned int r=0; r<3; ++r)
+          for( unsigned int i = 0; i < numberOfGradients; i++ )
             {
-              diag[r][r] = lambda[r];
+            double b = 0;
+            if( isValid[v] )
+              {
+              b = static_cast< double >( referenceBuffer ? gradientBuffers[i][gradientLineOffsets[i] + x] :
+                vectorBuffer[inputOffset * vectorLength + gradientind[i]] );
+              }
+            logSignals(i, v) = ( b == 0 ) ? 0 : -std::log( b / b0 ) / this->m_BValue;
+            if( isWeighted )
+              {
+              signals(i, v) = b;
+              }
             }
+          progress.CompletedPixel();
+          }
+        }
+      }
+    if( tileCount > 0 )
+      {
+      solveTile();
+      }
+  }
 
-            TensorMatrixType tmp
-              = (static_cast<TensorMatrixType>(eigenVectors.GetTranspose()) ) * (diag * eigenVectors);
 
-            tensor[0] = tmp[0][0];
-            tensor[1] = tmp[0][1];
-            tensor[2] = tmp[0][2];
-            tensor[3] = tmp[1][1];
-            tensor[4] = tmp[1][2];
-            tensor[5] = tmp[2][2];
-          }
+  template< class TReferenceImagePixelType,
+            class TGradientImagePixelType, class TTensorPixelType >
+  void DiffusionTensor3DReconstructionImageFilter< TReferenceImagePixelType,
+    TGradientImagePixelType, TTensorPixelType >
+  ::MakeTensorPositiveDefinite( TensorPixelType &tensor ) const
+  {
+    //CHECK FOR SPD; the eigenvectors are only needed when the tensor has to be reconstituted
+    const cbica::SymmetricEigenSystem3x3 eigenValuesOnly = cbica::ComputeSymmetricEigenSystem3x3(tensor, false);
+    if ((eigenValuesOnly.eigenValues[0] > 0) && (eigenValuesOnly.eigenValues[1] > 0) && (eigenValuesOnly.eigenValues[2] > 0))
+    {
+      return;
+    }
 
-        }
-        if (m_CalculateResidualImage)
+    //its notSPD, so reconstitue the tensor from the absolute eigenvalues: V^T * |Lambda| * V, with the eigenvectors as rows of V
+    const cbica::SymmetricEigenSystem3x3 eigenSystem = cbica::ComputeSymmetricEigenSystem3x3(tensor);
+    unsigned int element = 0;
+    for (unsigned int r=0; r<3; ++r)
+    {
+      for (unsigned int c=r; c<3; ++c)
+      {
+        double value = 0;
+        for (unsigned int k=0; k<3; ++k)
         {
-          //~ ResidualPixelType res = ComputeResidual( B,tensor );
-          //~ std::cerr << res << std::endl;
-          rit.Set( ComputeResidual( B, tensor, static_cast<double>(b0) ) );
-          ++rit;
+          value += eigenSystem.eigenVectors[k][r] * std::abs(eigenSystem.eigenValues[k]) * eigenSystem.eigenVectors[k][c];
         }
-        oit.Set( tensor );
-        ++oit; // Output (reconstructed tensor image) iterator
-        ++git; // Gradient  image iterator
-        progress.CompletedPixel();
+        tensor[element++] = static_cast< typename TensorPixelType::ValueType >(value);
+      }
+    }
+  }
 
-        }
+
+  template< class TReferenceImagePixelType,
+            class TGradientImagePixelType, class TTensorPixelType >
+  template< class TSignals, class TLogSignals, class TFittedSignals, class TWeights >
+  void DiffusionTensor3DReconstructionImageFilter< TReferenceImagePixelType,
+    TGradientImagePixelType, TTensorPixelType >
+  ::ComputeFittingWeights( const TSignals &signals, const TLogSignals &logSignals, const TFittedSignals &fittedSignals,
+                           double b0, bool isRobust, TWeights weights, std::vector< double > &absoluteResiduals ) const
+  {
+    // the variance of a log signal is inversely proportional to the squared signal, for which the
+    // prediction of the current fit is used; measurements with a zero signal are left out
+    const unsigned int numberOfGradients = static_cast< unsigned int >( signals.size() );
+    for( unsigned int i = 0; i < numberOfGradients; i++ )
+      {
+      const double predictedSignal = b0 * std::exp( -fittedSignals[i] * this->m_BValue );
+      weights[i] = ( signals[i] == 0 ) ? 0 : predictedSignal * predictedSignal;
+      }
+    if( !isRobust )
+      {
+      return;
       }
 
+    // Cauchy weights on the signal residuals, scaled by their median absolute deviation
+    absoluteResiduals.clear();
+    for( unsigned int i = 0; i < numberOfGradients; i++ )
+      {
+      if( weights[i] > 0 )
+        {
+        absoluteResiduals.push_back( std::abs( std::sqrt( weights[i] ) * ( logSignals[i] - fittedSignals[i] ) * this->m_BValue ) );
+        }
+      }
+    if( absoluteResiduals.empty() )
+      {
+      return;
+      }
+    auto median = absoluteResiduals.begin() + absoluteResiduals.size() / 2;
+    std::nth_element( absoluteResiduals.begin(), median, absoluteResiduals.end() );
+    const double scale = 2.385 * 1.4826 * ( *median );
+    if( scale <= 0 )
+      {
+      return;
+      }
+    for( unsigned int i = 0; i < numberOfGradients; i++ )
+      {
+      const double residual = std::sqrt( weights[i] ) * ( logSignals[i] - fittedSignals[i] ) * this->m_BValue / scale;
+      weights[i] /= ( 1 + residual * residual );
+      }
   }
 
-
   template< class TReferenceImagePixelType,
             class TGradientImagePixelType, class TTensorPixelType >
   void DiffusionTensor3DReconstructionImageFilter< TReferenceImagePixelType,
@@ -494,20 +486,31 @@ namespace itk
       m_BMatrix[m][5] =     m_GradientDirectionContainer->ElementAt(gradientind[m])[2] * m_GradientDirectionContainer->ElementAt(gradientind[m])[2];
       }
 
-    if( m_NumberOfGradientDirections > 6 )
+    // the pseudo-inverse of the design matrix replaces the normal equations, which square its condition number;
+    // Eigen's decompositions are thread-safe, unlike the netlib routines behind vnl_svd
+    Eigen::MatrixXd designMatrix(m_NumberOfGradientDirections, 6);
+    for (unsigned int m = 0; m < m_NumberOfGradientDirections; m++)
       {
-      m_TensorBasis = m_BMatrix.transpose() * m_BMatrix;
+      for (unsigned int k = 0; k < 6; k++)
+        {
+        designMatrix(m, k) = m_BMatrix[m][k];
+        }
       }
-    else
+    const Eigen::MatrixXd pseudoInverse = designMatrix.completeOrthogonalDecomposition().pseudoInverse();
+    m_PseudoInverse = pseudoInverse;
+    m_DesignMatrix = designMatrix;
+    m_DesignOuterProducts.resize(21, m_NumberOfGradientDirections);
+    for (unsigned int m = 0; m < m_NumberOfGradientDirections; m++)
       {
-      m_TensorBasis = m_BMatrix;
+      unsigned int packed = 0;
+      for (unsigned int r = 0; r < 6; r++)
+        {
+        for (unsigned int c = r; c < 6; c++)
+          {
+          m_DesignOuterProducts(packed++, m) = designMatrix(m, r) * designMatrix(m, c);
+          }
+        }
       }
-
-    m_BMatrix.inplace_transpose();
-
-    /*Speed up*/
-    vnl_svd<double> solver(m_TensorBasis);
-    m_TensorBasisInverse = solver.inverse();
   }
 
   template< class TReferenceImagePixelType,
@@ -589,47 +592,6 @@ namespace itk
     m_GradientImageTypeEnumeration = GradientIsInASingleImage;
   }
 
-  template< class TReferenceImagePixelType,
-            class TGradientImagePixelType, class TTensorPixelType >
-  typename DiffusionTensor3DReconstructionImageFilter< TReferenceImagePixelType,TGradientImagePixelType, TTensorPixelType >::ResidualPixelType
-  DiffusionTensor3DReconstructionImageFilter< TReferenceImagePixelType,TGradientImagePixelType, TTensorPixelType >
-  ::ComputeResidual( vnl_vector<double> adc, TensorPixelType tensor, double S0)
-  {
-    ResidualPixelType res( m_NumberOfGradientDirections );
-
-    vnl_vector<double> adcFit; // the fitted adc profile!!!
-    vnl_vector<double> signal; //recreate the input signal!
-    vnl_vector_fixed<double,6> ten;
-
-    for (unsigned int i=0;i<6;++i)
-      ten[i] = tensor[i];
-
-    if( m_NumberOfGradientDirections > 6 )
-    {
-      // m_BMatrix is tranposed at the end of ComputeTensorBasis() and therefore 
-      // we need to transpose it back to the original one that is used to map
-      // 6 tensor elements to ADC values
-      adcFit = m_BMatrix.transpose() * ten;
-    }
-    else
-    {
-      adcFit = m_TensorBasis * ten;
-    }
-
-    for (unsigned int i=0;i<m_NumberOfGradientDirections;++i)
-    {
-
-      //compute the residue..
-      res[i] = static_cast< typename ResidualPixelType::ValueType>(
-          S0 * ( exp( - adc[i] * this->m_BValue ) - exp( - adcFit[i] * this->m_BValue ) )
-        );
-
-    }
-
-    return res;
-  }
-
-
   template< class TReferenceImagePixelType,
             class TGradientImagePixelType, class TTensorPixelType >
   void DiffusionTensor3DReconstructionImageFilter< TReferenceImagePixelType,
@@ -638,7 +600,6 @@ namespace itk
   {
     Superclass::PrintSelf(os,indent);
 
-    os << indent << "TensorBasisMatrix: " << m_TensorBasis << std::endl;
     os << indent << "Coeffs: " << m_BMatrix << std::endl;
     if ( m_GradientDirectionContainer )
       {
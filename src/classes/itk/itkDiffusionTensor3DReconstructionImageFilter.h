@@ -24,6 +24,10 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
 #include "itkSpatialObject.h"
 #include "itkNumericTraits.h"
 
+#include "Eigen/Dense"
+
+#include <vector>
+
 #if WIN32
 __declspec(dllexport) inline void getRidOfLNK4221(){};
 #endif
@@ -96,14 +100,13 @@ Analysis, 2002, pp 93-108.</em>
 \li<a href="splweb.bwh.harvard.edu:8000/pages/papers/westin/ISMRM2002.pdf">[2]</a>
 <em>A Dual Tensor Basis Solution to the Stejskal-Tanner Equations for DT-MRI</em>
 
-\par WARNING:
-Although this filter has been written to support multiple threads, please
-set the number of threads to 1.
-\code
-        filter->SetNumberOfThreads(1);
-\endcode
-This is due to buggy code in netlib/dsvdc, that is called by vnl_svd.
-(used to compute the psudo-inverse to find the dual tensor basis).
+\par Multithreading:
+The pseudo-inverse of the gradient design matrix is the same for every voxel, so
+it is computed once (with Eigen, which is thread-safe, rather than the netlib
+routines behind vnl_svd) in BeforeThreadedGenerateData(). Every thread gathers
+the log signals of a tile of voxels into an N x (tile size) matrix and fits the
+whole tile with a single product by the 6xN pseudo-inverse, so the filter can use
+all threads. The weighted fitting modes also solve one 6x6 system per voxel.
 
 \author Thanks to Xiaodong Tao, GE, for contributing parts of this class. Also
 thanks to Casey Goodlet, UNC for patches to support multiple baseline images
@@ -200,8 +203,6 @@ public:
 
 
   /** Holds the tensor basis coefficients G_k */
-  typedef vnl_matrix_fixed< double, 6, 6 >         TensorBasisMatrixType;
-  typedef vnl_matrix_fixed< double, 6, 6 >         TensorBasisInverseMatrixType;
   typedef vnl_matrix< double >                     CoefficientMatrixType;
 
   /** Holds each magnetic field gradient used to acquire one DWImage */
@@ -269,6 +270,35 @@ public:
   /** Get the Residual image . */
   itkGetConstObjectMacro( ResidualImage, ResidualImageType );
 
+  /** Get/set compute baseline (S0) image flag; it is computed in the same pass as the tensors. */
+  itkSetMacro( CalculateBaselineImage, bool );
+  itkGetMacro( CalculateBaselineImage, bool );
+
+  /** Get the baseline (S0) image, which is the average of the baselines for a VectorImage input. */
+  itkGetConstObjectMacro( BaselineImage, ReferenceImageType );
+
+  /** The fitting engines of the log signals:
+   * \li OrdinaryLeastSquares - linear least squares (default)
+   * \li WeightedLeastSquares - weighted by the squared signals predicted by the ordinary fit, which
+   * accounts for the noise of the log transform
+   * \li IterativelyReweightedLeastSquares - WeightedLeastSquares followed by NumberOfIterations
+   * reweightings that down-weight outliers (Cauchy weights on the signal residuals, scaled by their
+   * median absolute deviation) */
+  typedef enum
+    {
+    OrdinaryLeastSquares = 0,
+    WeightedLeastSquares,
+    IterativelyReweightedLeastSquares
+    } FittingModeType;
+
+  /** Get/set the fitting engine. */
+  itkSetMacro( FittingMode, FittingModeType );
+  itkGetMacro( FittingMode, FittingModeType );
+
+  /** Get/set the number of robust reweightings for IterativelyReweightedLeastSquares; defaults to 3. */
+  itkSetMacro( NumberOfIterations, unsigned int );
+  itkGetMacro( NumberOfIterations, unsigned int );
+
   /**
    * The BValue \f$ (s/mm^2) \f$ value used in normalizing the tensors to
    * physically meaningful units.  See equation (24) of the first reference for
@@ -321,18 +351,31 @@ protected:
     Else
     } GradientImageTypeEnumeration;
 
-  /* method to compute the residual */
-  ResidualPixelType ComputeResidual( vnl_vector<double>, TensorPixelType, double);
+  /* takes the absolute value of negative eigenvalues and reconstitutes the tensor */
+  void MakeTensorPositiveDefinite( TensorPixelType &tensor ) const;
+
+  /* weights of the measurements of a voxel for the weighted fits; the robust weights also need the
+   * scratch vector, which is kept per thread */
+  template< class TSignals, class TLogSignals, class TFittedSignals, class TWeights >
+  void ComputeFittingWeights( const TSignals &signals, const TLogSignals &logSignals, const TFittedSignals &fittedSignals,
+                              double b0, bool isRobust, TWeights weights, std::vector< double > &absoluteResiduals ) const;
 
 private:
 
-  /* Tensor basis coefficients */
-  TensorBasisMatrixType                             m_TensorBasis;
+  CoefficientMatrixType                             m_BMatrix;
+
+  /** Pseudo-inverse of the (N x 6) design matrix, mapping the N log signals to the 6 tensor elements */
+  Eigen::Matrix< double, 6, Eigen::Dynamic >         m_PseudoInverse;
 
-  /* Tensor basis coefficients */
-  TensorBasisInverseMatrixType                      m_TensorBasisInverse;
+  /** The (N x 6) design matrix, mapping the 6 tensor elements to the N log signals */
+  Eigen::MatrixXd                                   m_DesignMatrix;
 
-  CoefficientMatrixType                             m_BMatrix;
+  /** The upper triangles of the outer products of the rows of the design matrix (21 x N), so that the
+   * normal matrices of the weighted fits of a tile of voxels come from a single product with the weights */
+  Eigen::MatrixXd                                   m_DesignOuterProducts;
+
+  FittingModeType                                   m_FittingMode;
+  unsigned int                                      m_NumberOfIterations;
 
   /** container to hold gradient directions */
   GradientDirectionContainerType::Pointer           m_GradientDirectionContainer;
@@ -358,6 +401,9 @@ private:
   typename ResidualImageType::Pointer               m_ResidualImage;
   bool                                              m_CalculateResidualImage;
 
+  typename ReferenceImageType::Pointer              m_BaselineImage;
+  bool                                              m_CalculateBaselineImage;
+
 };
 
 }
@@ -12,6 +12,10 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
 */
 #pragma once
 
+#include <vector>
+#include <cmath>
+#include <iostream>
+
 #include "itkNaryFunctorImageFilter.h"
 #include "itkNumericTraits.h"
 #include "itkDiffusionTensor3D.h"
@@ -37,15 +41,15 @@ namespace itk
       ~Variance() {}
       inline TOutput operator()( const std::vector< TInput > & B)
       {
-        RealType sum = NumericTraits< TOutput >::Zero;
-        RealType sum_sqr = NumericTraits< TOutput >::Zero;
-          
+        // Welford's update in double precision; the naive sum_sqr - sum^2/n loses precision (and can go negative)
+        double mean = 0, M2 = 0;
         for( unsigned int i=0; i< B.size(); i++ )
         {
-          sum_sqr += static_cast< TOutput >(B[i]) * static_cast< TOutput >(B[i]);
-          sum += static_cast< TOutput >(B[i]);
-        }       
-        return static_cast<TOutput>( (sum_sqr - (sum * sum) / B.size() ) /B.size() );
+          const double delta = static_cast< double >(B[i]) - mean;
+          mean += delta / (i + 1);
+          M2 += delta * (static_cast< double >(B[i]) - mean);
+        }
+        return static_cast<TOutput>( B.empty() ? 0 : M2 / B.size() );
       }
       bool operator== (const Variance&) const
       {
@@ -167,5 +171,166 @@ namespace itk
 
   };
 
+  /**
+  \class StreamingVarianceImageAccumulator
+
+  \brief Computes pixel-wise mean and variance of images that are added one at a time
+
+  Every voxel keeps its running mean and sum of squared differences from the mean (Welford's update) in double 
+  precision, so memory does not depend on the number of images and the variance is never negative. Partial 
+  accumulators (from different threads, processes or nodes) are combined with Merge() using the pairwise formula of 
+  Chan et al., which gives the same result as adding all images to a single accumulator.
+
+  Usage example:
+  \verbatim
+  itk::StreamingVarianceImageAccumulator< ImageType > accumulator;
+  for (auto &file : files)
+  {
+    accumulator.AddImage(cbica::ReadImage< ImageType >(file)); // only the current image is in memory
+  }
+  auto variance = accumulator.GetVarianceImage();
+  \endverbatim
+  */
+  template< class TInputImage, class TOutputImage = Image< float, TInputImage::ImageDimension > >
+  class StreamingVarianceImageAccumulator
+  {
+  public:
+    typedef StreamingVarianceImageAccumulator Self;
+
+    //! Number of images added so far (including the merged ones)
+    size_t GetNumberOfImages() const { return m_count; }
+
+    /**
+    \brief Add an image; the first image defines the geometry of the outputs
+
+    \return False if the image does not have the same size as the previous ones
+    */
+    bool AddImage(const TInputImage *image)
+    {
+      const size_t numberOfPixels = image->GetBufferedRegion().GetNumberOfPixels();
+      if (m_count == 0)
+      {
+        m_reference = TOutputImage::New();
+        m_reference->CopyInformation(image);
+        m_reference->SetRegions(image->GetBufferedRegion());
+        m_mean.assign(numberOfPixels, 0);
+        m_M2.assign(numberOfPixels, 0);
+      }
+      else if (image->GetBufferedRegion().GetSize() != m_reference->GetBufferedRegion().GetSize())
+      {
+        std::cerr << "Image size does not match the size of the accumulated images.\n";
+        return false;
+      }
+
+      m_count++;
+      const double count = static_cast< double >(m_count);
+      const typename TInputImage::PixelType *buffer = image->GetBufferPointer();
+      const long long numberOfElements = static_cast< long long >(numberOfPixels);
+#pragma omp parallel for if (numberOfElements > 65536)
+      for (long long i = 0; i < numberOfElements; i++)
+      {
+        const double value = static_cast< double >(buffer[i]);
+        const double delta = value - m_mean[i];
+        m_mean[i] += delta / count;
+        m_M2[i] += delta * (value - m_mean[i]);
+      }
+      return true;
+    }
+
+    /**
+    \brief Combine the images accumulated by another accumulator into this one
+
+    \return False if the accumulators do not have the same size
+    */
+    bool Merge(const Self &other)
+    {
+      if (other.m_count == 0)
+      {
+        return true;
+      }
+      if (m_count == 0)
+      {
+        *this = other;
+        return true;
+      }
+      if (other.m_mean.size() != m_mean.size())
+      {
+        std::cerr << "Accumulators of different sizes cannot be merged.\n";
+        return false;
+      }
+
+      const double na = static_cast< double >(m_count), nb = static_cast< double >(other.m_count);
+      const double n = na + nb;
+      const long long numberOfElements = static_cast< long long >(m_mean.size());
+#pragma omp parallel for if (numberOfElements > 65536)
+      for (long long i = 0; i < numberOfElements; i++)
+      {
+        const double delta = other.m_mean[i] - m_mean[i];
+        m_mean[i] += delta * nb / n;
+        m_M2[i] += other.m_M2[i] + delta * delta * na * nb / n;
+      }
+      m_count += other.m_count;
+      return true;
+    }
+
+    //! The pixel-wise mean
+    typename TOutputImage::Pointer GetMeanImage() const
+    {
+      return CreateOutput([this](size_t i) { return m_mean[i]; });
+    }
+
+    /**
+    \brief The pixel-wise variance
+
+    \param sampleVariance If true, divides by (n-1) instead of n; defaults to the population variance, like NaryVarianceImageFilter
+    */
+    typename TOutputImage::Pointer GetVarianceImage(bool sampleVariance = false) const
+    {
+      const double denominator = static_cast< double >(sampleVariance ? m_count - 1 : m_count);
+      return CreateOutput([this, denominator](size_t i) { return (denominator > 0) ? m_M2[i] / denominator : 0; });
+    }
+
+    /**
+    \brief The pixel-wise standard deviation
+
+    \param sampleVariance If true, divides by (n-1) instead of n; defaults to the population variance
+    */
+    typename TOutputImage::Pointer GetStandardDeviationImage(bool sampleVariance = false) const
+    {
+      const double denominator = static_cast< double >(sampleVariance ? m_count - 1 : m_count);
+      return CreateOutput([this, denominator](size_t i) { return (denominator > 0) ? std::sqrt(m_M2[i] / denominator) : 0; });
+    }
+
+  private:
+    //! Allocates an output with the geometry of the first image and fills it with the given pixel-wise value
+    template< class TValueFunction >
+    typename TOutputImage::Pointer CreateOutput(TValueFunction valueFunction) const
+    {
+      if (m_count == 0)
+      {
+        std::cerr << "No images have been accumulated.\n";
+        return nullptr;
+      }
+      auto outputImage = TOutputImage::New();
+      outputImage->CopyInformation(m_reference);
+      outputImage->SetRegions(m_reference->GetBufferedRegion());
+      outputImage->Allocate();
+
+      auto outputBuffer = outputImage->GetBufferPointer();
+      const long long numberOfElements = static_cast< long long >(m_mean.size());
+#pragma omp parallel for if (numberOfElements > 65536)
+      for (long long i = 0; i < numberOfElements; i++)
+      {
+        outputBuffer[i] = static_cast< typename TOutputImage::PixelType >(valueFunction(static_cast< size_t >(i)));
+      }
+      return outputImage;
+    }
+
+    size_t m_count = 0;
+    std::vector< double > m_mean, m_M2;
+    typename TOutputImage::Pointer m_reference; // holds the geometry only; never allocated
+  };
+
 } // end namespace itk
 
+
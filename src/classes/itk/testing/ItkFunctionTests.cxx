@@ -16,6 +16,7 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
 #include <stdlib.h>
 #include <string>
 #include <algorithm>
+#include <functional>
 #include <fstream>
 
 #include "itkImage.h"
@@ -26,6 +27,10 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
 #include "classes/itk/cbicaITKImageInfo.h"
 #include "classes/itk/cbicaITKSafeImageIO.h"
 #include "classes/itk/cbicaITKUtilities.h"
+#include "classes/itk/itkNaryVarianceImageFilter.h"
+#ifdef ITK_TESTS_WITH_OPENCV
+#include "classes/itk/cbicaITKOpenCVUtilities.h"
+#endif
 
 #include "itkImage.h"
 
@@ -38,6 +43,47 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html
 #include "itkMinimumMaximumImageCalculator.h"
 #include "itkDiffusionTensor3DReconstructionImageFilter.h"
 #include "itkTestingComparisonImageFilter.h"
+#include "itkImageRegionIteratorWithIndex.h"
+
+/**
+\brief Creates an image with the given size at the default origin, spacing and direction
+
+\param size The size of the image
+\param valueAt Gives the value at every buffer offset; the buffer is filled with '0' if this is empty
+*/
+template< class TImageType >
+typename TImageType::Pointer CreateTestImage(const typename TImageType::SizeType &size,
+  const std::function< typename TImageType::PixelType(size_t) > &valueAt = nullptr)
+{
+  typename TImageType::RegionType region;
+  region.SetSize(size);
+  auto image = TImageType::New();
+  image->SetRegions(region);
+  image->Allocate();
+  if (!valueAt)
+  {
+    image->FillBuffer(0);
+    return image;
+  }
+  auto buffer = image->GetBufferPointer();
+  for (size_t i = 0; i < region.GetNumberOfPixels(); i++)
+  {
+    buffer[i] = valueAt(i);
+  }
+  return image;
+}
+
+/**
+\brief Creates a cubic image (the same size along every axis); see the other overload for details
+*/
+template< class TImageType >
+typename TImageType::Pointer CreateTestImage(const size_t size,
+  const std::function< typename TImageType::PixelType(size_t) > &valueAt = nullptr)
+{
+  typename TImageType::SizeType imageSize;
+  imageSize.Fill(size);
+  return CreateTestImage< TImageType >(imageSize, valueAt);
+}
 
 int main(int argc, char** argv)
 {
@@ -49,6 +95,15 @@ int main(int argc, char** argv)
   parser.addOptionalParameter("s", "skullStrip", cbica::Parameter::NONE, "", "Skull stripping Test");
   parser.addOptionalParameter("l", "labelDist", cbica::Parameter::DIRECTORY, "", "Label distance calculator Test");
   parser.addOptionalParameter("dcm", "dicom", cbica::Parameter::STRING, "", "DICOM reading test");
+  parser.addOptionalParameter("mo", "maskOffsets", cbica::Parameter::NONE, "", "Compact mask, offset and index gather Test");
+  parser.addOptionalParameter("vi", "vectorizeImages", cbica::Parameter::NONE, "", "Vectorizing masked images through buffer offsets Test");
+  parser.addOptionalParameter("li", "labelImages", cbica::Parameter::NONE, "", "Label splitting Test");
+  parser.addOptionalParameter("hd", "hausdorff", cbica::Parameter::NONE, "", "Hausdorff distance fast mode and label region of interest Test");
+  parser.addOptionalParameter("cv", "changeValues", cbica::Parameter::NONE, "", "Relabeling images in copy and in-place modes Test");
+  parser.addOptionalParameter("rl", "resampleLabel", cbica::Parameter::NONE, "", "Label image resampling Test");
+  parser.addOptionalParameter("je", "joinExtract", cbica::Parameter::NONE, "", "Joining, extracting and viewing image series Test");
+  parser.addOptionalParameter("sv", "streamingVariance", cbica::Parameter::NONE, "", "Streaming and mergeable variance map Test");
+  parser.addOptionalParameter("dti", "dtiRecon", cbica::Parameter::NONE, "", "Multithreaded, tiled tensor reconstruction (OLS, WLS and IRLS) Test");
 
   int tempPosition;
   if (parser.compareParameter("imageInfo", tempPosition))
@@ -211,5 +266,508 @@ int main(int argc, char** argv)
     // check properties for inputImage here
   }
 
+  if (parser.compareParameter("maskOffsets", tempPosition))
+  {
+    using ImageType = itk::Image< float, 3 >;
+
+    // 2 modalities whose mean is positive only in part of the image
+    std::vector< std::vector< ImageType::Pointer > > subjects(1);
+    subjects[0].push_back(CreateTestImage< ImageType >(24, [](size_t i) { return static_cast< float >(i % 5) - 2; }));
+    subjects[0].push_back(CreateTestImage< ImageType >(24, [](size_t i) { return static_cast< float >(i % 3); }));
+
+    auto maskOffsets = cbica::CreateMaskOffsets< ImageType >(subjects);
+    auto maskIndeces = cbica::CreateMaskIndeces< ImageType >(subjects);
+    if ((maskOffsets.size() != 1) || (maskOffsets[0].size() != maskIndeces[0].size()) || maskOffsets[0].empty())
+    {
+      return EXIT_FAILURE;
+    }
+
+    auto values = cbica::GetPixelValuesFromOffsets< ImageType >(subjects[0][0], maskOffsets[0]);
+
+    // the index based gathers should give the same values
+    auto valuesFromIndeces = cbica::GetPixelValuesFromIndeces< ImageType >(subjects[0][0], maskIndeces[0]);
+    auto valuesFromIndeces_all = cbica::GetPixelValuesFromIndeces< ImageType >(subjects[0], maskIndeces[0]);
+    if ((valuesFromIndeces != values) || (valuesFromIndeces_all.size() != 2) || (valuesFromIndeces_all[0] != values) ||
+      (valuesFromIndeces_all[1] != cbica::GetPixelValuesFromOffsets< ImageType >(subjects[0][1], maskOffsets[0])))
+    {
+      return EXIT_FAILURE;
+    }
+    for (size_t k = 0; k < maskOffsets[0].size(); k++)
+    {
+      const auto offset = maskOffsets[0][k];
+      if ((subjects[0][0]->ComputeOffset(maskIndeces[0][k]) != offset) || (values[k] != subjects[0][0]->GetBufferPointer()[offset]) ||
+        (subjects[0][0]->GetBufferPointer()[offset] + subjects[0][1]->GetBufferPointer()[offset] <= 0))
+      {
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+#ifdef ITK_TESTS_WITH_OPENCV
+  if (parser.compareParameter("vectorizeImages", tempPosition))
+  {
+    using ImageType = itk::Image< float, 3 >;
+
+    // 2 subjects with 3 modalities each, and a different mask per modality
+    const size_t numberOfSubjects = 2, numberOfModalities = 3;
+    std::vector< std::vector< ImageType::Pointer > > subjects(numberOfSubjects);
+    std::vector< ImageType::Pointer > masks;
+    for (size_t i = 0; i < numberOfSubjects; i++)
+    {
+      for (size_t j = 0; j < numberOfModalities; j++)
+      {
+        subjects[i].push_back(CreateTestImage< ImageType >(12, [&](size_t k) { return static_cast< float >(k + 1000 * (i * numberOfModalities + j)); }));
+      }
+    }
+    for (size_t j = 0; j < numberOfModalities; j++)
+    {
+      masks.push_back(CreateTestImage< ImageType >(12, [&](size_t k) { return static_cast< float >((k % (j + 2)) == 0); }));
+    }
+    std::vector< std::vector< std::uint32_t > > maskOffsets;
+    for (const auto &mask : masks)
+    {
+      maskOffsets.push_back(cbica::GetMaskOffsets< ImageType >(mask));
+    }
+
+    // every mask has a different number of voxels, so the modalities can only be appended per subject
+    auto rows = cbica::VectorizeImages< ImageType >(subjects, masks, false, true, false);
+    auto columns = cbica::VectorizeImages< ImageType >(subjects, maskOffsets, true, true, false);
+    const size_t rowLength = maskOffsets[0].size() + maskOffsets[1].size() + maskOffsets[2].size();
+    if ((rows.rows != static_cast< int >(numberOfSubjects)) || (rows.cols != static_cast< int >(rowLength)) ||
+      (columns.rows != rows.cols) || (columns.cols != rows.rows))
+    {
+      return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < numberOfSubjects; i++)
+    {
+      size_t column = 0;
+      for (size_t j = 0; j < numberOfModalities; j++)
+      {
+        for (auto offset : maskOffsets[j])
+        {
+          const float expected = subjects[i][j]->GetBufferPointer()[offset];
+          if ((rows.at< float >(static_cast< int >(i), static_cast< int >(column)) != expected) ||
+            (columns.at< float >(static_cast< int >(column), static_cast< int >(i)) != expected))
+          {
+            return EXIT_FAILURE;
+          }
+          column++;
+        }
+      }
+    }
+
+    // a single mask per subject gives a row per (subject, modality) pair
+    std::vector< ImageType::Pointer > subjectMasks(numberOfSubjects, masks[0]);
+    auto modalityRows = cbica::VectorizeImages< ImageType >(subjects, subjectMasks, false, false, true);
+    if ((modalityRows.rows != static_cast< int >(numberOfSubjects * numberOfModalities)) || (modalityRows.cols != static_cast< int >(maskOffsets[0].size())) ||
+      (modalityRows.at< float >(static_cast< int >(numberOfModalities + 1), 1) != subjects[1][1]->GetBufferPointer()[maskOffsets[0][1]]))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+#endif
+
+  if (parser.compareParameter("labelImages", tempPosition))
+  {
+    using ImageType = itk::Image< float, 3 >;
+    using MaskType = itk::Image< unsigned char, 3 >;
+
+    // slabs of labels 0, 1, 2 and 4 along the last axis
+    auto labelImage = CreateTestImage< ImageType >(32, [](size_t i)
+    {
+      const float labels[] = { 0, 1, 2, 4 };
+      return labels[(i / (32 * 32)) % 4];
+    });
+    const auto region = labelImage->GetBufferedRegion();
+    auto buffer = labelImage->GetBufferPointer();
+
+    auto labelImages = cbica::GetUniqueLabelImagessFromImage< ImageType >(labelImage);
+    auto labelMasks = cbica::GetUniqueLabelImagessFromImage< ImageType, MaskType >(labelImage);
+    cbica::LabelImageView< ImageType > labelView(labelImage);
+
+    if ((labelImages.size() != 4) || (labelMasks.size() != 4) || (labelView.GetLabels().size() != 4) || 
+      (labelView.GetCount(2) != region.GetNumberOfPixels() / 4))
+    {
+      return EXIT_FAILURE;
+    }
+    for (auto &label : labelView.GetLabels())
+    {
+      auto viewMask = labelView.GetMask(label);
+      auto imageBuffer = labelImages[static_cast< int >(label)]->GetBufferPointer();
+      auto maskBuffer = labelMasks[static_cast< int >(label)]->GetBufferPointer();
+      auto viewBuffer = viewMask->GetBufferPointer();
+      for (size_t i = 0; i < region.GetNumberOfPixels(); i++)
+      {
+        const bool expected = (buffer[i] == label);
+        if ((imageBuffer[i] != expected) || (maskBuffer[i] != expected) || (viewBuffer[i] != expected))
+        {
+          return EXIT_FAILURE;
+        }
+      }
+    }
+  }
+
+  if (parser.compareParameter("hausdorff", tempPosition))
+  {
+    using ImageType = itk::Image< unsigned char, 3 >;
+
+    // 2 overlapping spheres of different radii
+    auto sphere_1 = CreateTestImage< ImageType >(48), sphere_2 = CreateTestImage< ImageType >(48);
+    itk::ImageRegionIteratorWithIndex< ImageType > iterator_1(sphere_1, sphere_1->GetBufferedRegion());
+    for (iterator_1.GoToBegin(); !iterator_1.IsAtEnd(); ++iterator_1)
+    {
+      auto index = iterator_1.GetIndex();
+      auto distance_1 = std::sqrt(std::pow(index[0] - 20.0, 2) + std::pow(index[1] - 24.0, 2) + std::pow(index[2] - 24.0, 2));
+      auto distance_2 = std::sqrt(std::pow(index[0] - 26.0, 2) + std::pow(index[1] - 24.0, 2) + std::pow(index[2] - 22.0, 2));
+      iterator_1.Set(distance_1 < 10 ? 1 : 0);
+      sphere_2->SetPixel(index, distance_2 < 13 ? 1 : 0);
+    }
+
+    // the fast mode should be identical to the default one when both images are on the same grid
+    auto metric = HausdorffDistanceImageToImageMetric< ImageType, ImageType >::New();
+    metric->SetFixedImage(sphere_1);
+    metric->SetMovingImage(sphere_2);
+    metric->SetPercentile(0.95);
+    auto defaultValue = metric->GetValue();
+    metric->FastModeOn();
+    auto fastValue = metric->GetValue();
+
+    if ((std::abs(defaultValue - fastValue) > 1e-4) || (defaultValue <= 0))
+    {
+      return EXIT_FAILURE;
+    }
+
+    // the region of interest is the union of both spheres and a margin of 1 voxel
+    auto regionOfInterest = cbica::GetNonZeroBoundingRegion< ImageType >(sphere_1, sphere_2);
+    if ((regionOfInterest.GetIndex()[0] != 10) || (regionOfInterest.GetIndex()[1] != 11) || (regionOfInterest.GetIndex()[2] != 9) ||
+      (regionOfInterest.GetSize()[0] != 30) || (regionOfInterest.GetSize()[1] != 27) || (regionOfInterest.GetSize()[2] != 27))
+    {
+      return EXIT_FAILURE;
+    }
+    if (std::abs(cbica::GetHausdorffDistance< ImageType >(sphere_1, sphere_2) - fastValue) > 1e-4)
+    {
+      return EXIT_FAILURE;
+    }
+
+    // empty masks
+    auto emptyImage = cbica::CreateImage< ImageType >(sphere_1);
+    metric->SetMovingImage(emptyImage);
+    if (!std::isinf(metric->GetValue()))
+    {
+      return EXIT_FAILURE;
+    }
+    metric->SetFixedImage(emptyImage);
+    if (metric->GetValue() != 0)
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (parser.compareParameter("changeValues", tempPosition))
+  {
+    using ImageType = itk::Image< short, 3 >;
+
+    // only a part of the largest possible region is buffered, as would be the case for a streamed image
+    ImageType::SizeType size;
+    size.Fill(16);
+    ImageType::RegionType largestRegion, bufferedRegion;
+    largestRegion.SetSize(size);
+    size[0] = 8;
+    ImageType::IndexType start;
+    start.Fill(0);
+    start[0] = 4;
+    bufferedRegion.SetIndex(start);
+    bufferedRegion.SetSize(size);
+
+    auto labelImage = ImageType::New();
+    labelImage->SetLargestPossibleRegion(largestRegion);
+    labelImage->SetBufferedRegion(bufferedRegion);
+    labelImage->SetRequestedRegion(bufferedRegion);
+    ImageType::SpacingType spacing;
+    spacing.Fill(0.5);
+    labelImage->SetSpacing(spacing);
+    labelImage->Allocate();
+    auto buffer = labelImage->GetBufferPointer();
+    const size_t numberOfPixels = bufferedRegion.GetNumberOfPixels();
+    for (size_t i = 0; i < numberOfPixels; i++)
+    {
+      buffer[i] = static_cast< short >(i % 5);
+    }
+    auto expected = [](short value) { return static_cast< short >((value == 1) ? 2 : ((value == 2) ? 1 : value)); };
+
+    // the copy keeps the geometry and leaves the input untouched
+    auto relabeled = cbica::ChangeImageValues< ImageType >(labelImage, "1x2", "2x1");
+    if ((relabeled == labelImage) || (relabeled->GetLargestPossibleRegion() != largestRegion) ||
+      (relabeled->GetBufferedRegion() != bufferedRegion) || (relabeled->GetSpacing() != spacing))
+    {
+      return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < numberOfPixels; i++)
+    {
+      if ((buffer[i] != static_cast< short >(i % 5)) || (relabeled->GetBufferPointer()[i] != expected(buffer[i])))
+      {
+        return EXIT_FAILURE;
+      }
+    }
+
+    // in-place modifies and returns the input
+    auto relabeledInPlace = cbica::ChangeImageValues< ImageType >(labelImage, "1x2", "2x1", true);
+    if (relabeledInPlace != labelImage)
+    {
+      return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < numberOfPixels; i++)
+    {
+      if (buffer[i] != relabeled->GetBufferPointer()[i])
+      {
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  if (parser.compareParameter("resampleLabel", tempPosition))
+  {
+    using ImageType = itk::Image< float, 3 >;
+
+    // 3 slabs along x
+    auto labelImage = CreateTestImage< ImageType >(32);
+    itk::ImageRegionIteratorWithIndex< ImageType > iterator(labelImage, labelImage->GetBufferedRegion());
+    for (iterator.GoToBegin(); !iterator.IsAtEnd(); ++iterator)
+    {
+      const auto x = iterator.GetIndex()[0];
+      iterator.Set((x < 10) ? 0 : ((x < 20) ? 1 : 4));
+    }
+
+    // the output should be on the requested grid, with the labels of the slabs away from their borders
+    ImageType::SpacingType outputSpacing;
+    outputSpacing.Fill(2);
+    ImageType::SizeType outputSize;
+    outputSize.Fill(16);
+    auto resampled = cbica::ResampleImage< ImageType >(labelImage, outputSpacing, outputSize, "NearestLabel");
+    if ((resampled->GetLargestPossibleRegion().GetSize() != outputSize) || (resampled->GetSpacing() != outputSpacing))
+    {
+      return EXIT_FAILURE;
+    }
+    const std::map< int, float > expectedLabels = { { 2, 0 }, { 7, 1 }, { 13, 4 } };
+    for (const auto &expected : expectedLabels)
+    {
+      ImageType::IndexType index;
+      index.Fill(8);
+      index[0] = expected.first;
+      if (resampled->GetPixel(index) != expected.second)
+      {
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  if (parser.compareParameter("joinExtract", tempPosition))
+  {
+    using ImageType = itk::Image< float, 3 >;
+    using SeriesType = itk::Image< float, 4 >;
+
+    ImageType::SizeType size;
+    size[0] = 7;
+    size[1] = 5;
+    size[2] = 3;
+    ImageType::SpacingType spacing;
+    spacing[0] = 0.5;
+    spacing[1] = 1;
+    spacing[2] = 2;
+    std::vector< ImageType::Pointer > volumes(4);
+    for (size_t v = 0; v < volumes.size(); v++)
+    {
+      volumes[v] = CreateTestImage< ImageType >(size, [v](size_t i) { return static_cast< float >(v * 1000 + i); });
+      volumes[v]->SetSpacing(spacing);
+    }
+    const auto region = volumes[0]->GetBufferedRegion();
+
+    auto series = cbica::GetJoinedImage< ImageType, SeriesType >(volumes, 3.0);
+    if ((series->GetLargestPossibleRegion().GetSize()[3] != volumes.size()) || (series->GetSpacing()[3] != 3.0) ||
+      (series->GetSpacing()[0] != 0.5) || (series->GetSpacing()[2] != 2))
+    {
+      return EXIT_FAILURE;
+    }
+
+    // copies and views of the time points should both give back the original volumes
+    for (auto shareBuffer : { false, true })
+    {
+      auto extracted = cbica::GetExtractedImages< SeriesType, ImageType >(series, 3, false, shareBuffer);
+      if (extracted.size() != volumes.size())
+      {
+        return EXIT_FAILURE;
+      }
+      for (size_t v = 0; v < volumes.size(); v++)
+      {
+        if ((extracted[v]->GetLargestPossibleRegion() != region) || (extracted[v]->GetSpacing() != spacing) ||
+          ((extracted[v]->GetBufferPointer() == series->GetBufferPointer() + v * region.GetNumberOfPixels()) != shareBuffer) ||
+          !std::equal(volumes[v]->GetBufferPointer(), volumes[v]->GetBufferPointer() + region.GetNumberOfPixels(), extracted[v]->GetBufferPointer()))
+        {
+          return EXIT_FAILURE;
+        }
+      }
+    }
+
+    // time points wrapped as images share the series memory and work with the other utilities
+    cbica::TimePointView< SeriesType > timePoints(series);
+    if ((timePoints.GetNumberOfTimePoints() != volumes.size()) || (timePoints.GetImage(volumes.size()) != nullptr))
+    {
+      return EXIT_FAILURE;
+    }
+    auto timePoint = timePoints.GetImage(2);
+    timePoint->GetBufferPointer()[0] = -1;
+    if ((series->GetBufferPointer()[2 * region.GetNumberOfPixels()] != -1) ||
+      (cbica::GetUniqueValuesAndCountsInImage< ImageType >(timePoint).size() != region.GetNumberOfPixels()))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (parser.compareParameter("streamingVariance", tempPosition))
+  {
+    using ImageType = itk::Image< float, 3 >;
+    using AccumulatorType = itk::StreamingVarianceImageAccumulator< ImageType, itk::Image< double, 3 > >;
+
+    // a large offset with a small spread, where sum_sqr - sum^2/n in float loses all precision
+    const size_t numberOfImages = 10;
+    AccumulatorType all, firstHalf, secondHalf;
+    for (size_t n = 0; n < numberOfImages; n++)
+    {
+      auto image = CreateTestImage< ImageType >(8, [n](size_t) { return 100000.0f + n; });
+      all.AddImage(image);
+      if (n < numberOfImages / 2)
+      {
+        firstHalf.AddImage(image);
+      }
+      else
+      {
+        secondHalf.AddImage(image);
+      }
+    }
+
+    // partial accumulators should merge to the same result; the variance of 0..9 is 8.25
+    firstHalf.Merge(secondHalf);
+    auto variance_all = all.GetVarianceImage(), variance_merged = firstHalf.GetVarianceImage();
+    auto mean_merged = firstHalf.GetMeanImage();
+    for (size_t i = 0; i < variance_all->GetBufferedRegion().GetNumberOfPixels(); i++)
+    {
+      if ((std::abs(variance_all->GetBufferPointer()[i] - 8.25) > 1e-6) || (std::abs(variance_merged->GetBufferPointer()[i] - 8.25) > 1e-6) ||
+        (std::abs(mean_merged->GetBufferPointer()[i] - 100004.5) > 1e-6))
+      {
+        return EXIT_FAILURE;
+      }
+    }
+    if ((firstHalf.GetNumberOfImages() != numberOfImages) || 
+      (std::abs(all.GetStandardDeviationImage(true)->GetBufferPointer()[0] - std::sqrt(8.25 * 10 / 9)) > 1e-6))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (parser.compareParameter("dtiRecon", tempPosition))
+  {
+    using ImageType = itk::Image< float, 3 >;
+    using FilterType = itk::DiffusionTensor3DReconstructionImageFilter< float, float, double >;
+
+    // signals of a known prolate tensor (in mm^2/s) for 12 directions, which are noise-free except for 2 voxels: 
+    // one with a signal dropout in a single measurement and one with noise of a fixed spread in the signal domain,
+    // which is signal dependent in the log domain that the tensor is fitted in
+    const double bValue = 1000, S0 = 1000;
+    const double tensor[6] = { 1.7e-3, 0.1e-3, 0, 0.4e-3, 0.05e-3, 0.3e-3 }; // xx, xy, xz, yy, yz, zz
+    const double directions[12][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 1, 1, 0 }, { 1, 0, 1 }, { 0, 1, 1 },
+      { 1, -1, 0 }, { 1, 0, -1 }, { 0, 1, -1 }, { 1, 1, 1 }, { -1, 1, 1 }, { 1, -1, 1 } };
+
+    auto createImage = [](float value) { return CreateTestImage< ImageType >(16, [value](size_t) { return value; }); };
+
+    auto filter = FilterType::New();
+    filter->SetReferenceImage(createImage(S0));
+    for (size_t g = 0; g < 12; g++)
+    {
+      FilterType::GradientDirectionType direction;
+      direction[0] = directions[g][0];
+      direction[1] = directions[g][1];
+      direction[2] = directions[g][2];
+      direction.normalize();
+      const double adc = direction[0] * direction[0] * tensor[0] + 2 * direction[0] * direction[1] * tensor[1] +
+        2 * direction[0] * direction[2] * tensor[2] + direction[1] * direction[1] * tensor[3] +
+        2 * direction[1] * direction[2] * tensor[4] + direction[2] * direction[2] * tensor[5];
+      auto gradientImage = createImage(S0 * std::exp(-bValue * adc));
+      const float noise[12] = { 12, -9, 15, -14, 7, -11, 10, -6, 13, -8, 9, -12 };
+      gradientImage->GetBufferPointer()[0] *= (g == 3) ? 0.3f : 1.0f;
+      gradientImage->GetBufferPointer()[1] += noise[g];
+      filter->AddGradientImage(direction, gradientImage);
+    }
+    const size_t outlierVoxel = 0, noisyVoxel = 1;
+    filter->SetBValue(bValue);
+    filter->SetCalculateBaselineImage(true);
+
+    // every noise-free voxel, whichever thread and tile computed it, should recover the tensor with a negligible 
+    // residual, and so should the weighted fits, since the signals are consistent under any weighting
+    const FilterType::FittingModeType fittingModes[3] = { FilterType::OrdinaryLeastSquares,
+      FilterType::WeightedLeastSquares, FilterType::IterativelyReweightedLeastSquares };
+    FilterType::TensorPixelType outlierTensors[3], noisyTensors[3];
+    for (size_t mode = 0; mode < 3; mode++)
+    {
+      filter->SetFittingMode(fittingModes[mode]);
+      filter->Update();
+
+      const FilterType::TensorPixelType *output = filter->GetOutput()->GetBufferPointer();
+      const float *residuals = filter->GetResidualImage()->GetBufferPointer();
+      const float *baselines = filter->GetBaselineImage()->GetBufferPointer();
+      outlierTensors[mode] = output[outlierVoxel];
+      noisyTensors[mode] = output[noisyVoxel];
+      for (size_t i = 0; i < filter->GetOutput()->GetBufferedRegion().GetNumberOfPixels(); i++)
+      {
+        if ((i == outlierVoxel) || (i == noisyVoxel))
+        {
+          continue;
+        }
+        for (size_t k = 0; k < 6; k++)
+        {
+          if (std::abs(output[i][k] - tensor[k]) > 1e-6)
+          {
+            return EXIT_FAILURE;
+          }
+        }
+        for (size_t g = 0; g < 12; g++)
+        {
+          if (std::abs(residuals[i * 12 + g]) > 1e-2)
+          {
+            return EXIT_FAILURE;
+          }
+        }
+        if (baselines[i] != S0)
+        {
+          return EXIT_FAILURE;
+        }
+      }
+    }
+
+    // the robust fit should (almost entirely) reject the dropout, unlike the ordinary fit
+    auto tensorError = [&tensor](const FilterType::TensorPixelType &fitted)
+    {
+      double error = 0;
+      for (size_t k = 0; k < 6; k++)
+      {
+        error += (fitted[k] - tensor[k]) * (fitted[k] - tensor[k]);
+      }
+      return std::sqrt(error);
+    };
+    if (!(tensorError(outlierTensors[2]) < tensorError(outlierTensors[0])) || (tensorError(outlierTensors[2]) > 1e-6))
+    {
+      return EXIT_FAILURE;
+    }
+    // with signal dependent noise, the weights make a difference
+    double weightingDifference = 0;
+    for (size_t k = 0; k < 6; k++)
+    {
+      weightingDifference = std::max(weightingDifference, std::abs(noisyTensors[1][k] - noisyTensors[0][k]));
+    }
+    if (weightingDifference < 1e-6)
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
   return EXIT_SUCCESS;
 }
\ No newline at end of file
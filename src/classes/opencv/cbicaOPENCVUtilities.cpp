@@ -1,3 +1,6 @@
+#include <cstdint>
+#include <cstring>
+
 #include "cbicaOPENCVUtilities.h"
 
 namespace cbica
@@ -64,51 +67,254 @@ namespace cbica
 
   void SaveAsCSV(const cv::Mat &inputMat, const std::string &filename)
   {
-    std::ofstream myfile;
-    myfile.open(filename.c_str());
-    myfile << cv::format(inputMat, cv::Formatter::FMT_CSV) << std::endl;
+    std::ofstream myfile(filename.c_str(), std::ios::binary);
+    if (!myfile.is_open())
+    {
+      std::cerr << "Could not open '" << filename << "' for writing.\n";
+      return;
+    }
+
+    // channels are written as columns; float and double are written directly, half floats as float and integer depths 
+    // as (exact) 32-bit integers
+    cv::Mat data = inputMat.reshape(1);
+#ifdef CV_16F
+    if (data.depth() == CV_16F)
+    {
+      data.convertTo(data, CV_32F);
+    }
+#endif
+    const bool isDouble = (data.depth() == CV_64F);
+    const bool isInteger = !isDouble && (data.depth() != CV_32F);
+    if (isInteger && (data.depth() != CV_32S))
+    {
+      data.convertTo(data, CV_32S);
+    }
+
+    // rows are formatted into a buffer which is written out in large blocks
+    const size_t flushSize = 1 << 20;
+    std::string buffer;
+    buffer.reserve(flushSize + 64 * static_cast< size_t >(data.cols));
+    char cell[32];
+    for (int i = 0; i < data.rows; i++)
+    {
+      for (int j = 0; j < data.cols; j++)
+      {
+        // enough digits to read back the exact same value
+        const int length = isDouble ? snprintf(cell, sizeof(cell), "%.17g", data.ptr< double >(i)[j]) :
+          (isInteger ? snprintf(cell, sizeof(cell), "%d", data.ptr< int >(i)[j]) :
+          snprintf(cell, sizeof(cell), "%.9g", data.ptr< float >(i)[j]));
+        buffer.append(cell, static_cast< size_t >(length));
+        buffer.push_back((j + 1 < data.cols) ? ',' : '\n');
+      }
+      if (buffer.size() >= flushSize)
+      {
+        myfile.write(buffer.data(), buffer.size());
+        buffer.clear();
+      }
+    }
+    myfile.write(buffer.data(), buffer.size());
     myfile.close();
   }
 
   cv::Mat ReadFromCSV(const std::string &filename)
   {
-    std::ifstream inputfile(filename.c_str());
+    auto all_data = cbica::readCSVDataMatrix< float >(filename);
+    if ((all_data.rows == 0) || (all_data.cols == 0))
+    {
+      std::cerr << "No data could be read from '" << filename << "'.\n";
+      return cv::Mat();
+    }
 
-    std::string current_line;
+    // the parsed data is already contiguous and row-major
+    cv::Mat vect((int)all_data.rows, (int)all_data.cols, CV_32FC1);
+    std::copy(all_data.data.begin(), all_data.data.end(), vect.ptr< float >(0));
 
-    // vector allows you to add data without knowing the exact size beforehand
-    std::vector< std::vector<float> > all_data;
+    return vect;
+  }
 
-    // Start reading lines as long as there are lines in the file
-    while (getline(inputfile, current_line))
+  CSVRowBlockReader::CSVRowBlockReader(const std::string &filename, size_t blockRows, char delimiter) :
+    m_file(filename), m_blockRows(std::max< size_t >(1, blockRows)), m_delimiter(delimiter)
+  {
+    if (!m_file.IsOpen())
     {
-      // Now inside each line we need to seperate the cols
-      std::vector< float > values;
-      std::stringstream temp(current_line);
-      std::string single_value;
-      while (getline(temp, single_value, ','))
+      std::cerr << "Could not open '" << filename << "' for reading.\n";
+      return;
+    }
+    m_current = m_file.GetData();
+    m_end = m_file.GetData() + m_file.GetSize();
+
+    // columns come from the first non-empty line
+    for (auto lineBegin = m_current; lineBegin < m_end;)
+    {
+      auto lineEnd = std::find(lineBegin, m_end, '\n');
+      auto nextLine = (lineEnd < m_end) ? lineEnd + 1 : m_end;
+      if ((lineEnd > lineBegin) && (*(lineEnd - 1) == '\r'))
+      {
+        lineEnd--;
+      }
+      if (lineEnd > lineBegin)
+      {
+        m_cols = static_cast< int >(std::count(lineBegin, lineEnd, m_delimiter)) + 1;
+        break;
+      }
+      lineBegin = nextLine;
+    }
+  }
+
+  bool CSVRowBlockReader::ReadNextBlock(cv::Mat &outputBlock)
+  {
+    if (m_cols == 0)
+    {
+      return false;
+    }
+
+    // find the extent of the next block of non-empty lines
+    std::vector< std::pair< const char *, const char * > > lines;
+    lines.reserve(m_blockRows);
+    while ((m_current < m_end) && (lines.size() < m_blockRows))
+    {
+      auto lineEnd = std::find(m_current, m_end, '\n');
+      auto nextLine = (lineEnd < m_end) ? lineEnd + 1 : m_end;
+      if ((lineEnd > m_current) && (*(lineEnd - 1) == '\r'))
       {
-        // convert the string element to a integer value
-        values.push_back(atof(single_value.c_str()));
+        lineEnd--;
       }
-      // add the row to the complete data vector
-      if (!values.empty())
+      if (lineEnd > m_current)
       {
-        all_data.push_back(values);
+        lines.emplace_back(m_current, lineEnd);
       }
+      m_current = nextLine;
+    }
+    if (lines.empty())
+    {
+      return false;
     }
 
-    // Now add all the data into a Mat element
-    cv::Mat vect = cv::Mat::zeros((int)all_data.size(), (int)all_data[0].size(), CV_32FC1);
-    // Loop over vectors and add the data
-    for (int rows = 0; rows < (int)all_data.size(); rows++)
+    outputBlock.create(static_cast< int >(lines.size()), m_cols, CV_32FC1);
+    outputBlock.setTo(0);
+
+    // a line holds many cells, so the thread team pays off at far fewer lines than elements in the other loops
+    const int numberOfLines = static_cast< int >(lines.size());
+#pragma omp parallel for if (numberOfLines > 1024)
+    for (int i = 0; i < numberOfLines; i++)
     {
-      for (int cols = 0; cols< (int)all_data[0].size(); cols++)
+      auto rowPointer = outputBlock.ptr< float >(i);
+      auto cellBegin = lines[i].first, lineEnd = lines[i].second;
+      for (int j = 0; j < m_cols; j++)
       {
-        vect.ptr< float >(rows)[cols] = all_data[rows][cols];
+        auto cellEnd = std::find(cellBegin, lineEnd, m_delimiter);
+        rowPointer[j] = static_cast< float >(cbica::parseCSVNumber(cellBegin, cellEnd));
+        if (cellEnd == lineEnd)
+        {
+          break;
+        }
+        cellBegin = cellEnd + 1;
       }
     }
 
-    return vect;
+    m_rowsRead += lines.size();
+    return true;
+  }
+
+  namespace
+  {
+    //! On-disk header of the binary matrix format; the data follows at offset sizeof(BinaryMatrixHeader)
+    struct BinaryMatrixHeader
+    {
+      char magic[4];
+      uint32_t version;
+      uint64_t rows, cols;
+      uint64_t reserved;
+    };
+    static_assert(sizeof(BinaryMatrixHeader) == 32, "Binary matrix header needs to be 32 bytes");
+
+    const char binaryMatrixMagic[4] = { 'C', 'B', 'M', 'T' };
+    const uint32_t binaryMatrixVersion = 1;
+
+    //! Checks the header of a mapped binary matrix and returns a pointer to its data (or nullptr)
+    const float *GetBinaryMatrixData(const MemoryMappedFile &file, BinaryMatrixHeader &header)
+    {
+      if (!file.IsOpen() || (file.GetSize() < sizeof(BinaryMatrixHeader)))
+      {
+        return nullptr;
+      }
+      memcpy(&header, file.GetData(), sizeof(BinaryMatrixHeader));
+      if ((memcmp(header.magic, binaryMatrixMagic, 4) != 0) || (header.version != binaryMatrixVersion) ||
+        (header.rows > static_cast< uint64_t >(std::numeric_limits< int >::max())) || (header.cols > static_cast< uint64_t >(std::numeric_limits< int >::max())) ||
+        (file.GetSize() - sizeof(BinaryMatrixHeader) < header.rows * header.cols * sizeof(float)))
+      {
+        return nullptr;
+      }
+      return reinterpret_cast< const float * >(file.GetData() + sizeof(BinaryMatrixHeader));
+    }
+  }
+
+  bool SaveAsBinary(const cv::Mat &inputMat, const std::string &filename)
+  {
+    std::ofstream myfile(filename.c_str(), std::ios::binary);
+    if (!myfile.is_open())
+    {
+      std::cerr << "Could not open '" << filename << "' for writing.\n";
+      return false;
+    }
+
+    cv::Mat data = inputMat.reshape(1);
+    if (data.depth() != CV_32F)
+    {
+      data.convertTo(data, CV_32F);
+    }
+
+    BinaryMatrixHeader header;
+    memcpy(header.magic, binaryMatrixMagic, 4);
+    header.version = binaryMatrixVersion;
+    header.rows = static_cast< uint64_t >(data.rows);
+    header.cols = static_cast< uint64_t >(data.cols);
+    header.reserved = 0;
+    myfile.write(reinterpret_cast< const char * >(&header), sizeof(header));
+
+    if (data.isContinuous())
+    {
+      myfile.write(reinterpret_cast< const char * >(data.ptr< float >(0)), data.total() * sizeof(float));
+    }
+    else
+    {
+      for (int i = 0; i < data.rows; i++)
+      {
+        myfile.write(reinterpret_cast< const char * >(data.ptr< float >(i)), data.cols * sizeof(float));
+      }
+    }
+
+    return myfile.good();
+  }
+
+  cv::Mat ReadFromBinary(const std::string &filename)
+  {
+    MemoryMappedFile file(filename);
+    BinaryMatrixHeader header;
+    auto data = GetBinaryMatrixData(file, header);
+    if (data == nullptr)
+    {
+      std::cerr << "'" << filename << "' is not a valid binary matrix file.\n";
+      return cv::Mat();
+    }
+
+    cv::Mat returnMat(static_cast< int >(header.rows), static_cast< int >(header.cols), CV_32FC1);
+    if (!returnMat.empty())
+    {
+      memcpy(returnMat.ptr< float >(0), data, header.rows * header.cols * sizeof(float));
+    }
+    return returnMat;
+  }
+
+  BinaryMatrixView::BinaryMatrixView(const std::string &filename) : m_file(filename)
+  {
+    BinaryMatrixHeader header;
+    auto data = GetBinaryMatrixData(m_file, header);
+    if (data == nullptr)
+    {
+      std::cerr << "'" << filename << "' is not a valid binary matrix file.\n";
+      return;
+    }
+    m_mat = cv::Mat(static_cast< int >(header.rows), static_cast< int >(header.cols), CV_32FC1, const_cast< float * >(data));
   }
-}
\ No newline at end of file
+}
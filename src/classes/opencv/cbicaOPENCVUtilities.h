@@ -117,6 +117,8 @@ namespace cbica
   /**
   \brief Save input matrix as a csv
 
+  Rows are formatted into a fixed-size buffer which is flushed in large blocks; multi-channel matrices are written with the channels as columns. Integer depths are written as integers and half floats as floats, so no precision is lost.
+
   \param inputMat The input matrix to save
   \param filename The filename to save the matrix to
   */
@@ -130,4 +132,92 @@ namespace cbica
   \param filename The filename to read
   */
   cv::Mat ReadFromCSV(const std::string &filename);
+
+  /**
+  \brief Reads a CSV (no header) in fixed-size blocks of rows, so that the entire matrix never needs to be in memory
+
+  Usage:
+  \verbatim
+  cbica::CSVRowBlockReader reader("features.csv", 4096);
+  cv::Mat block;
+  while (reader.ReadNextBlock(block))
+  {
+    // block is a (<=4096)xN CV_32F matrix
+  }
+  \endverbatim
+  */
+  class CSVRowBlockReader
+  {
+  public:
+    /**
+    \brief Constructor
+
+    \param filename The CSV file to read (no header information)
+    \param blockRows Maximum number of rows returned by each call of ReadNextBlock()
+    \param delimiter The column delimiter
+    */
+    CSVRowBlockReader(const std::string &filename, size_t blockRows = 4096, char delimiter = ',');
+
+    /**
+    \brief Parses the next block of rows into outputBlock (CV_32F); returns false once the file is exhausted
+
+    outputBlock is only re-allocated if its size or type changes, so the same matrix can be reused across calls.
+    */
+    bool ReadNextBlock(cv::Mat &outputBlock);
+
+    //! Number of columns (from the first line)
+    int GetNumberOfColumns() const { return m_cols; }
+
+    //! Number of rows returned so far
+    size_t GetNumberOfRowsRead() const { return m_rowsRead; }
+
+  private:
+    MemoryMappedFile m_file;
+    const char *m_current = nullptr, *m_end = nullptr;
+    size_t m_blockRows = 4096, m_rowsRead = 0;
+    char m_delimiter = ',';
+    int m_cols = 0;
+  };
+
+  /**
+  \brief Save input matrix in the binary sidecar format
+
+  Layout: a 32-byte header ("CBMT", uint32 version, uint64 rows, uint64 cols, 8 reserved bytes) followed by the rows as
+  contiguous float32 values in native byte order. The data starts at a fixed offset so that the file can be memory-mapped
+  (see BinaryMatrixView). Multi-channel inputs are stored with the channels as columns.
+
+  \param inputMat The input matrix to save (converted to CV_32F if needed)
+  \param filename The filename to save the matrix to; the convention is to use the CSV file name with '.bin' appended
+  \return True if the file was written
+  */
+  bool SaveAsBinary(const cv::Mat &inputMat, const std::string &filename);
+
+  /**
+  \brief Read a matrix saved with SaveAsBinary(); returns an empty matrix if the file is not valid
+
+  \param filename The filename to read
+  */
+  cv::Mat ReadFromBinary(const std::string &filename);
+
+  /**
+  \brief Read-only, zero-copy view of a matrix saved with SaveAsBinary()
+
+  The returned cv::Mat wraps the mapped file; it must not be written to and is only valid while the view exists.
+  */
+  class BinaryMatrixView
+  {
+  public:
+    //! Constructor with the file to map
+    explicit BinaryMatrixView(const std::string &filename);
+
+    //! Whether the file was a valid binary matrix
+    bool IsValid() const { return !m_mat.empty(); }
+
+    //! The CV_32F matrix backed by the mapped file
+    const cv::Mat &GetMat() const { return m_mat; }
+
+  private:
+    MemoryMappedFile m_file;
+    cv::Mat m_mat;
+  };
 }
\ No newline at end of file
@@ -28,6 +28,7 @@ int main(int argc, char** argv)
 {
   cbica::CmdParser parser(argc, argv);
   parser.addOptionalParameter("r", "roc", cbica::Parameter::NONE, "", "ROC test");
+  parser.addOptionalParameter("m", "matrixIO", cbica::Parameter::NONE, "", "CSV and binary matrix I/O test");
 
   if (parser.isPresent("r"))
   {
@@ -49,5 +50,72 @@ int main(int argc, char** argv)
     int blah = 1;
   }
 
+  if (parser.isPresent("m"))
+  {
+    const std::string outputDir = argv[2];
+    const std::string csvFile = outputDir + "/matrixIO.csv", binaryFile = csvFile + ".bin";
+
+    cv::Mat inputData(1001, 13, CV_32FC1);
+    cv::randn(inputData, 0, 100);
+
+    // CSV round trip needs to be exact
+    cbica::SaveAsCSV(inputData, csvFile);
+    auto csvData = cbica::ReadFromCSV(csvFile);
+    if ((csvData.size() != inputData.size()) || (cv::countNonZero(csvData != inputData) != 0))
+    {
+      return EXIT_FAILURE;
+    }
+
+    // integers beyond the float mantissa need to be written exactly
+    const std::string integerFile = outputDir + "/matrixIO_integer.csv";
+    cv::Mat integerData(17, 3, CV_32SC1);
+    cv::randu(integerData, 16777217, 2147483647);
+    cbica::SaveAsCSV(integerData, integerFile);
+    auto integerCSV = cbica::readCSVDataMatrix< double >(integerFile);
+    if ((integerCSV.rows != static_cast< size_t >(integerData.rows)) || (integerCSV.cols != static_cast< size_t >(integerData.cols)))
+    {
+      return EXIT_FAILURE;
+    }
+    for (int i = 0; i < integerData.rows; i++)
+    {
+      for (int j = 0; j < integerData.cols; j++)
+      {
+        if (integerCSV(i, j) != integerData.ptr< int >(i)[j])
+        {
+          return EXIT_FAILURE;
+        }
+      }
+    }
+
+    // blocks should cover the entire matrix in order
+    cbica::CSVRowBlockReader reader(csvFile, 100);
+    cv::Mat block;
+    int rowsRead = 0;
+    while (reader.ReadNextBlock(block))
+    {
+      if (cv::countNonZero(block != inputData.rowRange(rowsRead, rowsRead + block.rows)) != 0)
+      {
+        return EXIT_FAILURE;
+      }
+      rowsRead += block.rows;
+    }
+    if (rowsRead != inputData.rows)
+    {
+      return EXIT_FAILURE;
+    }
+
+    // binary sidecar, both copied and mapped
+    if (!cbica::SaveAsBinary(inputData, binaryFile))
+    {
+      return EXIT_FAILURE;
+    }
+    auto binaryData = cbica::ReadFromBinary(binaryFile);
+    cbica::BinaryMatrixView binaryView(binaryFile);
+    if (!binaryView.IsValid() || (cv::countNonZero(binaryData != inputData) != 0) || (cv::countNonZero(binaryView.GetMat() != inputData) != 0))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
   return EXIT_SUCCESS;
 }
\ No newline at end of file
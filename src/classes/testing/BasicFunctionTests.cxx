@@ -15,6 +15,7 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html.
 #include <stdlib.h>
 #include <string>
 #include <algorithm>
+#include <array>
 #include <exception>
 #include <typeinfo>
 #include <stdexcept>
@@ -29,6 +30,7 @@ See COPYING file or https://www.cbica.upenn.edu/sbia/software/license.html.
 
 #include "cbicaUtilities.h"
 #include "cbicaStatistics.h"
+#include "cbicaTensorScalars.h"
 #include "cbicaLogging.h"
 #include "cbicaCmdParser.h"
 
@@ -56,6 +58,14 @@ int main(int argc, char** argv)
   parser.addOptionalParameter("v", "variadic", cbica::Parameter::NONE, "", "variadic Test");
   parser.addOptionalParameter("r", "roc", cbica::Parameter::NONE, "", "ROC test");
   parser.addOptionalParameter("z", "zscore", cbica::Parameter::NONE, "", "ZScore test");
+  parser.addOptionalParameter("s3", "streamingStats", cbica::Parameter::NONE, "", "Streaming Statistics test");
+  parser.addOptionalParameter("q", "quantileSketch", cbica::Parameter::NONE, "", "Quantile Sketch test");
+  parser.addOptionalParameter("c4", "confusionMatrix", cbica::Parameter::NONE, "", "Confusion Matrix on raw buffers test");
+  parser.addOptionalParameter("a", "auc", cbica::Parameter::NONE, "", "ROC curve and AUC test");
+  parser.addOptionalParameter("lc", "labelCooccurrence", cbica::Parameter::NONE, "", "Label co-occurrence table test");
+  parser.addOptionalParameter("u", "uniqueValues", cbica::Parameter::NONE, "", "Unique values and counts test");
+  parser.addOptionalParameter("cv", "changeValues", cbica::Parameter::NONE, "", "Change values with lookup and hash tables test");
+  parser.addOptionalParameter("ts", "tensorScalars", cbica::Parameter::NONE, "", "Closed-form tensor eigen-analysis and scalars test");
 
   int tempPostion;
   if (parser.compareParameter("buffer", tempPostion))
@@ -308,6 +318,22 @@ int main(int argc, char** argv)
         return EXIT_FAILURE;
       }
     }
+
+    // contiguous buffer should have the same values in both layouts
+    auto matrix = cbica::readCSVDataMatrix< double >(csvFileName);
+    auto matrix_col = cbica::readCSVDataMatrix< double >(csvFileName, true);
+    if ((matrix.rows != 100) || (matrix.cols != 1) || (matrix_col.rows != 100) || (matrix_col.cols != 1))
+    {
+      return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < matrix.rows; i++)
+    {
+      if ((matrix(i, 0) != parsedCsv[i][0]) || (matrix_col(i, 0) != parsedCsv_col[0][i]) ||
+        (matrix(i, 0) != std::atof(cbica::readCSVDataFile(csvFileName)[i][0].c_str())))
+      {
+        return EXIT_FAILURE;
+      }
+    }
   }
 
   if (parser.compareParameter("deleteFile", tempPostion))
@@ -533,6 +559,334 @@ int main(int argc, char** argv)
     }
   }
 
+  if (parser.isPresent("confusionMatrix"))
+  {
+    const std::string dataDir = argv[2];
+    auto realLabels = cbica::readCSVDataFile< float >(dataDir + "/labels_real.csv", true);
+    auto predLabels = cbica::readCSVDataFile< float >(dataDir + "/labels_predicted.csv", true);
+
+    // the integer buffers should give exactly the same counts as the float adapter
+    std::vector< unsigned char > realLabels_uchar(realLabels[0].begin(), realLabels[0].end());
+    std::vector< short > predLabels_short(predLabels[0].begin(), predLabels[0].end());
+    auto counts = cbica::GetConfusionMatrixCounts(realLabels_uchar.data(), predLabels_short.data(), realLabels_uchar.size());
+    auto countsMap = cbica::ConfusionMatrix(realLabels[0], predLabels[0]);
+
+    if ((counts.ToMap() != countsMap) || (counts.GetTotal() != realLabels[0].size()) ||
+      (counts.TP + counts.FN != counts.RP) || (counts.TP + counts.FP != counts.PP))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (parser.isPresent("changeValues"))
+  {
+    // swap labels 1 and 2 and map 4 to 3 (the first mapping of 4 wins); 1.5 only applies to the float buffer
+    const std::vector< double > oldValues = { 1, 2, 4, 1.5, 4 }, newValues = { 2, 1, 3, 7, 9 };
+    const size_t size = 100000;
+    std::vector< unsigned char > labels(size), labels_relabeled(size);
+    std::vector< float > labels_float(size);
+    for (size_t i = 0; i < size; i++)
+    {
+      labels[i] = static_cast< unsigned char >((i / 5) % 6);
+      labels_float[i] = (i % 11 == 0) ? 1.5f : labels[i];
+    }
+    auto expected = [](double value) { return (value == 1) ? 2 : ((value == 2) ? 1 : ((value == 4) ? 3 : value)); };
+
+    // the lookup table (copy), the hash table (in-place) and a mismatched mapping
+    if (!cbica::ChangeValuesInBuffer(labels.data(), labels_relabeled.data(), size, oldValues, newValues) ||
+      !cbica::ChangeValuesInBuffer(labels_float.data(), labels_float.data(), size, oldValues, newValues) ||
+      cbica::ChangeValuesInBuffer(labels.data(), labels.data(), size, oldValues, std::vector< double >(2)))
+    {
+      return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+      const float expected_float = (i % 11 == 0) ? 7.0f : static_cast< float >(expected(labels[i]));
+      if ((labels_relabeled[i] != expected(labels[i])) || (labels_float[i] != expected_float))
+      {
+        return EXIT_FAILURE;
+      }
+    }
+
+    // the range of 64-bit old values can overflow a signed difference, which should fall back to the hash table
+    const long long farValue = 1ll << 62;
+    std::vector< long long > wideLabels = { -farValue, 0, farValue, 5 };
+    std::vector< unsigned long long > wideUnsignedLabels = { 1, std::numeric_limits< unsigned long long >::max(), 3 };
+    if (!cbica::ChangeValuesInBuffer(wideLabels.data(), wideLabels.data(), wideLabels.size(),
+      { static_cast< double >(-farValue), static_cast< double >(farValue) }, { 1, 2 }) ||
+      !cbica::ChangeValuesInBuffer(wideUnsignedLabels.data(), wideUnsignedLabels.data(), wideUnsignedLabels.size(), { 1, 3 }, { 3, 1 }) ||
+      (wideLabels != std::vector< long long >({ 1, 0, 2, 5 })) ||
+      (wideUnsignedLabels != std::vector< unsigned long long >({ 3, std::numeric_limits< unsigned long long >::max(), 1 })))
+    {
+      return EXIT_FAILURE;
+    }
+
+    // 2^63 and 2^64 are the doubles nearest to the 64-bit maxima, but are out of range and should not be mapped
+    std::vector< long long > edgeLabels = { std::numeric_limits< long long >::max(), std::numeric_limits< long long >::lowest() };
+    std::vector< unsigned long long > edgeUnsignedLabels = { std::numeric_limits< unsigned long long >::max(), 0 };
+    const auto edgeLabelsInput = edgeLabels;
+    const auto edgeUnsignedLabelsInput = edgeUnsignedLabels;
+    if (!cbica::ChangeValuesInBuffer(edgeLabels.data(), edgeLabels.data(), edgeLabels.size(), { std::ldexp(1.0, 63) }, { 7 }) ||
+      !cbica::ChangeValuesInBuffer(edgeUnsignedLabels.data(), edgeUnsignedLabels.data(), edgeUnsignedLabels.size(), { std::ldexp(1.0, 64) }, { 7 }) ||
+      (edgeLabels != edgeLabelsInput) || (edgeUnsignedLabels != edgeUnsignedLabelsInput))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (parser.isPresent("tensorScalars"))
+  {
+    // tensors (xx, xy, xz, yy, yz, zz) with distinct, repeated (prolate, oblate), nearly repeated, isotropic and zero eigenvalues,
+    // rotated by R = Rz(0.3) * Rx(0.7) unless they are diagonal
+    const double eigenValueSets[7][3] = { { 0.3e-3, 0.5e-3, 1.7e-3 }, { 0.3e-3, 0.3e-3, 1.7e-3 }, { 0.3e-3, 1.7e-3, 1.7e-3 },
+      { 1e-3, 1e-3, 1e-3 + 1e-12 }, { 1e-3, 1e-3, 1e-3 }, { 0, 0, 0 }, { -0.1e-3, 0.2e-3, 0.9e-3 } };
+    const double cz = std::cos(0.3), sz = std::sin(0.3), cx = std::cos(0.7), sx = std::sin(0.7);
+    const double rotation[3][3] = { { cz, -sz * cx, sz * sx }, { sz, cz * cx, -cz * sx }, { 0, sx, cx } };
+    std::vector< std::array< double, 6 > > allTensors;
+    for (size_t set = 0; set < 7; set++)
+    {
+      double matrix[3][3];
+      for (size_t r = 0; r < 3; r++)
+      {
+        for (size_t c = 0; c < 3; c++)
+        {
+          matrix[r][c] = 0;
+          for (size_t k = 0; k < 3; k++)
+          {
+            matrix[r][c] += rotation[r][k] * eigenValueSets[set][k] * rotation[c][k];
+          }
+        }
+      }
+      const double tensor[6] = { matrix[0][0], matrix[0][1], matrix[0][2], matrix[1][1], matrix[1][2], matrix[2][2] };
+      allTensors.push_back({ { tensor[0], tensor[1], tensor[2], tensor[3], tensor[4], tensor[5] } });
+      const auto eigenSystem = cbica::ComputeSymmetricEigenSystem3x3(tensor);
+      for (size_t i = 0; i < 3; i++)
+      {
+        if (std::abs(eigenSystem.eigenValues[i] - eigenValueSets[set][i]) > 1e-15)
+        {
+          return EXIT_FAILURE;
+        }
+        // A * v = lambda * v, with orthonormal eigenvectors
+        for (size_t r = 0; r < 3; r++)
+        {
+          double product = 0;
+          for (size_t k = 0; k < 3; k++)
+          {
+            product += matrix[r][k] * eigenSystem.eigenVectors[i][k];
+          }
+          if (std::abs(product - eigenSystem.eigenValues[i] * eigenSystem.eigenVectors[i][r]) > 1e-15)
+          {
+            return EXIT_FAILURE;
+          }
+        }
+        for (size_t j = 0; j < 3; j++)
+        {
+          double product = 0;
+          for (size_t k = 0; k < 3; k++)
+          {
+            product += eigenSystem.eigenVectors[i][k] * eigenSystem.eigenVectors[j][k];
+          }
+          if (std::abs(product - ((i == j) ? 1 : 0)) > 1e-12)
+          {
+            return EXIT_FAILURE;
+          }
+        }
+      }
+
+      // FA from the eigenvalues should match the one from the tensor elements (as in itk::DiffusionTensor3D)
+      const auto scalars = cbica::ComputeTensorScalars(eigenSystem.eigenValues);
+      const double trace = tensor[0] + tensor[3] + tensor[5],
+        innerProduct = tensor[0] * tensor[0] + tensor[3] * tensor[3] + tensor[5] * tensor[5] +
+        2 * (tensor[1] * tensor[1] + tensor[2] * tensor[2] + tensor[4] * tensor[4]);
+      const double fa = (innerProduct > 0) ? std::sqrt(std::max(0.0, 3 * innerProduct - trace * trace) / (2 * innerProduct)) : 0;
+      if ((std::abs(scalars.FA - fa) > 1e-6) || (std::abs(scalars.TR - trace) > 1e-15) ||
+        (scalars.AD != eigenSystem.eigenValues[2]) || !std::isfinite(scalars.R3) || !std::isfinite(scalars.K3))
+      {
+        return EXIT_FAILURE;
+      }
+    }
+
+    // the maps of a buffer of tensors should match the per-tensor results, with L1/V1 as the largest eigen-pair
+    const size_t numberOfTensors = allTensors.size();
+    std::vector< float > faMap(numberOfTensors), k3Map(numberOfTensors), l1Map(numberOfTensors), l3Map(numberOfTensors), v1Map(3 * numberOfTensors);
+    cbica::TensorScalarBuffers< float > scalarBuffers;
+    scalarBuffers.FA = faMap.data();
+    scalarBuffers.K3 = k3Map.data();
+    scalarBuffers.eigenValues[0] = l1Map.data();
+    scalarBuffers.eigenValues[2] = l3Map.data();
+    scalarBuffers.eigenVectors[0] = v1Map.data();
+    cbica::ComputeTensorScalarMaps(allTensors.data(), numberOfTensors, scalarBuffers);
+    for (size_t i = 0; i < numberOfTensors; i++)
+    {
+      const auto eigenSystem = cbica::ComputeSymmetricEigenSystem3x3(allTensors[i]);
+      const auto scalars = cbica::ComputeTensorScalars(eigenSystem.eigenValues);
+      if ((faMap[i] != static_cast< float >(scalars.FA)) || (k3Map[i] != static_cast< float >(scalars.K3)) ||
+        (l1Map[i] != static_cast< float >(eigenSystem.eigenValues[2])) || (l3Map[i] != static_cast< float >(eigenSystem.eigenValues[0])))
+      {
+        return EXIT_FAILURE;
+      }
+      for (size_t k = 0; k < 3; k++)
+      {
+        if (v1Map[3 * i + k] != static_cast< float >(eigenSystem.eigenVectors[2][k]))
+        {
+          return EXIT_FAILURE;
+        }
+      }
+    }
+  }
+
+  if (parser.isPresent("uniqueValues"))
+  {
+    // both the histogram (16-bit) and the run list (float) paths should give the same sorted values and counts
+    const size_t size = 100000;
+    std::vector< short > labels_short(size);
+    std::vector< float > labels_float(size);
+    std::map< short, size_t > expectedCounts;
+    for (size_t i = 0; i < size; i++)
+    {
+      labels_short[i] = static_cast< short >(((i / 7) % 13) * 100 - 400);
+      labels_float[i] = labels_short[i];
+      expectedCounts[labels_short[i]]++;
+    }
+
+    auto counts_short = cbica::GetUniqueValuesAndCounts(labels_short.data(), size);
+    auto counts_float = cbica::GetUniqueValuesAndCounts(labels_float.data(), size);
+    if ((counts_short.size() != expectedCounts.size()) || (counts_float.size() != expectedCounts.size()))
+    {
+      return EXIT_FAILURE;
+    }
+    size_t i = 0;
+    for (const auto &expected : expectedCounts)
+    {
+      if ((counts_short[i].first != expected.first) || (counts_short[i].second != expected.second) ||
+        (counts_float[i].first != expected.first) || (counts_float[i].second != expected.second))
+      {
+        return EXIT_FAILURE;
+      }
+      i++;
+    }
+  }
+
+  if (parser.isPresent("labelCooccurrence"))
+  {
+    // BraTS-like labels, where the prediction is shifted with respect to the reference
+    const size_t size = 64 * 64 * 64;
+    std::vector< unsigned char > realLabels(size, 0), predLabels(size, 0);
+    for (size_t i = 0; i < size; i++)
+    {
+      const size_t x = i % 64, z = i / (64 * 64);
+      if ((z > 20) && (z < 40) && (x > 10) && (x < 50))
+      {
+        realLabels[i] = (x < 20) ? 1 : ((x < 35) ? 2 : 4);
+        predLabels[i] = (x < 22) ? 1 : ((x < 33) ? 2 : ((x < 48) ? 4 : 0));
+      }
+    }
+
+    auto labelTable = cbica::GetLabelCooccurrence(realLabels.data(), predLabels.data(), size);
+    if ((labelTable.total != size) || (labelTable.labels_1.size() != 4) || (labelTable.labels_2.size() != 4))
+    {
+      return EXIT_FAILURE;
+    }
+
+    const std::vector< std::vector< double > > regions = { { 0 }, { 1 }, { 2 }, { 4 }, { 1, 4 }, { 1, 2, 4 } };
+    for (const auto &region : regions)
+    {
+      // the region counts should be the same as the ones from the binary masks of the region
+      std::vector< unsigned char > realMask(size), predMask(size);
+      for (size_t i = 0; i < size; i++)
+      {
+        realMask[i] = (std::find(region.begin(), region.end(), realLabels[i]) != region.end());
+        predMask[i] = (std::find(region.begin(), region.end(), predLabels[i]) != region.end());
+      }
+      if (labelTable.GetRegionCounts(region).ToMap() != cbica::GetConfusionMatrixCounts(realMask.data(), predMask.data(), size).ToMap())
+      {
+        return EXIT_FAILURE;
+      }
+
+      if (region.size() == 1)
+      {
+        if (labelTable.GetConfusionMatrixCounts(region[0]).ToMap() != 
+          cbica::GetConfusionMatrixCounts(realLabels.data(), predLabels.data(), size, region[0]).ToMap())
+        {
+          return EXIT_FAILURE;
+        }
+      }
+    }
+
+    // label 1 is [11,20) in the reference and [11,22) in the prediction
+    auto overlap = cbica::GetOverlapMeasures(labelTable.GetRegionCounts({ 1 }));
+    if ((std::abs(overlap["Dice"] - 2.0 * 9 / (9 + 11)) > 1e-10) || (std::abs(overlap["Jaccard"] - 9.0 / 11) > 1e-10))
+    {
+      return EXIT_FAILURE;
+    }
+
+    // a region missing in both is a perfect match
+    if (cbica::GetOverlapMeasures(labelTable.GetRegionCounts({ 3 }))["Dice"] != 1)
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (parser.isPresent("auc"))
+  {
+    const std::string dataDir = argv[2];
+    auto realLabels = cbica::readCSVDataFile< float >(dataDir + "/labels_real.csv", true);
+    auto scores = cbica::readCSVDataFile< float >(dataDir + "/input.csv", true);
+
+    // the AUC is the probability that a positive is scored higher than a negative (Mann-Whitney U), ties counting as half
+    double wins = 0;
+    size_t positives = 0, negatives = 0;
+    for (size_t i = 0; i < realLabels[0].size(); i++)
+    {
+      if (realLabels[0][i] == 1)
+      {
+        positives++;
+        for (size_t j = 0; j < realLabels[0].size(); j++)
+        {
+          if (realLabels[0][j] != 1)
+          {
+            wins += (scores[0][i] > scores[0][j]) ? 1 : ((scores[0][i] == scores[0][j]) ? 0.5 : 0);
+          }
+        }
+      }
+      else
+      {
+        negatives++;
+      }
+    }
+    const double expectedAUC = wins / static_cast< double >(positives * negatives);
+
+    auto exactCurve = cbica::GetROCCurve(realLabels[0], scores[0]);
+    auto binnedCurve = cbica::GetROCCurve(realLabels[0], scores[0], 4096);
+    if ((std::abs(exactCurve.auc - expectedAUC) > 1e-6) || (std::abs(cbica::area_under_curve(realLabels[0], scores[0]) - expectedAUC) > 1e-5) ||
+      (std::abs(binnedCurve.auc - expectedAUC) > 1e-2))
+    {
+      return EXIT_FAILURE;
+    }
+
+    // the curve goes from (0,0) to (1,1)
+    if ((exactCurve.truePositiveRates.front() != 0) || (exactCurve.falsePositiveRates.front() != 0) ||
+      (exactCurve.truePositiveRates.back() != 1) || (exactCurve.falsePositiveRates.back() != 1))
+    {
+      return EXIT_FAILURE;
+    }
+
+    // NaN scores are excluded, so they should not change the curve
+    auto labelsWithNaN = realLabels[0], scoresWithNaN = scores[0];
+    for (size_t i = 0; i < 10; i++)
+    {
+      labelsWithNaN.push_back(static_cast< float >(i % 2));
+      scoresWithNaN.push_back(std::numeric_limits< float >::quiet_NaN());
+    }
+    auto exactCurveWithNaN = cbica::GetROCCurve(labelsWithNaN, scoresWithNaN);
+    auto binnedCurveWithNaN = cbica::GetROCCurve(labelsWithNaN, scoresWithNaN, 4096);
+    if ((exactCurveWithNaN.auc != exactCurve.auc) || (binnedCurveWithNaN.auc != binnedCurve.auc) ||
+      (exactCurveWithNaN.positives != exactCurve.positives) || (exactCurveWithNaN.negatives != exactCurve.negatives))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
   if (parser.isPresent("zscore"))
   {
     const std::string dataDir = argv[2];
@@ -567,6 +921,112 @@ int main(int argc, char** argv)
     int blah = 1;
   }
 
+  if (parser.isPresent("streamingStats"))
+  {
+    const std::string dataDir = argv[2];
+    auto input = cbica::readCSVDataFile< float >(dataDir + "/input.csv", true);
+
+    cbica::Statistics< float > batch(input[0]);
+
+    // accumulate the two halves separately and merge, as would be done across threads
+    cbica::Statistics< float > firstHalf, secondHalf, momentsOnly;
+    momentsOnly.SetKeepValues(false);
+    for (size_t i = 0; i < input[0].size(); i++)
+    {
+      ((i < input[0].size() / 2) ? firstHalf : secondHalf).Add(input[0][i]);
+      momentsOnly.Add(input[0][i]);
+    }
+    firstHalf.Merge(secondHalf);
+
+    for (auto streamed : { &firstHalf, &momentsOnly })
+    {
+      if ((streamed->GetCount() != batch.GetCount()) ||
+        (std::abs(streamed->GetMean() - batch.GetMean()) > 1e-5) ||
+        (std::abs(streamed->GetVariance() - batch.GetVariance()) > 1e-5) ||
+        (std::abs(streamed->GetSkewness() - batch.GetSkewness()) > 1e-5) ||
+        (std::abs(streamed->GetKurtosis() - batch.GetKurtosis()) > 1e-5) ||
+        (streamed->GetMinimum() != batch.GetMinimum()) || (streamed->GetMaximum() != batch.GetMaximum()))
+      {
+        return EXIT_FAILURE;
+      }
+    }
+
+    // order statistics through selection should match the fully sorted array
+    auto sorted = input[0];
+    std::sort(sorted.begin(), sorted.end());
+    for (size_t n = 1; n < 100; n += 7)
+    {
+      if (batch.GetNthPercentileElement(n) != sorted[(n * sorted.size()) / 100])
+      {
+        return EXIT_FAILURE;
+      }
+    }
+    auto expectedMedian = (sorted.size() % 2 == 0) ? (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2 : sorted[sorted.size() / 2];
+    if ((batch.GetMedian() != expectedMedian) || (firstHalf.GetMedian() != expectedMedian))
+    {
+      return EXIT_FAILURE;
+    }
+
+    // SetInput() copies, so later changes to the caller's vector do not reach the calculator; SetInputView() does not copy
+    auto changingInput = input[0];
+    cbica::Statistics< float > copied, viewed;
+    copied.SetInput(changingInput);
+    viewed.SetInputView(input[0]);
+    std::fill(changingInput.begin(), changingInput.end(), 0.0f);
+    if ((copied.GetMedian() != expectedMedian) || (viewed.GetMedian() != expectedMedian) ||
+      (copied.GetMean() != batch.GetMean()) || (viewed.GetMean() != batch.GetMean()))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (parser.isPresent("quantileSketch"))
+  {
+    const double rankError = 0.01;
+    const size_t numberOfValues = 500000;
+
+    // two sketched partial calculators (as would be done per thread or per subject) which do not keep the values
+    cbica::Statistics< float > partial_1, partial_2;
+    for (auto partial : { &partial_1, &partial_2 })
+    {
+      partial->SetKeepValues(false);
+      partial->SetQuantileSketch(true, rankError);
+    }
+
+    std::vector< float > allValues(numberOfValues);
+    for (size_t i = 0; i < numberOfValues; i++)
+    {
+      allValues[i] = static_cast< float >(std::sin(0.001 * i) * 100 + (i % 97)); // non-uniform and not sorted
+      ((i % 2 == 0) ? partial_1 : partial_2).Add(allValues[i]);
+    }
+    partial_1.Merge(partial_2);
+    std::sort(allValues.begin(), allValues.end());
+
+    for (size_t n = 1; n < 100; n++)
+    {
+      auto value = partial_1.GetNthPercentileElement(n);
+      auto rank = static_cast< double >(std::lower_bound(allValues.begin(), allValues.end(), value) - allValues.begin()) / numberOfValues;
+      if (std::abs(rank - n / 100.0) > 2 * rankError) // the bound is probabilistic, so allow some slack
+      {
+        return EXIT_FAILURE;
+      }
+    }
+
+    // sketches with different rank errors have different compactor sizes and should not be merged
+    cbica::QuantileSketch< float > sketch_fine(rankError), sketch_coarse(2 * rankError), sketch_same(rankError);
+    for (size_t i = 0; i < 1000; i++)
+    {
+      sketch_fine.Add(allValues[i]);
+      sketch_coarse.Add(allValues[i]);
+      sketch_same.Add(allValues[i]);
+    }
+    if (sketch_fine.Merge(sketch_coarse) || (sketch_fine.GetCount() != 1000) ||
+      !sketch_fine.Merge(sketch_same) || (sketch_fine.GetCount() != 2000))
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
 
   return EXIT_SUCCESS;
 }